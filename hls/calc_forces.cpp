@@ -16,6 +16,8 @@
 #include <hls_math.h>
 #include <ap_int.h>
 #include <ap_axi_sdata.h>
+#include "nbody_build_config.h"
+#include "../src/nbody_config.h"
 
 static ap_uint<64> __mcxx_taskId;
 template<class T>
@@ -32,42 +34,27 @@ typedef ap_axiu<64, 1, 1, 2> mcxx_outaxis;
 void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort);
 void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort);
 
-static constexpr unsigned int NCALCFORCES = 16;
-static constexpr unsigned int FPGA_PWIDTH = 128;
-static constexpr int BLOCK_SIZE = 2048;
-static void calculate_forces_block_moved(float x [BLOCK_SIZE], float y[BLOCK_SIZE], float z[BLOCK_SIZE], const float pos_x1[BLOCK_SIZE], const float pos_y1[BLOCK_SIZE], const float pos_z1[BLOCK_SIZE], const float mass1[BLOCK_SIZE], const float pos_x2[BLOCK_SIZE], const float pos_y2[BLOCK_SIZE], const float pos_z2[BLOCK_SIZE], const float weight2[BLOCK_SIZE])
+static constexpr unsigned int NCALCFORCES = NBODY_NCALCFORCES;
+static constexpr unsigned int FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
+static constexpr int BLOCK_SIZE = NBODY_BLOCK_SIZE;
+//NOTE: Number of target blocks kept in the accelerator. They are mapped by
+//      block index, so consecutive blocks use different entries
+static constexpr int TARGET_CACHE_BLOCKS = 4;
+static constexpr unsigned int PARTICLES_FPGABLOCK_BYTES = 8 * BLOCK_SIZE * sizeof(float);
+//NOTE: The force kernel is shared with the emulator, and NBODY_PRECISION
+//      selects the types of its arithmetic
+#include "calc_forces_kernel.h"
+typedef nbody_precision<NBODY_PRECISION>::acc_t force_t;
+static void calculate_forces_block_moved(force_t forces[3][BLOCK_SIZE], const float target[TARGET_CACHE_BLOCKS][4][BLOCK_SIZE], const int slot, const float source[4][BLOCK_SIZE])
 {
 #pragma HLS inline
-#pragma HLS array_partition variable=x cyclic factor=NCALCFORCES
-#pragma HLS array_partition variable=y cyclic factor=NCALCFORCES
-#pragma HLS array_partition variable=z cyclic factor=NCALCFORCES
-#pragma HLS array_partition variable=pos_x1 cyclic factor=NCALCFORCES/2
-#pragma HLS array_partition variable=pos_y1 cyclic factor=NCALCFORCES/2
-#pragma HLS array_partition variable=pos_z1 cyclic factor=NCALCFORCES/2
-#pragma HLS array_partition variable=mass1 cyclic factor=NCALCFORCES/2
-#pragma HLS array_partition variable=pos_x2 cyclic factor=FPGA_PWIDTH/64
-#pragma HLS array_partition variable=pos_y2 cyclic factor=FPGA_PWIDTH/64
-#pragma HLS array_partition variable=pos_z2 cyclic factor=FPGA_PWIDTH/64
-#pragma HLS array_partition variable=weight2 cyclic factor=FPGA_PWIDTH/64
-	//for (int i=0 ; i < 2048; i++)
-      main_loop: for (int l = 0; l < 2048*2048; l++)
-        {
-//#pragma HLS loop_flatten
-#pragma HLS pipeline II=1
-#pragma HLS unroll factor=NCALCFORCES
-          const float diff_x = pos_x2[l/2048] - pos_x1[l%2048];
-          const float diff_y = pos_y2[l/2048] - pos_y1[l%2048];
-          const float diff_z = pos_z2[l/2048] - pos_z1[l%2048];
-          const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
-          //const float distance = sqrtf(distance_squared);
-          //const float force = mass1[j] / (distance_squared * distance) * weight2[i];
-          const float inv_dist = hls::rsqrtf(distance_squared);
-          const float force = mass1[l%2048] / distance_squared * inv_dist * weight2[l/2048];
-          const float force_corrected = distance_squared == 0 ? 0 : force;
-          x[l%2048] += force_corrected * diff_x;
-          y[l%2048] += force_corrected * diff_y;
-          z[l%2048] += force_corrected * diff_z;
-        }
+#pragma HLS array_partition variable=forces complete dim=1
+#pragma HLS array_partition variable=forces cyclic factor=NCALCFORCES dim=2
+#pragma HLS array_partition variable=target complete dim=2
+#pragma HLS array_partition variable=target cyclic factor=NCALCFORCES/2 dim=3
+#pragma HLS array_partition variable=source complete dim=1
+#pragma HLS array_partition variable=source cyclic factor=FPGA_PWIDTH/64 dim=2
+  nbody_calculate_forces<NBODY_PRECISION, BLOCK_SIZE>(forces, target[slot], source);
 }
 
 void mcxx_write_out_port(const ap_uint<64> data, const ap_uint<2> dest, const ap_uint<1> last, hls::stream<mcxx_outaxis>& mcxx_outPort) {
@@ -78,22 +65,23 @@ void mcxx_write_out_port(const ap_uint<64> data, const ap_uint<2> dest, const ap
    axis_word.last = last;
    mcxx_outPort.write(axis_word);
 }
-void calc_forces_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, ap_uint<128>* mcxx_memport) {
+void calc_forces_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, ap_uint<FPGA_PWIDTH>* mcxx_memport) {
 #pragma HLS interface ap_ctrl_none port=return
 #pragma HLS interface axis port=mcxx_inPort
 #pragma HLS interface axis port=mcxx_outPort
 #pragma HLS interface m_axi port=mcxx_memport
-   static float weight2[2048L];
-   static float pos_x1[2048L];
-   static float pos_y2[2048L];
-   static float pos_z1[2048L];
-   static float y[2048L];
-   static float pos_z2[2048L];
-   static float pos_y1[2048L];
-   static float x[2048L];
-   static float mass1[2048L];
-   static float z[2048L];
-   static float pos_x2[2048L];
+   static force_t forces[3][BLOCK_SIZE];
+   static float target[TARGET_CACHE_BLOCKS][4][BLOCK_SIZE];
+   static float source[4][BLOCK_SIZE];
+   //NOTE: The particle blocks already in the accelerator are tagged with
+   //      their address and with the simulation and step that loaded them,
+   //      since the particles only change between steps
+   static ap_uint<64> source_tag_addr;
+   static ap_uint<64> source_tag_parent;
+   static int source_tag_step = -1;
+   static ap_uint<64> target_tag_addr[TARGET_CACHE_BLOCKS];
+   static ap_uint<64> target_tag_parent[TARGET_CACHE_BLOCKS];
+   static int target_tag_step[TARGET_CACHE_BLOCKS] = {-1, -1, -1, -1};
    mcxx_inPort.read(); //command word
    __mcxx_taskId = mcxx_inPort.read();
    ap_uint<64> __mcxx_parent_taskId = mcxx_inPort.read();
@@ -103,22 +91,7 @@ void calc_forces_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcx
    ap_uint<64> mcxx_offset_1;
    ap_uint<8> mcxx_flags_2;
    ap_uint<64> mcxx_offset_2;
-   ap_uint<8> mcxx_flags_3;
-   ap_uint<64> mcxx_offset_3;
-   ap_uint<8> mcxx_flags_4;
-   ap_uint<64> mcxx_offset_4;
-   ap_uint<8> mcxx_flags_5;
-   ap_uint<64> mcxx_offset_5;
-   ap_uint<8> mcxx_flags_6;
-   ap_uint<64> mcxx_offset_6;
-   ap_uint<8> mcxx_flags_7;
-   ap_uint<64> mcxx_offset_7;
-   ap_uint<8> mcxx_flags_8;
-   ap_uint<64> mcxx_offset_8;
-   ap_uint<8> mcxx_flags_9;
-   ap_uint<64> mcxx_offset_9;
-   ap_uint<8> mcxx_flags_10;
-   ap_uint<64> mcxx_offset_10;
+   int step;
    {
       #pragma HLS protocol fixed
       {
@@ -140,224 +113,88 @@ void calc_forces_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcx
       }
       ap_wait();
       {
+         ap_uint<8> mcxx_flags_3;
+         ap_uint<64> mcxx_offset_3;
          mcxx_flags_3 = mcxx_inPort.read()(7,0);
          ap_wait();
-         mcxx_offset_3 = mcxx_inPort.read();
-      }
-      ap_wait();
-      {
-         mcxx_flags_4 = mcxx_inPort.read()(7,0);
-         ap_wait();
-         mcxx_offset_4 = mcxx_inPort.read();
-      }
-      ap_wait();
-      {
-         mcxx_flags_5 = mcxx_inPort.read()(7,0);
-         ap_wait();
-         mcxx_offset_5 = mcxx_inPort.read();
-      }
-      ap_wait();
-      {
-         mcxx_flags_6 = mcxx_inPort.read()(7,0);
-         ap_wait();
-         mcxx_offset_6 = mcxx_inPort.read();
-      }
-      ap_wait();
-      {
-         mcxx_flags_7 = mcxx_inPort.read()(7,0);
-         ap_wait();
-         mcxx_offset_7 = mcxx_inPort.read();
-      }
-      ap_wait();
-      {
-         mcxx_flags_8 = mcxx_inPort.read()(7,0);
-         ap_wait();
-         mcxx_offset_8 = mcxx_inPort.read();
-      }
-      ap_wait();
-      {
-         mcxx_flags_9 = mcxx_inPort.read()(7,0);
-         ap_wait();
-         mcxx_offset_9 = mcxx_inPort.read();
-      }
-      ap_wait();
-      {
-         mcxx_flags_10 = mcxx_inPort.read()(7,0);
-         ap_wait();
-         mcxx_offset_10 = mcxx_inPort.read();
+         __mcxx_cast<int> mcxx_arg_3;
+         mcxx_arg_3.raw = mcxx_inPort.read();
+         step = mcxx_arg_3.typed;
       }
       ap_wait();
    }
+   const bool source_hit = source_tag_step == step && source_tag_parent == __mcxx_parent_taskId && source_tag_addr == mcxx_offset_2;
+   const int slot = (mcxx_offset_1/PARTICLES_FPGABLOCK_BYTES) % TARGET_CACHE_BLOCKS;
+   const bool target_hit = target_tag_step[slot] == step && target_tag_parent[slot] == __mcxx_parent_taskId && target_tag_addr[slot] == mcxx_offset_1;
    //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
-   if (mcxx_flags_10[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_10/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<const float> cast_tmp;
-            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            weight2[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
-         }
-      }
-   }
-   if (mcxx_flags_3[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_3/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<const float> cast_tmp;
-            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            pos_x1[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
-         }
-      }
-   }
-   if (mcxx_flags_8[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_8/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<const float> cast_tmp;
-            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            pos_y2[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
-         }
-      }
-   }
-   if (mcxx_flags_5[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_5/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<const float> cast_tmp;
-            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            pos_z1[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
-         }
-      }
-   }
-   if (mcxx_flags_1[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<float> cast_tmp;
-            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            y[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
-         }
-      }
-   }
-   if (mcxx_flags_9[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_9/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<const float> cast_tmp;
-            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            pos_z2[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
-         }
-      }
-   }
-   if (mcxx_flags_4[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_4/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<const float> cast_tmp;
-            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            pos_y1[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
-         }
-      }
-   }
+   //NOTE: The force arrays start from zero when they are not copied in,
+   //      for the first contribution of a step in the fused mode
    if (mcxx_flags_0[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+      for (int __i = 0; __i < (((4L) * (3L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
             __mcxx_cast<float> cast_tmp;
             cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            x[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
+            const int __e = __i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j;
+            forces[__e/BLOCK_SIZE][__e%BLOCK_SIZE] = cast_tmp.typed;
          }
       }
-   }
-   if (mcxx_flags_6[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+   } else {
+      for (int __i = 0; __i < BLOCK_SIZE; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_6/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<const float> cast_tmp;
-            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            mass1[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
-         }
+         forces[0][__i] = 0.0f;
+         forces[1][__i] = 0.0f;
+         forces[2][__i] = 0.0f;
       }
    }
-   if (mcxx_flags_2[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+   if (mcxx_flags_1[4] && !target_hit) {
+      for (int __i = 0; __i < (((4L) * (4L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_2/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
             __mcxx_cast<float> cast_tmp;
             cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            z[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
+            const int __e = __i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j;
+            target[slot][__e/BLOCK_SIZE][__e%BLOCK_SIZE] = cast_tmp.typed;
          }
       }
    }
-   if (mcxx_flags_7[4]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+   if (mcxx_flags_2[4] && !source_hit) {
+      for (int __i = 0; __i < (((4L) * (4L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_7/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<const float> cast_tmp;
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_2/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
             cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            pos_x2[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
+            const int __e = __i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j;
+            source[__e/BLOCK_SIZE][__e%BLOCK_SIZE] = cast_tmp.typed;
          }
       }
    }
+   source_tag_addr = mcxx_offset_2;
+   source_tag_parent = __mcxx_parent_taskId;
+   source_tag_step = mcxx_flags_2[4] ? step : -1;
+   target_tag_addr[slot] = mcxx_offset_1;
+   target_tag_parent[slot] = __mcxx_parent_taskId;
+   target_tag_step[slot] = mcxx_flags_1[4] ? step : -1;
    //mcxx_unset_lock(mcxx_outPort);
-   calculate_forces_block_moved(x, y, z, pos_x1, pos_y1, pos_z1, mass1, pos_x2, pos_y2, pos_z2, weight2);
+   calculate_forces_block_moved(forces, target, slot, source);
    //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
-   if (mcxx_flags_1[5]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<float> cast_tmp;
-            cast_tmp.typed = y[__i*(sizeof(ap_uint<128>)/4)+__j];
-            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
-         }
-         *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<128>)+ __i) = __tmpBuffer;
-      }
-   }
    if (mcxx_flags_0[5]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
-      #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
-            __mcxx_cast<float> cast_tmp;
-            cast_tmp.typed = x[__i*(sizeof(ap_uint<128>)/4)+__j];
-            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
-         }
-         *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<128>)+ __i) = __tmpBuffer;
-      }
-   }
-   if (mcxx_flags_2[5]) {
-      for (int __i = 0; __i < (((4L) * (2048L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+      for (int __i = 0; __i < (((4L) * (3L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
             __mcxx_cast<float> cast_tmp;
-            cast_tmp.typed = z[__i*(sizeof(ap_uint<128>)/4)+__j];
+            const int __e = __i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j;
+            cast_tmp.typed = forces[__e/BLOCK_SIZE][__e%BLOCK_SIZE];
             __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
          }
-         *(mcxx_memport + mcxx_offset_2/sizeof(ap_uint<128>)+ __i) = __tmpBuffer;
+         *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
       }
    }
    //mcxx_unset_lock(mcxx_outPort);
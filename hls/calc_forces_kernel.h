@@ -0,0 +1,168 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+// Force kernel of the calc_forces accelerator, templated on the precision.
+// The accelerator and the emulator include it, so the precisions checked by
+// nbody_emu are the code that is synthesized. The includer defines
+// NCALCFORCES, which is used by the pragmas.
+
+#ifndef CALC_FORCES_KERNEL_H
+#define CALC_FORCES_KERNEL_H
+
+#include <hls_math.h>
+#include <hls_half.h>
+#include <ap_fixed.h>
+// NBODY_PRECISION and its values
+#include "../src/nbody_config.h"
+
+//Fields of the hot part of the particle blocks copied in. The target goes
+//from the mass to the z positions and the source from the x positions to
+//the weights, so each one is a single burst
+static constexpr int TARGET_MASS = 0;
+static constexpr int TARGET_POS_X = 1;
+static constexpr int TARGET_POS_Y = 2;
+static constexpr int TARGET_POS_Z = 3;
+static constexpr int SOURCE_POS_X = 0;
+static constexpr int SOURCE_POS_Y = 1;
+static constexpr int SOURCE_POS_Z = 2;
+static constexpr int SOURCE_WEIGHT = 3;
+
+//pos_t:  position differences and squared distances, the rest of the force
+//        is computed in fp32
+//acc_t:  accumulated forces, the force block kept in the accelerator
+//scaled: the positions are taken relative to the center of the two blocks
+//        and in units of a power of two above their extent, so they are in
+//        [-1,1] and fit the narrow types
+template<int PRECISION>
+struct nbody_precision;
+
+template<>
+struct nbody_precision<NBODY_PRECISION_FLOAT> {
+	typedef float pos_t;
+	typedef float acc_t;
+	static const bool scaled = false;
+};
+
+template<>
+struct nbody_precision<NBODY_PRECISION_MIXED> {
+	typedef float pos_t;
+	typedef double acc_t;
+	static const bool scaled = false;
+};
+
+template<>
+struct nbody_precision<NBODY_PRECISION_HALF> {
+	typedef half pos_t;
+	typedef float acc_t;
+	static const bool scaled = true;
+};
+
+template<>
+struct nbody_precision<NBODY_PRECISION_FIXED> {
+	//Differences up to 2 and squared distances up to 12
+	typedef ap_fixed<32, 5> pos_t;
+	typedef float acc_t;
+	static const bool scaled = true;
+};
+
+template<bool SCALED>
+struct nbody_scaled_tag {};
+
+template<int PRECISION, int BS>
+static void nbody_force_loop(typename nbody_precision<PRECISION>::acc_t forces[3][BS],
+	const typename nbody_precision<PRECISION>::pos_t pos_x1[BS], const typename nbody_precision<PRECISION>::pos_t pos_y1[BS],
+	const typename nbody_precision<PRECISION>::pos_t pos_z1[BS], const float mass1[BS],
+	const typename nbody_precision<PRECISION>::pos_t pos_x2[BS], const typename nbody_precision<PRECISION>::pos_t pos_y2[BS],
+	const typename nbody_precision<PRECISION>::pos_t pos_z2[BS], const float weight2[BS])
+{
+#pragma HLS inline
+	typedef typename nbody_precision<PRECISION>::pos_t pos_t;
+	main_loop: for (int l = 0; l < BS*BS; l++)
+	{
+#pragma HLS pipeline II=1
+#pragma HLS unroll factor=NCALCFORCES
+		const pos_t diff_x = pos_x2[l/BS] - pos_x1[l%BS];
+		const pos_t diff_y = pos_y2[l/BS] - pos_y1[l%BS];
+		const pos_t diff_z = pos_z2[l/BS] - pos_z1[l%BS];
+		const pos_t distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+		const float d2 = distance_squared;
+		const float inv_dist = hls::rsqrtf(d2);
+		const float force = mass1[l%BS] / d2 * inv_dist * weight2[l/BS];
+		const float force_corrected = d2 == 0 ? 0 : force;
+		forces[0][l%BS] += force_corrected * (float)diff_x;
+		forces[1][l%BS] += force_corrected * (float)diff_y;
+		forces[2][l%BS] += force_corrected * (float)diff_z;
+	}
+}
+
+template<int PRECISION, int BS>
+static void nbody_calculate_forces(typename nbody_precision<PRECISION>::acc_t forces[3][BS], const float target[4][BS], const float source[4][BS], nbody_scaled_tag<false>)
+{
+#pragma HLS inline
+	nbody_force_loop<PRECISION, BS>(forces, target[TARGET_POS_X], target[TARGET_POS_Y], target[TARGET_POS_Z], target[TARGET_MASS],
+		source[SOURCE_POS_X], source[SOURCE_POS_Y], source[SOURCE_POS_Z], source[SOURCE_WEIGHT]);
+}
+
+//The frame is computed for each task, since the target and source blocks
+//kept in the accelerator are paired with different blocks
+template<int PRECISION, int BS>
+static void nbody_calculate_forces(typename nbody_precision<PRECISION>::acc_t forces[3][BS], const float target[4][BS], const float source[4][BS], nbody_scaled_tag<true>)
+{
+#pragma HLS inline
+	typedef typename nbody_precision<PRECISION>::pos_t pos_t;
+	static pos_t pos1[3][BS];
+	static pos_t pos2[3][BS];
+	static float mass1[BS];
+#pragma HLS array_partition variable=pos1 complete dim=1
+#pragma HLS array_partition variable=pos1 cyclic factor=NCALCFORCES/2 dim=2
+#pragma HLS array_partition variable=pos2 complete dim=1
+#pragma HLS array_partition variable=mass1 cyclic factor=NCALCFORCES/2
+	float center[3];
+	float extent = 0.0f;
+	frame_loop: for (int c = 0; c < 3; c++)
+	{
+		float minimum = target[TARGET_POS_X + c][0];
+		float maximum = minimum;
+		for (int e = 0; e < BS; e++)
+		{
+#pragma HLS pipeline II=1
+			const float t = target[TARGET_POS_X + c][e];
+			const float s = source[SOURCE_POS_X + c][e];
+			minimum = t < minimum ? t : minimum;
+			maximum = t > maximum ? t : maximum;
+			minimum = s < minimum ? s : minimum;
+			maximum = s > maximum ? s : maximum;
+		}
+		center[c] = 0.5f * (minimum + maximum);
+		extent = 0.5f * (maximum - minimum) > extent ? 0.5f * (maximum - minimum) : extent;
+	}
+	//A power of two, so the scaling is exact. The forces of the normalized
+	//positions are unit^2 times the real ones, which is applied to the mass
+	int exponent;
+	hls::frexpf(extent, &exponent);
+	const float inv_unit = hls::ldexpf(1.0f, -exponent);
+	convert_loop: for (int e = 0; e < BS; e++)
+	{
+#pragma HLS pipeline II=1
+		for (int c = 0; c < 3; c++)
+		{
+			pos1[c][e] = (target[TARGET_POS_X + c][e] - center[c]) * inv_unit;
+			pos2[c][e] = (source[SOURCE_POS_X + c][e] - center[c]) * inv_unit;
+		}
+		mass1[e] = target[TARGET_MASS][e] * inv_unit * inv_unit;
+	}
+	nbody_force_loop<PRECISION, BS>(forces, pos1[0], pos1[1], pos1[2], mass1, pos2[0], pos2[1], pos2[2], source[SOURCE_WEIGHT]);
+}
+
+template<int PRECISION, int BS>
+static void nbody_calculate_forces(typename nbody_precision<PRECISION>::acc_t forces[3][BS], const float target[4][BS], const float source[4][BS])
+{
+#pragma HLS inline
+	nbody_calculate_forces<PRECISION, BS>(forces, target, source, nbody_scaled_tag<nbody_precision<PRECISION>::scaled>());
+}
+
+#endif // CALC_FORCES_KERNEL_H
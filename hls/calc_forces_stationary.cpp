@@ -0,0 +1,330 @@
+///////////////////
+// Automatic IP Generated by OmpSs@FPGA compiler
+///////////////////
+// The below code is composed by:
+//  1) User source code, which may be under any license (see in original source code)
+//  2) OmpSs@FPGA toolchain code which is licensed under LGPLv3 terms and conditions
+///////////////////
+// Top IP Function: calc_forces_stationary
+// Accel. type hash: 4294967303
+// Num. instances: 1
+// Wrapper version: 13
+///////////////////
+
+//#include "src/blocking/fpga_distributed/nbody.fpga.h"
+#include <hls_stream.h>
+#include <hls_math.h>
+#include <ap_int.h>
+#include <ap_axi_sdata.h>
+#include "nbody_build_config.h"
+#include "../src/nbody_config.h"
+
+static ap_uint<64> __mcxx_taskId;
+template<class T>
+union __mcxx_cast {
+   unsigned long long int raw;
+   T typed;
+};
+struct mcxx_inaxis {
+   ap_uint<64> data;
+};
+
+typedef ap_axiu<64, 1, 1, 2> mcxx_outaxis;
+
+void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort);
+void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort);
+
+static constexpr unsigned int NCALCFORCES = NBODY_NCALCFORCES;
+static constexpr unsigned int FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
+static constexpr int BLOCK_SIZE = NBODY_BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_X_OFFSET = 1 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_SIZE = 8 * BLOCK_SIZE;
+//Fields of the hot part of a source block, from the x positions to the weights
+static constexpr int SOURCE_POS_X = 0;
+static constexpr int SOURCE_POS_Y = 1;
+static constexpr int SOURCE_POS_Z = 2;
+static constexpr int SOURCE_WEIGHT = 3;
+//The positions and weights of a source block are contiguous, so they are
+//read in a single burst
+static void load_source_block_moved(float dst[4][BLOCK_SIZE], const ap_uint<64> addr, ap_uint<FPGA_PWIDTH>* mcxx_memport)
+{
+#pragma HLS inline
+   for (int __i = 0; __i < (((4L) * (4L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+   #pragma HLS pipeline II=1
+      ap_uint<FPGA_PWIDTH> __tmpBuffer;
+      __tmpBuffer = *(mcxx_memport + addr/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+      for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+         __mcxx_cast<float> cast_tmp;
+         cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+         const int __e = __i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j;
+         dst[__e/BLOCK_SIZE][__e%BLOCK_SIZE] = cast_tmp.typed;
+      }
+   }
+}
+//The force block stays on chip while all the source blocks of the
+//particle array stream through, and it is written back once per step
+static void calculate_forces_stationary_block_moved(float x[BLOCK_SIZE], float y[BLOCK_SIZE], float z[BLOCK_SIZE], const float pos_x1[BLOCK_SIZE], const float pos_y1[BLOCK_SIZE], const float pos_z1[BLOCK_SIZE], const float mass1[BLOCK_SIZE], const ap_uint<64> particles, const int num_blocks, ap_uint<FPGA_PWIDTH>* mcxx_memport)
+{
+#pragma HLS inline
+#pragma HLS array_partition variable=x cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=y cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=z cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=pos_x1 cyclic factor=NCALCFORCES/2
+#pragma HLS array_partition variable=pos_y1 cyclic factor=NCALCFORCES/2
+#pragma HLS array_partition variable=pos_z1 cyclic factor=NCALCFORCES/2
+#pragma HLS array_partition variable=mass1 cyclic factor=NCALCFORCES/2
+   static float source[4][BLOCK_SIZE];
+#pragma HLS array_partition variable=source complete dim=1
+#pragma HLS array_partition variable=source cyclic factor=FPGA_PWIDTH/64 dim=2
+   //NOTE: fp32 only, the host rejects this mode when calc_forces is built
+   //      with another NBODY_PRECISION
+   source_loop: for (int i = 0; i < num_blocks; i++)
+     {
+       const ap_uint<64> block2 = particles + i * PARTICLES_FPGABLOCK_SIZE * sizeof(float);
+       load_source_block_moved(source, block2 + PARTICLES_FPGABLOCK_POS_X_OFFSET * sizeof(float), mcxx_memport);
+       main_loop: for (int l = 0; l < BLOCK_SIZE*BLOCK_SIZE; l++)
+         {
+#pragma HLS pipeline II=1
+#pragma HLS unroll factor=NCALCFORCES
+           const float diff_x = source[SOURCE_POS_X][l/BLOCK_SIZE] - pos_x1[l%BLOCK_SIZE];
+           const float diff_y = source[SOURCE_POS_Y][l/BLOCK_SIZE] - pos_y1[l%BLOCK_SIZE];
+           const float diff_z = source[SOURCE_POS_Z][l/BLOCK_SIZE] - pos_z1[l%BLOCK_SIZE];
+           const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+           const float inv_dist = hls::rsqrtf(distance_squared);
+           const float force = mass1[l%BLOCK_SIZE] / distance_squared * inv_dist * source[SOURCE_WEIGHT][l/BLOCK_SIZE];
+           const float force_corrected = distance_squared == 0 ? 0 : force;
+           x[l%BLOCK_SIZE] += force_corrected * diff_x;
+           y[l%BLOCK_SIZE] += force_corrected * diff_y;
+           z[l%BLOCK_SIZE] += force_corrected * diff_z;
+         }
+     }
+}
+
+void mcxx_write_out_port(const ap_uint<64> data, const ap_uint<2> dest, const ap_uint<1> last, hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   mcxx_outaxis axis_word;
+   axis_word.data = data;
+   axis_word.dest = dest;
+   axis_word.last = last;
+   mcxx_outPort.write(axis_word);
+}
+void calc_forces_stationary_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, ap_uint<FPGA_PWIDTH>* mcxx_memport) {
+#pragma HLS interface ap_ctrl_none port=return
+#pragma HLS interface axis port=mcxx_inPort
+#pragma HLS interface axis port=mcxx_outPort
+#pragma HLS interface m_axi port=mcxx_memport
+   static float x[BLOCK_SIZE];
+   static float y[BLOCK_SIZE];
+   static float z[BLOCK_SIZE];
+   static float pos_x1[BLOCK_SIZE];
+   static float pos_y1[BLOCK_SIZE];
+   static float pos_z1[BLOCK_SIZE];
+   static float mass1[BLOCK_SIZE];
+   mcxx_inPort.read(); //command word
+   __mcxx_taskId = mcxx_inPort.read();
+   ap_uint<64> __mcxx_parent_taskId = mcxx_inPort.read();
+   ap_uint<8> mcxx_flags_0;
+   ap_uint<64> mcxx_offset_0;
+   ap_uint<8> mcxx_flags_1;
+   ap_uint<64> mcxx_offset_1;
+   ap_uint<8> mcxx_flags_2;
+   ap_uint<64> mcxx_offset_2;
+   ap_uint<8> mcxx_flags_3;
+   ap_uint<64> mcxx_offset_3;
+   ap_uint<8> mcxx_flags_4;
+   ap_uint<64> mcxx_offset_4;
+   ap_uint<8> mcxx_flags_5;
+   ap_uint<64> mcxx_offset_5;
+   ap_uint<8> mcxx_flags_6;
+   ap_uint<64> mcxx_offset_6;
+   ap_uint<8> mcxx_flags_7;
+   ap_uint<64> mcxx_offset_7;
+   int num_blocks;
+   {
+      #pragma HLS protocol fixed
+      {
+         mcxx_flags_0 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_0 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_1 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_1 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_2 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_2 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_3 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_3 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_4 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_4 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_5 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_5 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_6 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_6 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_7 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_7 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         ap_uint<8> mcxx_flags_8;
+         ap_uint<64> mcxx_offset_8;
+         mcxx_flags_8 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         __mcxx_cast<int> mcxx_arg_8;
+         mcxx_arg_8.raw = mcxx_inPort.read();
+         num_blocks = mcxx_arg_8.typed;
+      }
+      ap_wait();
+   }
+   //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
+   //NOTE: The forces are only copied out, they start from zero every step
+   for (int __i = 0; __i < BLOCK_SIZE; ++__i) {
+   #pragma HLS pipeline II=1
+      x[__i] = 0.0f;
+      y[__i] = 0.0f;
+      z[__i] = 0.0f;
+   }
+   if (mcxx_flags_3[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_3/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_x1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_4[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_4/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_y1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_5[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_5/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_z1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_6[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_6/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            mass1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   //mcxx_unset_lock(mcxx_outPort);
+   calculate_forces_stationary_block_moved(x, y, z, pos_x1, pos_y1, pos_z1, mass1, mcxx_offset_7, num_blocks, mcxx_memport);
+   //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
+   if (mcxx_flags_0[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = x[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   if (mcxx_flags_1[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = y[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   if (mcxx_flags_2[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = z[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_2/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   //mcxx_unset_lock(mcxx_outPort);
+   {
+      #pragma HLS protocol fixed
+      ap_uint<64> header = 0x03;
+      ap_wait();
+      mcxx_write_out_port(header, 0, 0, mcxx_outPort);
+      ap_wait();
+      mcxx_write_out_port(__mcxx_taskId, 0, 0, mcxx_outPort);
+      ap_wait();
+      mcxx_write_out_port(__mcxx_parent_taskId, 0, 1, mcxx_outPort);
+      ap_wait();
+   }
+}
+
+void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   ap_uint<64> tmp = 0x4;
+   ap_uint<8> ack;
+   do {
+      ap_wait();
+      mcxx_write_out_port(tmp, 1, 1, mcxx_outPort);
+      ap_wait();
+      ack = mcxx_inPort.read();
+      ap_wait();
+   } while (ack == 0);
+}
+
+void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   ap_uint<64> tmp = 0x6;
+   mcxx_write_out_port(tmp, 1, 1, mcxx_outPort);
+}
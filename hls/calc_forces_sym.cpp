@@ -0,0 +1,540 @@
+///////////////////
+// Automatic IP Generated by OmpSs@FPGA compiler
+///////////////////
+// The below code is composed by:
+//  1) User source code, which may be under any license (see in original source code)
+//  2) OmpSs@FPGA toolchain code which is licensed under LGPLv3 terms and conditions
+///////////////////
+// Top IP Function: calc_forces_sym
+// Accel. type hash: 4294967301
+// Num. instances: 1
+// Wrapper version: 13
+///////////////////
+
+#include <hls_stream.h>
+#include <hls_math.h>
+#include <ap_int.h>
+#include <ap_axi_sdata.h>
+#include "nbody_build_config.h"
+#include "../src/nbody_config.h"
+
+static ap_uint<64> __mcxx_taskId;
+template<class T>
+union __mcxx_cast {
+   unsigned long long int raw;
+   T typed;
+};
+struct mcxx_inaxis {
+   ap_uint<64> data;
+};
+
+typedef ap_axiu<64, 1, 1, 2> mcxx_outaxis;
+
+void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort);
+void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort);
+
+static constexpr unsigned int NCALCFORCES = NBODY_NCALCFORCES;
+static constexpr unsigned int FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
+static constexpr int BLOCK_SIZE = NBODY_BLOCK_SIZE;
+//NOTE: Latency of the floating point adder, the source partial sums are
+//      spread over this many accumulators to keep the inner loop at II=1
+static constexpr int FADD_LATENCY = 8;
+static void calculate_forces_sym_block_moved(float x1[BLOCK_SIZE], float y1[BLOCK_SIZE], float z1[BLOCK_SIZE], float x2[BLOCK_SIZE], float y2[BLOCK_SIZE], float z2[BLOCK_SIZE], const float pos_x1[BLOCK_SIZE], const float pos_y1[BLOCK_SIZE], const float pos_z1[BLOCK_SIZE], const float mass1[BLOCK_SIZE], const float pos_x2[BLOCK_SIZE], const float pos_y2[BLOCK_SIZE], const float pos_z2[BLOCK_SIZE], const float weight2[BLOCK_SIZE])
+{
+#pragma HLS inline
+#pragma HLS array_partition variable=x1 cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=y1 cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=z1 cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=x2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=y2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=z2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=pos_x1 cyclic factor=NCALCFORCES/2
+#pragma HLS array_partition variable=pos_y1 cyclic factor=NCALCFORCES/2
+#pragma HLS array_partition variable=pos_z1 cyclic factor=NCALCFORCES/2
+#pragma HLS array_partition variable=mass1 cyclic factor=NCALCFORCES/2
+#pragma HLS array_partition variable=pos_x2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=pos_y2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=pos_z2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=weight2 cyclic factor=FPGA_PWIDTH/64
+      //NOTE: fp32 only, the host rejects this mode when calc_forces is built
+      //      with another NBODY_PRECISION
+      //Every pair is visited once: the force goes to target j of block 1
+      //and the opposite one to source i of block 2
+      source_loop: for (int i = 0; i < BLOCK_SIZE; i++)
+        {
+          float acc_x[FADD_LATENCY];
+          float acc_y[FADD_LATENCY];
+          float acc_z[FADD_LATENCY];
+#pragma HLS array_partition variable=acc_x complete
+#pragma HLS array_partition variable=acc_y complete
+#pragma HLS array_partition variable=acc_z complete
+          for (int a = 0; a < FADD_LATENCY; a++)
+            {
+#pragma HLS unroll
+              acc_x[a] = 0;
+              acc_y[a] = 0;
+              acc_z[a] = 0;
+            }
+          target_loop: for (int j = 0; j < BLOCK_SIZE; j += NCALCFORCES)
+            {
+#pragma HLS pipeline II=1
+#pragma HLS dependence variable=acc_x inter distance=FADD_LATENCY true
+#pragma HLS dependence variable=acc_y inter distance=FADD_LATENCY true
+#pragma HLS dependence variable=acc_z inter distance=FADD_LATENCY true
+              float part_x = 0;
+              float part_y = 0;
+              float part_z = 0;
+              for (int k = 0; k < NCALCFORCES; k++)
+                {
+#pragma HLS unroll
+                  const float diff_x = pos_x2[i] - pos_x1[j+k];
+                  const float diff_y = pos_y2[i] - pos_y1[j+k];
+                  const float diff_z = pos_z2[i] - pos_z1[j+k];
+                  const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+                  const float inv_dist = hls::rsqrtf(distance_squared);
+                  const float force = mass1[j+k] / distance_squared * inv_dist * weight2[i];
+                  const float force_corrected = distance_squared == 0 ? 0 : force;
+                  x1[j+k] += force_corrected * diff_x;
+                  y1[j+k] += force_corrected * diff_y;
+                  z1[j+k] += force_corrected * diff_z;
+                  part_x += force_corrected * diff_x;
+                  part_y += force_corrected * diff_y;
+                  part_z += force_corrected * diff_z;
+                }
+              acc_x[(j/NCALCFORCES)%FADD_LATENCY] += part_x;
+              acc_y[(j/NCALCFORCES)%FADD_LATENCY] += part_y;
+              acc_z[(j/NCALCFORCES)%FADD_LATENCY] += part_z;
+            }
+          float sum_x = 0;
+          float sum_y = 0;
+          float sum_z = 0;
+          for (int a = 0; a < FADD_LATENCY; a++)
+            {
+#pragma HLS unroll
+              sum_x += acc_x[a];
+              sum_y += acc_y[a];
+              sum_z += acc_z[a];
+            }
+          x2[i] -= sum_x;
+          y2[i] -= sum_y;
+          z2[i] -= sum_z;
+        }
+}
+
+void mcxx_write_out_port(const ap_uint<64> data, const ap_uint<2> dest, const ap_uint<1> last, hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   mcxx_outaxis axis_word;
+   axis_word.data = data;
+   axis_word.dest = dest;
+   axis_word.last = last;
+   mcxx_outPort.write(axis_word);
+}
+void calc_forces_sym_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, ap_uint<FPGA_PWIDTH>* mcxx_memport) {
+#pragma HLS interface ap_ctrl_none port=return
+#pragma HLS interface axis port=mcxx_inPort
+#pragma HLS interface axis port=mcxx_outPort
+#pragma HLS interface m_axi port=mcxx_memport
+   static float x1[BLOCK_SIZE];
+   static float y1[BLOCK_SIZE];
+   static float z1[BLOCK_SIZE];
+   static float x2[BLOCK_SIZE];
+   static float y2[BLOCK_SIZE];
+   static float z2[BLOCK_SIZE];
+   static float pos_x1[BLOCK_SIZE];
+   static float pos_y1[BLOCK_SIZE];
+   static float pos_z1[BLOCK_SIZE];
+   static float mass1[BLOCK_SIZE];
+   static float pos_x2[BLOCK_SIZE];
+   static float pos_y2[BLOCK_SIZE];
+   static float pos_z2[BLOCK_SIZE];
+   static float weight2[BLOCK_SIZE];
+   mcxx_inPort.read(); //command word
+   __mcxx_taskId = mcxx_inPort.read();
+   ap_uint<64> __mcxx_parent_taskId = mcxx_inPort.read();
+   ap_uint<8> mcxx_flags_0;
+   ap_uint<64> mcxx_offset_0;
+   ap_uint<8> mcxx_flags_1;
+   ap_uint<64> mcxx_offset_1;
+   ap_uint<8> mcxx_flags_2;
+   ap_uint<64> mcxx_offset_2;
+   ap_uint<8> mcxx_flags_3;
+   ap_uint<64> mcxx_offset_3;
+   ap_uint<8> mcxx_flags_4;
+   ap_uint<64> mcxx_offset_4;
+   ap_uint<8> mcxx_flags_5;
+   ap_uint<64> mcxx_offset_5;
+   ap_uint<8> mcxx_flags_6;
+   ap_uint<64> mcxx_offset_6;
+   ap_uint<8> mcxx_flags_7;
+   ap_uint<64> mcxx_offset_7;
+   ap_uint<8> mcxx_flags_8;
+   ap_uint<64> mcxx_offset_8;
+   ap_uint<8> mcxx_flags_9;
+   ap_uint<64> mcxx_offset_9;
+   ap_uint<8> mcxx_flags_10;
+   ap_uint<64> mcxx_offset_10;
+   ap_uint<8> mcxx_flags_11;
+   ap_uint<64> mcxx_offset_11;
+   ap_uint<8> mcxx_flags_12;
+   ap_uint<64> mcxx_offset_12;
+   ap_uint<8> mcxx_flags_13;
+   ap_uint<64> mcxx_offset_13;
+   {
+      #pragma HLS protocol fixed
+      {
+         mcxx_flags_0 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_0 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_1 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_1 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_2 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_2 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_3 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_3 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_4 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_4 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_5 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_5 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_6 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_6 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_7 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_7 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_8 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_8 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_9 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_9 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_10 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_10 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_11 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_11 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_12 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_12 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_13 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_13 = mcxx_inPort.read();
+      }
+      ap_wait();
+   }
+   if (mcxx_flags_0[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            x1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_1[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            y1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_2[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_2/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            z1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_3[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_3/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            x2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_4[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_4/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            y2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_5[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_5/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            z2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_6[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_6/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_x1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_7[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_7/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_y1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_8[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_8/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_z1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_9[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_9/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            mass1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_10[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_10/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_x2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_11[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_11/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_y2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_12[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_12/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_z2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_13[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_13/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            weight2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   calculate_forces_sym_block_moved(x1, y1, z1, x2, y2, z2, pos_x1, pos_y1, pos_z1, mass1, pos_x2, pos_y2, pos_z2, weight2);
+   if (mcxx_flags_0[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = x1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   if (mcxx_flags_1[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = y1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   if (mcxx_flags_2[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = z1[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_2/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   if (mcxx_flags_3[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = x2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_3/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   if (mcxx_flags_4[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = y2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_4/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   if (mcxx_flags_5[5]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = z2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_5/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   {
+      #pragma HLS protocol fixed
+      ap_uint<64> header = 0x03;
+      ap_wait();
+      mcxx_write_out_port(header, 0, 0, mcxx_outPort);
+      ap_wait();
+      mcxx_write_out_port(__mcxx_taskId, 0, 0, mcxx_outPort);
+      ap_wait();
+      mcxx_write_out_port(__mcxx_parent_taskId, 0, 1, mcxx_outPort);
+      ap_wait();
+   }
+}
+
+void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   ap_uint<64> tmp = 0x4;
+   ap_uint<8> ack;
+   do {
+      ap_wait();
+      mcxx_write_out_port(tmp, 1, 1, mcxx_outPort);
+      ap_wait();
+      ack = mcxx_inPort.read();
+      ap_wait();
+   } while (ack == 0);
+}
+
+void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   ap_uint<64> tmp = 0x6;
+   mcxx_write_out_port(tmp, 1, 1, mcxx_outPort);
+}
@@ -0,0 +1,380 @@
+///////////////////
+// Automatic IP Generated by OmpSs@FPGA compiler
+///////////////////
+// The below code is composed by:
+//  1) User source code, which may be under any license (see in original source code)
+//  2) OmpSs@FPGA toolchain code which is licensed under LGPLv3 terms and conditions
+///////////////////
+// Top IP Function: calc_forces_update
+// Accel. type hash: 4294967302
+// Num. instances: 1
+// Wrapper version: 13
+///////////////////
+
+//#include "src/blocking/fpga_distributed/nbody.fpga.h"
+#include <hls_stream.h>
+#include <hls_math.h>
+#include <ap_int.h>
+#include <ap_axi_sdata.h>
+#include "nbody_build_config.h"
+#include "../src/nbody_config.h"
+
+static ap_uint<64> __mcxx_taskId;
+template<class T>
+union __mcxx_cast {
+   unsigned long long int raw;
+   T typed;
+};
+struct mcxx_inaxis {
+   ap_uint<64> data;
+};
+
+typedef ap_axiu<64, 1, 1, 2> mcxx_outaxis;
+
+void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort);
+void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort);
+
+static constexpr unsigned int NCALCFORCES = NBODY_NCALCFORCES;
+static constexpr unsigned int FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
+static constexpr int BLOCK_SIZE = NBODY_BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_MASS_OFFSET = 0 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_X_OFFSET = 1 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_Y_OFFSET = 2 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_Z_OFFSET = 3 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_X_OFFSET = 5 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_Y_OFFSET = 6 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_Z_OFFSET = 7 * BLOCK_SIZE;
+//Last source block contribution to a force block followed by the update of
+//the target particles, without writing the forces back to memory
+static void calculate_forces_update_block_moved(float x[BLOCK_SIZE], float y[BLOCK_SIZE], float z[BLOCK_SIZE], float particles[8 * BLOCK_SIZE], const float pos_x2[BLOCK_SIZE], const float pos_y2[BLOCK_SIZE], const float pos_z2[BLOCK_SIZE], const float weight2[BLOCK_SIZE], const float time_interval)
+{
+#pragma HLS inline
+#pragma HLS array_partition variable=x cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=y cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=z cyclic factor=NCALCFORCES
+#pragma HLS array_partition variable=particles cyclic factor=NCALCFORCES/2
+#pragma HLS array_partition variable=pos_x2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=pos_y2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=pos_z2 cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=weight2 cyclic factor=FPGA_PWIDTH/64
+      //NOTE: fp32 only, the host rejects this mode when calc_forces is built
+      //      with another NBODY_PRECISION
+      main_loop: for (int l = 0; l < BLOCK_SIZE*BLOCK_SIZE; l++)
+        {
+#pragma HLS pipeline II=1
+#pragma HLS unroll factor=NCALCFORCES
+          const float diff_x = pos_x2[l/BLOCK_SIZE] - particles[PARTICLES_FPGABLOCK_POS_X_OFFSET + l%BLOCK_SIZE];
+          const float diff_y = pos_y2[l/BLOCK_SIZE] - particles[PARTICLES_FPGABLOCK_POS_Y_OFFSET + l%BLOCK_SIZE];
+          const float diff_z = pos_z2[l/BLOCK_SIZE] - particles[PARTICLES_FPGABLOCK_POS_Z_OFFSET + l%BLOCK_SIZE];
+          const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+          const float inv_dist = hls::rsqrtf(distance_squared);
+          const float force = particles[PARTICLES_FPGABLOCK_MASS_OFFSET + l%BLOCK_SIZE] / distance_squared * inv_dist * weight2[l/BLOCK_SIZE];
+          const float force_corrected = distance_squared == 0 ? 0 : force;
+          x[l%BLOCK_SIZE] += force_corrected * diff_x;
+          y[l%BLOCK_SIZE] += force_corrected * diff_y;
+          z[l%BLOCK_SIZE] += force_corrected * diff_z;
+        }
+      update_loop: for (int e = 0; e < BLOCK_SIZE; e++)
+        {
+#pragma HLS pipeline II=1
+#pragma HLS dependence variable=particles inter false
+          const float mass = particles[PARTICLES_FPGABLOCK_MASS_OFFSET + e];
+          const float velocity_x = particles[PARTICLES_FPGABLOCK_VEL_X_OFFSET + e];
+          const float velocity_y = particles[PARTICLES_FPGABLOCK_VEL_Y_OFFSET + e];
+          const float velocity_z = particles[PARTICLES_FPGABLOCK_VEL_Z_OFFSET + e];
+          const float position_x = particles[PARTICLES_FPGABLOCK_POS_X_OFFSET + e];
+          const float position_y = particles[PARTICLES_FPGABLOCK_POS_Y_OFFSET + e];
+          const float position_z = particles[PARTICLES_FPGABLOCK_POS_Z_OFFSET + e];
+          //The padding of a partial block has no mass and does not move
+          const float time_by_mass = mass == 0.0f ? 0.0f : time_interval / mass;
+          const float half_time_interval = 5.000000000000000000000000e-01f * time_interval;
+          const float velocity_change_x = x[e] * time_by_mass;
+          const float velocity_change_y = y[e] * time_by_mass;
+          const float velocity_change_z = z[e] * time_by_mass;
+          const float position_change_x = velocity_x * time_interval + velocity_change_x * half_time_interval;
+          const float position_change_y = velocity_y * time_interval + velocity_change_y * half_time_interval;
+          const float position_change_z = velocity_z * time_interval + velocity_change_z * half_time_interval;
+          particles[PARTICLES_FPGABLOCK_VEL_X_OFFSET + e] = velocity_x + velocity_change_x;
+          particles[PARTICLES_FPGABLOCK_VEL_Y_OFFSET + e] = velocity_y + velocity_change_y;
+          particles[PARTICLES_FPGABLOCK_VEL_Z_OFFSET + e] = velocity_z + velocity_change_z;
+          particles[PARTICLES_FPGABLOCK_POS_X_OFFSET + e] = position_x + position_change_x;
+          particles[PARTICLES_FPGABLOCK_POS_Y_OFFSET + e] = position_y + position_change_y;
+          particles[PARTICLES_FPGABLOCK_POS_Z_OFFSET + e] = position_z + position_change_z;
+        }
+}
+
+void mcxx_write_out_port(const ap_uint<64> data, const ap_uint<2> dest, const ap_uint<1> last, hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   mcxx_outaxis axis_word;
+   axis_word.data = data;
+   axis_word.dest = dest;
+   axis_word.last = last;
+   mcxx_outPort.write(axis_word);
+}
+void calc_forces_update_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, ap_uint<FPGA_PWIDTH>* mcxx_memport) {
+#pragma HLS interface ap_ctrl_none port=return
+#pragma HLS interface axis port=mcxx_inPort
+#pragma HLS interface axis port=mcxx_outPort
+#pragma HLS interface m_axi port=mcxx_memport
+   static float x[BLOCK_SIZE];
+   static float y[BLOCK_SIZE];
+   static float z[BLOCK_SIZE];
+   static float particles[8 * BLOCK_SIZE];
+   static float pos_x2[BLOCK_SIZE];
+   static float pos_y2[BLOCK_SIZE];
+   static float pos_z2[BLOCK_SIZE];
+   static float weight2[BLOCK_SIZE];
+   mcxx_inPort.read(); //command word
+   __mcxx_taskId = mcxx_inPort.read();
+   ap_uint<64> __mcxx_parent_taskId = mcxx_inPort.read();
+   ap_uint<8> mcxx_flags_0;
+   ap_uint<64> mcxx_offset_0;
+   ap_uint<8> mcxx_flags_1;
+   ap_uint<64> mcxx_offset_1;
+   ap_uint<8> mcxx_flags_2;
+   ap_uint<64> mcxx_offset_2;
+   ap_uint<8> mcxx_flags_3;
+   ap_uint<64> mcxx_offset_3;
+   ap_uint<8> mcxx_flags_4;
+   ap_uint<64> mcxx_offset_4;
+   ap_uint<8> mcxx_flags_5;
+   ap_uint<64> mcxx_offset_5;
+   ap_uint<8> mcxx_flags_6;
+   ap_uint<64> mcxx_offset_6;
+   ap_uint<8> mcxx_flags_7;
+   ap_uint<64> mcxx_offset_7;
+   float time_interval;
+   {
+      #pragma HLS protocol fixed
+      {
+         mcxx_flags_0 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_0 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_1 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_1 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_2 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_2 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_3 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_3 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_4 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_4 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_5 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_5 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_6 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_6 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_7 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_7 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         ap_uint<8> mcxx_flags_8;
+         ap_uint<64> mcxx_offset_8;
+         mcxx_flags_8 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         __mcxx_cast<float> mcxx_arg_8;
+         mcxx_arg_8.raw = mcxx_inPort.read();
+         time_interval = mcxx_arg_8.typed;
+      }
+      ap_wait();
+   }
+   //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
+   //NOTE: The forces are not copied in when this is also the first
+   //      contribution of the step, they start from zero instead
+   if (mcxx_flags_0[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            x[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   } else {
+      for (int __i = 0; __i < BLOCK_SIZE; ++__i) {
+      #pragma HLS pipeline II=1
+         x[__i] = 0.0f;
+      }
+   }
+   if (mcxx_flags_1[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            y[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   } else {
+      for (int __i = 0; __i < BLOCK_SIZE; ++__i) {
+      #pragma HLS pipeline II=1
+         y[__i] = 0.0f;
+      }
+   }
+   if (mcxx_flags_2[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_2/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            z[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   } else {
+      for (int __i = 0; __i < BLOCK_SIZE; ++__i) {
+      #pragma HLS pipeline II=1
+         z[__i] = 0.0f;
+      }
+   }
+   if (mcxx_flags_3[4]) {
+      for (int __i = 0; __i < (((4L) * (8L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_3/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            particles[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_4[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_4/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_x2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_5[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_5/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_y2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_6[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_6/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            pos_z2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_7[4]) {
+      for (int __i = 0; __i < (((4L) * (BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_7/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            weight2[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   //mcxx_unset_lock(mcxx_outPort);
+   calculate_forces_update_block_moved(x, y, z, particles, pos_x2, pos_y2, pos_z2, weight2, time_interval);
+   //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
+   //NOTE: Only the positions and velocities change, mass and weight are
+   //      not written back
+   if (mcxx_flags_3[5]) {
+      for (int __i = 0; __i < (((4L) * (3L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = particles[PARTICLES_FPGABLOCK_POS_X_OFFSET + __i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + (mcxx_offset_3 + PARTICLES_FPGABLOCK_POS_X_OFFSET*sizeof(float))/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+      for (int __i = 0; __i < (((4L) * (3L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = particles[PARTICLES_FPGABLOCK_VEL_X_OFFSET + __i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + (mcxx_offset_3 + PARTICLES_FPGABLOCK_VEL_X_OFFSET*sizeof(float))/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   //mcxx_unset_lock(mcxx_outPort);
+   {
+      #pragma HLS protocol fixed
+      ap_uint<64> header = 0x03;
+      ap_wait();
+      mcxx_write_out_port(header, 0, 0, mcxx_outPort);
+      ap_wait();
+      mcxx_write_out_port(__mcxx_taskId, 0, 0, mcxx_outPort);
+      ap_wait();
+      mcxx_write_out_port(__mcxx_parent_taskId, 0, 1, mcxx_outPort);
+      ap_wait();
+   }
+}
+
+void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   ap_uint<64> tmp = 0x4;
+   ap_uint<8> ack;
+   do {
+      ap_wait();
+      mcxx_write_out_port(tmp, 1, 1, mcxx_outPort);
+      ap_wait();
+      ack = mcxx_inPort.read();
+      ap_wait();
+   } while (ack == 0);
+}
+
+void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   ap_uint<64> tmp = 0x6;
+   mcxx_write_out_port(tmp, 1, 1, mcxx_outPort);
+}
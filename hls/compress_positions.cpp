@@ -0,0 +1,225 @@
+///////////////////
+// Automatic IP Generated by OmpSs@FPGA compiler
+///////////////////
+// The below code is composed by:
+//  1) User source code, which may be under any license (see in original source code)
+//  2) OmpSs@FPGA toolchain code which is licensed under LGPLv3 terms and conditions
+///////////////////
+// Top IP Function: compress_positions
+// Accel. type hash: 4294967304
+// Num. instances: 1
+// Wrapper version: 13
+///////////////////
+
+#include <hls_stream.h>
+#include <ap_int.h>
+#include <ap_axi_sdata.h>
+#include "nbody_build_config.h"
+#include "../src/nbody_config.h"
+
+static ap_uint<64> __mcxx_taskId;
+template<class T>
+union __mcxx_cast {
+   unsigned long long int raw;
+   T typed;
+};
+struct mcxx_inaxis {
+   ap_uint<64> data;
+};
+
+typedef ap_axiu<64, 1, 1, 2> mcxx_outaxis;
+
+void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort);
+void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort);
+
+static const unsigned int FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
+static const int BLOCK_SIZE = NBODY_BLOCK_SIZE;
+static const unsigned int PACKED_FPGABLOCK_ORIGIN_OFFSET = 0;
+static const unsigned int PACKED_FPGABLOCK_SCALE_OFFSET = 4;
+static const unsigned int PACKED_FPGABLOCK_HEADER_SIZE = 16;
+static const unsigned int PACKED_FPGABLOCK_SIZE = 16 + 3 * BLOCK_SIZE / 2;
+static const float PACKED_MAX_VALUE = 65535.0f;
+//Each position is stored as a 16-bit offset from the minimum of its block,
+//so the error is at most half a step of the grid: (max-min)/131070
+static void compress_positions_block_moved(float positions[3 * BLOCK_SIZE], unsigned int packed[PACKED_FPGABLOCK_SIZE], const int decode)
+{
+#pragma HLS inline
+#pragma HLS array_partition variable=positions cyclic factor=FPGA_PWIDTH/64
+#pragma HLS array_partition variable=packed cyclic factor=FPGA_PWIDTH/64
+  for (int c = 0; c < 3; c++)
+    {
+      const int pos_offset = c * BLOCK_SIZE;
+      const int packed_offset = PACKED_FPGABLOCK_HEADER_SIZE + c * BLOCK_SIZE / 2;
+      if (decode)
+        {
+          __mcxx_cast<float> origin, scale;
+          origin.raw = packed[PACKED_FPGABLOCK_ORIGIN_OFFSET + c];
+          scale.raw = packed[PACKED_FPGABLOCK_SCALE_OFFSET + c];
+          for (int e = 0; e < BLOCK_SIZE / 2; e++)
+            {
+#pragma HLS pipeline II=1
+              const unsigned int word = packed[packed_offset + e];
+              positions[pos_offset + 2 * e] = origin.typed + (float)(word & 0xFFFF) * scale.typed;
+              positions[pos_offset + 2 * e + 1] = origin.typed + (float)(word >> 16) * scale.typed;
+            }
+        }
+      else
+        {
+          float minimum = positions[pos_offset];
+          float maximum = positions[pos_offset];
+          for (int e = 1; e < BLOCK_SIZE; e++)
+            {
+#pragma HLS pipeline II=1
+              const float value = positions[pos_offset + e];
+              minimum = value < minimum ? value : minimum;
+              maximum = value > maximum ? value : maximum;
+            }
+          const float range = maximum - minimum;
+          const float scale = range / PACKED_MAX_VALUE;
+          const float inv_scale = range == 0 ? 0 : PACKED_MAX_VALUE / range;
+          __mcxx_cast<float> origin_cast, scale_cast;
+          origin_cast.typed = minimum;
+          scale_cast.typed = scale;
+          packed[PACKED_FPGABLOCK_ORIGIN_OFFSET + c] = origin_cast.raw;
+          packed[PACKED_FPGABLOCK_SCALE_OFFSET + c] = scale_cast.raw;
+          for (int e = 0; e < BLOCK_SIZE / 2; e++)
+            {
+#pragma HLS pipeline II=1
+              const float low = (positions[pos_offset + 2 * e] - minimum) * inv_scale + 0.5f;
+              const float high = (positions[pos_offset + 2 * e + 1] - minimum) * inv_scale + 0.5f;
+              const unsigned int q_low = low >= PACKED_MAX_VALUE ? 0xFFFF : (unsigned int)low;
+              const unsigned int q_high = high >= PACKED_MAX_VALUE ? 0xFFFF : (unsigned int)high;
+              packed[packed_offset + e] = q_low | q_high << 16;
+            }
+        }
+    }
+}
+
+void mcxx_write_out_port(const ap_uint<64> data, const ap_uint<2> dest, const ap_uint<1> last, hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   mcxx_outaxis axis_word;
+   axis_word.data = data;
+   axis_word.dest = dest;
+   axis_word.last = last;
+   mcxx_outPort.write(axis_word);
+}
+void compress_positions_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, ap_uint<FPGA_PWIDTH>* mcxx_memport) {
+#pragma HLS interface ap_ctrl_none port=return
+#pragma HLS interface axis port=mcxx_inPort
+#pragma HLS interface axis port=mcxx_outPort
+#pragma HLS interface m_axi port=mcxx_memport
+   static float positions[3 * BLOCK_SIZE];
+   static unsigned int packed[PACKED_FPGABLOCK_SIZE];
+   mcxx_inPort.read(); //command word
+   __mcxx_taskId = mcxx_inPort.read();
+   ap_uint<64> __mcxx_parent_taskId = mcxx_inPort.read();
+   ap_uint<8> mcxx_flags_0;
+   ap_uint<64> mcxx_offset_0;
+   ap_uint<8> mcxx_flags_1;
+   ap_uint<64> mcxx_offset_1;
+   int decode;
+   {
+      #pragma HLS protocol fixed
+      {
+         mcxx_flags_0 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_0 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         mcxx_flags_1 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         mcxx_offset_1 = mcxx_inPort.read();
+      }
+      ap_wait();
+      {
+         ap_uint<8> mcxx_flags_2;
+         ap_uint<64> mcxx_offset_2;
+         mcxx_flags_2 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         __mcxx_cast<int> mcxx_arg_2;
+         mcxx_arg_2.raw = mcxx_inPort.read();
+         decode = mcxx_arg_2.typed;
+      }
+      ap_wait();
+   }
+   //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
+   if (mcxx_flags_0[4]) {
+      for (int __i = 0; __i < (((4L) * (3L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+            positions[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
+         }
+      }
+   }
+   if (mcxx_flags_1[4]) {
+      for (int __i = 0; __i < (((4L) * (PACKED_FPGABLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            packed[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
+         }
+      }
+   }
+   //mcxx_unset_lock(mcxx_outPort);
+   compress_positions_block_moved(positions, packed, decode);
+   //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
+   if (mcxx_flags_0[5]) {
+      for (int __i = 0; __i < (((4L) * (3L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __mcxx_cast<float> cast_tmp;
+            cast_tmp.typed = positions[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
+         }
+         *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   if (mcxx_flags_1[5]) {
+      for (int __i = 0; __i < (((4L) * (PACKED_FPGABLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
+            __tmpBuffer((__j+1)*4*8-1,__j*4*8) = packed[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
+         }
+         *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
+      }
+   }
+   //mcxx_unset_lock(mcxx_outPort);
+   {
+      #pragma HLS protocol fixed
+      ap_uint<64> header = 0x03;
+      ap_wait();
+      mcxx_write_out_port(header, 0, 0, mcxx_outPort);
+      ap_wait();
+      mcxx_write_out_port(__mcxx_taskId, 0, 0, mcxx_outPort);
+      ap_wait();
+      mcxx_write_out_port(__mcxx_parent_taskId, 0, 1, mcxx_outPort);
+      ap_wait();
+   }
+}
+
+void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   ap_uint<64> tmp = 0x4;
+   ap_uint<8> ack;
+   do {
+      ap_wait();
+      mcxx_write_out_port(tmp, 1, 1, mcxx_outPort);
+      ap_wait();
+      ack = mcxx_inPort.read();
+      ap_wait();
+   } while (ack == 0);
+}
+
+void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+   ap_uint<64> tmp = 0x6;
+   mcxx_write_out_port(tmp, 1, 1, mcxx_outPort);
+}
@@ -0,0 +1,26 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+// Host stand-in of the Vitis HLS AXI stream words
+
+#ifndef EMU_AP_AXI_SDATA_H
+#define EMU_AP_AXI_SDATA_H
+
+#include "ap_int.h"
+
+template<int D, int U, int TI, int TD>
+struct ap_axiu {
+	ap_uint<D> data;
+	ap_uint<(D + 7)/8> keep;
+	ap_uint<(D + 7)/8> strb;
+	ap_uint<U> user;
+	ap_uint<1> last;
+	ap_uint<TI> id;
+	ap_uint<TD> dest;
+};
+
+#endif // EMU_AP_AXI_SDATA_H
@@ -0,0 +1,41 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+// Host stand-in of the Vitis HLS signed fixed point type, with the default
+// truncation (AP_TRN) and wrap around (AP_WRAP) modes. The results of the
+// operations, which are wider in Vitis, are computed in double and only
+// quantized when they are assigned to an ap_fixed.
+
+#ifndef EMU_AP_FIXED_H
+#define EMU_AP_FIXED_H
+
+#include <math.h>
+
+template<int W, int I>
+struct ap_fixed {
+	static_assert(W <= 32, "the emulated fixed point values must fit in a double");
+
+	long long val; // in units of 2^(I-W)
+
+	ap_fixed() : val(0) {}
+	ap_fixed(double v)
+	{
+		const long long raw = (long long)floor(ldexp(v, W - I));
+		val = (long long)((unsigned long long)raw << (64 - W)) >> (64 - W);
+	}
+
+	operator double() const
+	{
+		return ldexp((double)val, I - W);
+	}
+};
+
+template<int W, int I> static inline double operator+(ap_fixed<W, I> a, ap_fixed<W, I> b) { return (double)a + (double)b; }
+template<int W, int I> static inline double operator-(ap_fixed<W, I> a, ap_fixed<W, I> b) { return (double)a - (double)b; }
+template<int W, int I> static inline double operator*(ap_fixed<W, I> a, ap_fixed<W, I> b) { return (double)a * (double)b; }
+
+#endif // EMU_AP_FIXED_H
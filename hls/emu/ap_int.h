@@ -0,0 +1,148 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+// Host stand-in of the Vitis HLS arbitrary precision integers, with only
+// the operations used by the generated wrappers. The value is kept in 64-bit
+// words, so an array of memory words has the layout of the memory they are
+// read from, and ranges are up to 64 bits wide.
+
+#ifndef EMU_AP_INT_H
+#define EMU_AP_INT_H
+
+#include <assert.h>
+
+template<int W>
+struct ap_uint;
+
+static inline unsigned long long emu_low_mask(int width)
+{
+	return width >= 64 ? ~0ULL : ((1ULL << width) - 1);
+}
+
+// Bit range (hi, lo) of an ap_uint, readable and assignable
+template<int W>
+struct ap_range_ref {
+	ap_uint<W> *ref;
+	int hi, lo;
+
+	ap_range_ref(ap_uint<W> *ref, int hi, int lo) : ref(ref), hi(hi), lo(lo)
+	{
+		assert(hi >= lo && lo >= 0 && hi < W && hi - lo < 64);
+	}
+
+	unsigned long long get() const
+	{
+		const int word = lo / 64, shift = lo % 64;
+		unsigned long long v = ref->val[word] >> shift;
+		if (shift && word + 1 < ap_uint<W>::WORDS) v |= ref->val[word + 1] << (64 - shift);
+		return v & emu_low_mask(hi - lo + 1);
+	}
+
+	operator unsigned long long() const
+	{
+		return get();
+	}
+
+	ap_range_ref &operator=(unsigned long long v)
+	{
+		const int word = lo / 64, shift = lo % 64;
+		const unsigned long long mask = emu_low_mask(hi - lo + 1);
+		v &= mask;
+		ref->val[word] = (ref->val[word] & ~(mask << shift)) | (v << shift);
+		if (shift && word + 1 < ap_uint<W>::WORDS) {
+			ref->val[word + 1] = (ref->val[word + 1] & ~(mask >> (64 - shift))) | (v >> (64 - shift));
+		}
+		ref->clear_unused();
+		return *this;
+	}
+
+	ap_range_ref &operator=(const ap_range_ref &other)
+	{
+		return *this = other.get();
+	}
+
+	template<int W2>
+	ap_range_ref &operator=(const ap_range_ref<W2> &other)
+	{
+		return *this = other.get();
+	}
+
+	template<int W2>
+	ap_range_ref &operator=(const ap_uint<W2> &other)
+	{
+		return *this = (unsigned long long)other;
+	}
+};
+
+template<int W>
+struct ap_uint {
+	static const int WORDS = (W + 63) / 64;
+	unsigned long long val[WORDS];
+
+	void clear_unused()
+	{
+		val[WORDS - 1] &= emu_low_mask(W - 64*(WORDS - 1));
+	}
+
+	void set(unsigned long long v)
+	{
+		val[0] = v;
+		for (int w = 1; w < WORDS; w++) val[w] = 0;
+		clear_unused();
+	}
+
+	ap_uint() { set(0); }
+	ap_uint(unsigned long long v) { set(v); }
+	ap_uint(unsigned long v) { set(v); }
+	ap_uint(unsigned int v) { set(v); }
+	ap_uint(long long v) { set(v); }
+	ap_uint(long v) { set(v); }
+	ap_uint(int v) { set(v); }
+	ap_uint(unsigned char v) { set(v); }
+	ap_uint(bool v) { set(v); }
+
+	template<int W2>
+	ap_uint(const ap_uint<W2> &other)
+	{
+		for (int w = 0; w < WORDS; w++) val[w] = w < ap_uint<W2>::WORDS ? other.val[w] : 0;
+		clear_unused();
+	}
+
+	template<int W2>
+	ap_uint(const ap_range_ref<W2> &range) { set(range.get()); }
+
+	operator unsigned long long() const
+	{
+		return val[0];
+	}
+
+	ap_range_ref<W> operator()(int hi, int lo)
+	{
+		return ap_range_ref<W>(this, hi, lo);
+	}
+
+	// Read only ranges of constant values
+	ap_range_ref<W> operator()(int hi, int lo) const
+	{
+		return ap_range_ref<W>(const_cast<ap_uint *>(this), hi, lo);
+	}
+
+	bool operator[](int bit) const
+	{
+		assert(bit >= 0 && bit < W);
+		return (val[bit / 64] >> (bit % 64)) & 1;
+	}
+
+	ap_uint &operator++()
+	{
+		for (int w = 0; w < WORDS && ++val[w] == 0; w++);
+		clear_unused();
+		return *this;
+	}
+};
+
+#endif // EMU_AP_INT_H
@@ -0,0 +1,950 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+// Software emulation driver of the HLS accelerators. It plays the role of
+// the runtime: it sends the command word and the argument stream of each
+// task to the wrappers, backs mcxx_memport with a plain memory array and
+// checks the finish message of every task. The tasks created by the
+// nbody_solve accelerator are run afterwards in creation order, which is
+// a valid order for their dependencies.
+
+#include <hls_stream.h>
+#include <ap_int.h>
+#include <ap_axi_sdata.h>
+#include "../nbody_build_config.h"
+#include "../../src/nbody_config.h"
+#include "../../src/distribution.h"
+
+#include <assert.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "../calc_forces_kernel.h"
+
+typedef ap_axiu<64, 1, 1, 2> mcxx_outaxis;
+typedef ap_uint<FPGA_MEMORY_PORT_WIDTH> mcxx_memword;
+
+void calc_forces_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, mcxx_memword* mcxx_memport);
+void calc_forces_sym_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, mcxx_memword* mcxx_memport);
+void calc_forces_update_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, mcxx_memword* mcxx_memport);
+void calc_forces_stationary_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, mcxx_memword* mcxx_memport);
+void update_particles_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, mcxx_memword* mcxx_memport);
+void compress_positions_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, mcxx_memword* mcxx_memport);
+void nbody_solve_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, hls::stream<ap_uint<8> >& mcxx_spawnInPort, mcxx_memword* mcxx_memport, unsigned char ompif_rank, unsigned char ompif_size);
+
+// Block size the wrappers are built with
+static const int BLOCK_SIZE = NBODY_BLOCK_SIZE;
+static const int PARTICLES_FPGABLOCK_SIZE = 8*BLOCK_SIZE;
+static const int FORCE_FPGABLOCK_SIZE = 3*BLOCK_SIZE;
+static const int PACKED_FPGABLOCK_SIZE = 16 + 3*BLOCK_SIZE/2;
+// Fields of a particle block, the hot ones of the force tasks first
+enum {
+	MASS = 0, POS_X, POS_Y, POS_Z, WEIGHT, VEL_X, VEL_Y, VEL_Z
+};
+
+// Accelerator types, as in ait_extracted.json
+static const unsigned long long EMU_TYPE_CALC_FORCES      = 4294967297LLU;
+static const unsigned long long EMU_TYPE_UPDATE_PARTICLES = 4294967298LLU;
+static const unsigned long long EMU_TYPE_OMPIF_SEND_ALL   = 4294967299LLU;
+static const unsigned long long EMU_TYPE_OMPIF_RECV       = 4294967300LLU;
+static const unsigned long long EMU_TYPE_CALC_FORCES_SYM  = 4294967301LLU;
+static const unsigned long long EMU_TYPE_CALC_FORCES_UPD  = 4294967302LLU;
+static const unsigned long long EMU_TYPE_CALC_FORCES_OS   = 4294967303LLU;
+static const unsigned long long EMU_TYPE_COMPRESS         = 4294967304LLU;
+
+// Argument flags of the wrapper protocol
+static const unsigned char EMU_ARG_COPY_IN  = 1 << 4;
+static const unsigned char EMU_ARG_COPY_OUT = 1 << 5;
+
+static const float gravitational_constant = 6.6726e-11f;
+static const float time_interval          = 5.0e-1f; // not 1, so an update without v*dt fails
+static const double tolerated_error       = 1.0e-3;
+
+typedef struct {
+	unsigned long long value;
+	unsigned char flags;
+} emu_arg_t;
+
+typedef struct {
+	unsigned long long type;
+	unsigned long long parent = 0;
+	std::vector<emu_arg_t> args;
+} emu_task_t;
+
+// Device memory: byte addresses are offsets in the memory port array
+static std::vector<mcxx_memword> emu_memory;
+static unsigned long long emu_memory_top = 0;
+static unsigned long long emu_task_id = 1;
+
+static double get_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)(ts.tv_sec) + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static unsigned long long emu_alloc(size_t size)
+{
+	const unsigned long long addr = emu_memory_top;
+	emu_memory_top += (size + 63) & ~63ULL;
+	emu_memory.resize(emu_memory_top/sizeof(mcxx_memword));
+	return addr;
+}
+
+static float *emu_ptr(unsigned long long addr)
+{
+	static_assert(sizeof(mcxx_memword) == FPGA_MEMORY_PORT_WIDTH/8, "memory words must be packed");
+	return (float *)((char *)emu_memory.data() + addr);
+}
+
+static void emu_send_task(hls::stream<ap_uint<64> >& in, const emu_task_t& task, unsigned long long id)
+{
+	ap_uint<64> command = 0;
+	command(15,8) = task.args.size();
+	in.write(command);
+	in.write(id);
+	in.write(task.parent);
+	for (size_t i = 0; i < task.args.size(); i++) {
+		in.write(task.args[i].flags);
+		in.write(task.args[i].value);
+	}
+}
+
+static void emu_check_finish(hls::stream<mcxx_outaxis>& out, unsigned long long id, unsigned long long parent_id)
+{
+	const char *error = NULL;
+	if (out.size() != 3) {
+		error = "unexpected number of words";
+	} else {
+		const mcxx_outaxis header = out.read();
+		const mcxx_outaxis task = out.read();
+		const mcxx_outaxis parent = out.read();
+		if (header.data != 0x03 || header.dest != 0) error = "bad header";
+		else if (task.data != id) error = "bad task id";
+		else if (parent.data != parent_id || !parent.last) error = "bad parent task id";
+	}
+	if (error) {
+		fprintf(stderr, "emu: task %llu finish message: %s\n", id, error);
+		exit(1);
+	}
+}
+
+static void emu_run_task(const emu_task_t& task)
+{
+	hls::stream<ap_uint<64> > in;
+	hls::stream<mcxx_outaxis> out;
+	const unsigned long long id = emu_task_id++;
+	emu_send_task(in, task, id);
+	if (task.type == EMU_TYPE_CALC_FORCES)
+		calc_forces_wrapper(in, out, emu_memory.data());
+	else if (task.type == EMU_TYPE_CALC_FORCES_SYM)
+		calc_forces_sym_wrapper(in, out, emu_memory.data());
+	else if (task.type == EMU_TYPE_CALC_FORCES_UPD)
+		calc_forces_update_wrapper(in, out, emu_memory.data());
+	else if (task.type == EMU_TYPE_CALC_FORCES_OS)
+		calc_forces_stationary_wrapper(in, out, emu_memory.data());
+	else if (task.type == EMU_TYPE_UPDATE_PARTICLES)
+		update_particles_wrapper(in, out, emu_memory.data());
+	else if (task.type == EMU_TYPE_COMPRESS)
+		compress_positions_wrapper(in, out, emu_memory.data());
+	else {
+		fprintf(stderr, "emu: unknown accelerator type %llu\n", task.type);
+		exit(1);
+	}
+	if (!in.empty()) {
+		fprintf(stderr, "emu: task %llu did not read all its arguments\n", id);
+		exit(1);
+	}
+	emu_check_finish(out, id, task.parent);
+}
+
+// Decodes the messages of an accelerator that creates tasks
+static void emu_read_spawned(hls::stream<mcxx_outaxis>& out, std::vector<emu_task_t>& tasks, int *taskwaits)
+{
+	while (out.size() > 3) {
+		const mcxx_outaxis word = out.read();
+		if (word.dest == 3) {
+			(*taskwaits)++;
+			continue;
+		}
+		assert(word.dest == 2);
+		const int num_args = ap_uint<64>(word.data)(15,8);
+		const int num_deps = ap_uint<64>(word.data)(23,16);
+		const int num_copies = ap_uint<64>(word.data)(31,24);
+		emu_task_t task;
+		task.parent = out.read().data;
+		task.type = ap_uint<64>(out.read().data)(33,0);
+		for (int i = 0; i < num_deps; i++) out.read();
+		std::vector<unsigned char> flags(num_args, 0);
+		for (int i = 0; i < num_copies; i++) {
+			out.read(); // copy address, the argument itself when 0
+			const ap_uint<64> info = out.read().data;
+			const int copy_flags = info(7,0);
+			const int arg = info(15,8);
+			assert(arg < num_args);
+			flags[arg] = (copy_flags & 1 ? EMU_ARG_COPY_IN : 0) | (copy_flags & 2 ? EMU_ARG_COPY_OUT : 0);
+		}
+		for (int i = 0; i < num_args; i++) {
+			emu_arg_t a = {(unsigned long long)out.read().data, flags[i]};
+			task.args.push_back(a);
+		}
+		tasks.push_back(task);
+	}
+}
+
+static void emu_init_particles(float *block, int seed)
+{
+	srand(seed);
+	for (int e = 0; e < BLOCK_SIZE; e++) {
+		block[POS_X*BLOCK_SIZE + e] = 1.0e+10f * (rand() / ((float)RAND_MAX + 1.0f));
+		block[POS_Y*BLOCK_SIZE + e] = 1.0e+10f * (rand() / ((float)RAND_MAX + 1.0f));
+		block[POS_Z*BLOCK_SIZE + e] = 1.0e+10f * (rand() / ((float)RAND_MAX + 1.0f));
+		block[VEL_X*BLOCK_SIZE + e] = 0.0f;
+		block[VEL_Y*BLOCK_SIZE + e] = 0.0f;
+		block[VEL_Z*BLOCK_SIZE + e] = 0.0f;
+		block[MASS*BLOCK_SIZE + e] = 1.0e+28f * (rand() / ((float)RAND_MAX + 1.0f));
+		block[WEIGHT*BLOCK_SIZE + e] = gravitational_constant * block[MASS*BLOCK_SIZE + e];
+	}
+}
+
+// Padding of a partial block from count on, as the host lays it out
+static void emu_pad_particles(float *block, int count)
+{
+	for (int e = count; e < BLOCK_SIZE; e++) {
+		for (int c = POS_X; c <= POS_Z; c++) block[c*BLOCK_SIZE + e] = block[c*BLOCK_SIZE];
+		block[MASS*BLOCK_SIZE + e] = 0.0f;
+		block[WEIGHT*BLOCK_SIZE + e] = 0.0f;
+	}
+}
+
+// Reference force of the block pair in double precision
+static void emu_reference_forces(double *forces, const float *block1, const float *block2)
+{
+	for (int j = 0; j < BLOCK_SIZE; j++) {
+		for (int i = 0; i < BLOCK_SIZE; i++) {
+			const double dx = (double)block2[POS_X*BLOCK_SIZE + i] - block1[POS_X*BLOCK_SIZE + j];
+			const double dy = (double)block2[POS_Y*BLOCK_SIZE + i] - block1[POS_Y*BLOCK_SIZE + j];
+			const double dz = (double)block2[POS_Z*BLOCK_SIZE + i] - block1[POS_Z*BLOCK_SIZE + j];
+			const double d2 = dx*dx + dy*dy + dz*dz;
+			if (d2 == 0.0) continue;
+			const double f = (double)block1[MASS*BLOCK_SIZE + j] * block2[WEIGHT*BLOCK_SIZE + i] / (d2*sqrt(d2));
+			forces[0*BLOCK_SIZE + j] += f*dx;
+			forces[1*BLOCK_SIZE + j] += f*dy;
+			forces[2*BLOCK_SIZE + j] += f*dz;
+		}
+	}
+}
+
+// Largest error of the force vectors relative to the largest reference force
+static double emu_compare_forces(const float *forces, const double *reference)
+{
+	double norm = 0.0, error = 0.0;
+	for (int e = 0; e < BLOCK_SIZE; e++) {
+		double n = 0.0, d = 0.0;
+		for (int c = 0; c < 3; c++) {
+			n += reference[c*BLOCK_SIZE + e]*reference[c*BLOCK_SIZE + e];
+			d += (forces[c*BLOCK_SIZE + e] - reference[c*BLOCK_SIZE + e])*(forces[c*BLOCK_SIZE + e] - reference[c*BLOCK_SIZE + e]);
+		}
+		norm = fmax(norm, sqrt(n));
+		error = fmax(error, sqrt(d));
+	}
+	return error/norm;
+}
+
+static int emu_report_tolerance(const char *name, double error, double tolerance, double time, int repetitions)
+{
+	const int ok = error <= tolerance;
+	printf("%-22s %s  error %e  time %f s/task\n", name, ok ? "OK   " : "ERROR", error, time/repetitions);
+	return ok;
+}
+
+static int emu_report(const char *name, double error, double time, int repetitions)
+{
+	return emu_report_tolerance(name, error, tolerated_error, time, repetitions);
+}
+
+// Error bound of one block pair with each precision of the force kernel. The
+// half positions keep 11 bits, so the nearest pairs carry most of the error
+template<int PRECISION>
+static double emu_precision_tolerance()
+{
+	return PRECISION == NBODY_PRECISION_HALF ? 1.0e-1 : tolerated_error;
+}
+
+static emu_task_t emu_calc_forces_task(unsigned long long forces, unsigned long long block1, unsigned long long block2, int step)
+{
+	emu_task_t task;
+	task.type = EMU_TYPE_CALC_FORCES;
+	// One copy per block: the mass and positions of the target and the
+	// positions and weights of the source
+	emu_arg_t forces_arg = {forces, EMU_ARG_COPY_IN | EMU_ARG_COPY_OUT};
+	emu_arg_t target_arg = {block1 + MASS*BLOCK_SIZE*sizeof(float), EMU_ARG_COPY_IN};
+	emu_arg_t source_arg = {block2 + POS_X*BLOCK_SIZE*sizeof(float), EMU_ARG_COPY_IN};
+	emu_arg_t step_arg = {(unsigned int)step, 0};
+	task.args.push_back(forces_arg);
+	task.args.push_back(target_arg);
+	task.args.push_back(source_arg);
+	task.args.push_back(step_arg);
+	return task;
+}
+
+static int emu_check_calc_forces(int repetitions)
+{
+	const unsigned long long block1 = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long block2 = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long forces = emu_alloc(FORCE_FPGABLOCK_SIZE*sizeof(float));
+	emu_init_particles(emu_ptr(block1), 1);
+	emu_init_particles(emu_ptr(block2), 2);
+
+	std::vector<double> reference(FORCE_FPGABLOCK_SIZE, 0.0);
+	for (int r = 0; r < repetitions; r++) emu_reference_forces(reference.data(), emu_ptr(block1), emu_ptr(block2));
+
+	memset(emu_ptr(forces), 0, FORCE_FPGABLOCK_SIZE*sizeof(float));
+	const double start = get_time();
+	for (int r = 0; r < repetitions; r++) emu_run_task(emu_calc_forces_task(forces, block1, block2, 0));
+	const double end = get_time();
+	double error = emu_compare_forces(emu_ptr(forces), reference.data());
+
+	// The blocks kept in the accelerator must be read again in the next step
+	emu_init_particles(emu_ptr(block1), 3);
+	emu_init_particles(emu_ptr(block2), 4);
+	emu_reference_forces(reference.data(), emu_ptr(block1), emu_ptr(block2));
+	emu_run_task(emu_calc_forces_task(forces, block1, block2, 1));
+	error = fmax(error, emu_compare_forces(emu_ptr(forces), reference.data()));
+
+	return emu_report_tolerance("calc_forces", error, emu_precision_tolerance<NBODY_PRECISION>(), end - start, repetitions);
+}
+
+static int emu_check_calc_forces_sym(int repetitions)
+{
+	const unsigned long long block1 = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long block2 = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long forces1 = emu_alloc(FORCE_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long forces2 = emu_alloc(FORCE_FPGABLOCK_SIZE*sizeof(float));
+	emu_init_particles(emu_ptr(block1), 3);
+	emu_init_particles(emu_ptr(block2), 4);
+
+	std::vector<double> reference1(FORCE_FPGABLOCK_SIZE, 0.0), reference2(FORCE_FPGABLOCK_SIZE, 0.0);
+	for (int r = 0; r < repetitions; r++) {
+		emu_reference_forces(reference1.data(), emu_ptr(block1), emu_ptr(block2));
+		emu_reference_forces(reference2.data(), emu_ptr(block2), emu_ptr(block1));
+	}
+
+	emu_task_t task;
+	task.type = EMU_TYPE_CALC_FORCES_SYM;
+	const unsigned char inout = EMU_ARG_COPY_IN | EMU_ARG_COPY_OUT;
+	for (int c = 0; c < 3; c++) {
+		emu_arg_t a = {forces1 + c*BLOCK_SIZE*sizeof(float), inout};
+		task.args.push_back(a);
+	}
+	for (int c = 0; c < 3; c++) {
+		emu_arg_t a = {forces2 + c*BLOCK_SIZE*sizeof(float), inout};
+		task.args.push_back(a);
+	}
+	const int fields1[] = {POS_X, POS_Y, POS_Z, MASS};
+	const int fields2[] = {POS_X, POS_Y, POS_Z, WEIGHT};
+	for (int f = 0; f < 4; f++) {
+		emu_arg_t a = {block1 + fields1[f]*BLOCK_SIZE*sizeof(float), EMU_ARG_COPY_IN};
+		task.args.push_back(a);
+	}
+	for (int f = 0; f < 4; f++) {
+		emu_arg_t a = {block2 + fields2[f]*BLOCK_SIZE*sizeof(float), EMU_ARG_COPY_IN};
+		task.args.push_back(a);
+	}
+
+	memset(emu_ptr(forces1), 0, FORCE_FPGABLOCK_SIZE*sizeof(float));
+	memset(emu_ptr(forces2), 0, FORCE_FPGABLOCK_SIZE*sizeof(float));
+	const double start = get_time();
+	for (int r = 0; r < repetitions; r++) emu_run_task(task);
+	const double end = get_time();
+
+	const double error = fmax(emu_compare_forces(emu_ptr(forces1), reference1.data()),
+		emu_compare_forces(emu_ptr(forces2), reference2.data()));
+	return emu_report("calc_forces_sym", error, end - start, repetitions);
+}
+
+static int emu_check_update_particles(int repetitions)
+{
+	const unsigned long long block = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long forces = emu_alloc(FORCE_FPGABLOCK_SIZE*sizeof(float));
+	emu_init_particles(emu_ptr(block), 5);
+
+	std::vector<float> reference(emu_ptr(block), emu_ptr(block) + PARTICLES_FPGABLOCK_SIZE);
+	double start = 0.0, time = 0.0;
+	for (int r = 0; r < repetitions; r++) {
+		float *f = emu_ptr(forces);
+		for (int e = 0; e < FORCE_FPGABLOCK_SIZE; e++) f[e] = 1.0e+18f * (rand() / (float)RAND_MAX - 0.5f);
+		for (int e = 0; e < BLOCK_SIZE; e++) {
+			float *p = reference.data();
+			const float time_by_mass = time_interval / p[MASS*BLOCK_SIZE + e];
+			const float half_time_interval = 0.5f * time_interval;
+			for (int c = 0; c < 3; c++) {
+				const float velocity_change = f[c*BLOCK_SIZE + e] * time_by_mass;
+				const float position_change = p[(VEL_X + c)*BLOCK_SIZE + e] * time_interval + velocity_change * half_time_interval;
+				p[(VEL_X + c)*BLOCK_SIZE + e] += velocity_change;
+				p[(POS_X + c)*BLOCK_SIZE + e] += position_change;
+			}
+		}
+
+		emu_task_t task;
+		task.type = EMU_TYPE_UPDATE_PARTICLES;
+		emu_arg_t particles_arg = {block, EMU_ARG_COPY_IN | EMU_ARG_COPY_OUT};
+		emu_arg_t forces_arg = {forces, EMU_ARG_COPY_IN | EMU_ARG_COPY_OUT};
+		union { float f; unsigned int u; } dt = {time_interval};
+		emu_arg_t dt_arg = {dt.u, 0};
+		task.args.push_back(particles_arg);
+		task.args.push_back(forces_arg);
+		task.args.push_back(dt_arg);
+
+		start = get_time();
+		emu_run_task(task);
+		time += get_time() - start;
+	}
+
+	double error = 0.0;
+	for (int e = 0; e < PARTICLES_FPGABLOCK_SIZE; e++) {
+		if (reference[e] != 0.0f) error = fmax(error, fabs((emu_ptr(block)[e] - reference[e]) / reference[e]));
+	}
+	for (int e = 0; e < FORCE_FPGABLOCK_SIZE; e++) {
+		if (emu_ptr(forces)[e] != 0.0f) error = INFINITY;
+	}
+	return emu_report("update_particles", error, time, repetitions);
+}
+
+static emu_task_t emu_compress_positions_task(unsigned long long block, unsigned long long packed, int decode)
+{
+	emu_task_t task;
+	task.type = EMU_TYPE_COMPRESS;
+	emu_arg_t block_arg = {block + POS_X*BLOCK_SIZE*sizeof(float), decode ? EMU_ARG_COPY_OUT : EMU_ARG_COPY_IN};
+	emu_arg_t packed_arg = {packed, decode ? EMU_ARG_COPY_IN : EMU_ARG_COPY_OUT};
+	emu_arg_t decode_arg = {(unsigned long long)decode, 0};
+	task.args.push_back(block_arg);
+	task.args.push_back(packed_arg);
+	task.args.push_back(decode_arg);
+	return task;
+}
+
+// Packs a block and unpacks it into another one. The error of each position
+// must be within half a step of the grid of its block and axis, and only
+// the positions of the destination block are written
+static int emu_check_compress_positions(int repetitions)
+{
+	const unsigned long long block = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long packed = emu_alloc(PACKED_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long copy = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	emu_init_particles(emu_ptr(block), 9);
+	emu_init_particles(emu_ptr(copy), 10);
+	const std::vector<float> untouched(emu_ptr(copy), emu_ptr(copy) + PARTICLES_FPGABLOCK_SIZE);
+
+	const double start = get_time();
+	for (int r = 0; r < repetitions; r++) {
+		emu_run_task(emu_compress_positions_task(block, packed, 0));
+		emu_run_task(emu_compress_positions_task(copy, packed, 1));
+	}
+	const double end = get_time();
+
+	// Error relative to the bound of each axis
+	double error = 0.0;
+	for (int c = 0; c < 3; c++) {
+		const float *p = emu_ptr(block) + (POS_X + c)*BLOCK_SIZE;
+		const float minimum = *std::min_element(p, p + BLOCK_SIZE);
+		const float maximum = *std::max_element(p, p + BLOCK_SIZE);
+		const double bound = (maximum - minimum)/131070.0 + fabs(maximum)*1.0e-6;
+		for (int e = 0; e < BLOCK_SIZE; e++) {
+			error = fmax(error, fabs(emu_ptr(copy)[(POS_X + c)*BLOCK_SIZE + e] - p[e])/bound*tolerated_error);
+		}
+	}
+	for (int e = 0; e < PARTICLES_FPGABLOCK_SIZE; e++) {
+		const bool position = e >= POS_X*BLOCK_SIZE && e < (POS_Z + 1)*BLOCK_SIZE;
+		if (!position && emu_ptr(copy)[e] != untouched[e]) error = INFINITY;
+	}
+	return emu_report("compress_positions", error, end - start, 2*repetitions);
+}
+
+// Largest error of the velocities relative to the largest reference velocity
+static double emu_compare_velocities(const float *particles, const float *reference, int num_blocks)
+{
+	double error = 0.0, norm = 0.0;
+	for (int b = 0; b < num_blocks; b++) {
+		const float *p = particles + b*PARTICLES_FPGABLOCK_SIZE;
+		const float *q = reference + b*PARTICLES_FPGABLOCK_SIZE;
+		for (int e = 0; e < BLOCK_SIZE; e++) {
+			double n = 0.0, d = 0.0;
+			for (int c = VEL_X; c <= VEL_Z; c++) {
+				n += (double)q[c*BLOCK_SIZE + e]*q[c*BLOCK_SIZE + e];
+				d += ((double)p[c*BLOCK_SIZE + e] - q[c*BLOCK_SIZE + e])*((double)p[c*BLOCK_SIZE + e] - q[c*BLOCK_SIZE + e]);
+			}
+			// fmax would drop a NaN
+			if (!std::isfinite(d)) return INFINITY;
+			norm = fmax(norm, sqrt(n));
+			error = fmax(error, sqrt(d));
+		}
+	}
+	return error/norm;
+}
+
+// Euler update of a block with the same operations as the accelerators
+static void emu_reference_update(float *p, const double *f)
+{
+	for (int e = 0; e < BLOCK_SIZE; e++) {
+		const float time_by_mass = p[MASS*BLOCK_SIZE + e] == 0.0f ? 0.0f : time_interval / p[MASS*BLOCK_SIZE + e];
+		for (int c = 0; c < 3; c++) {
+			const float velocity_change = (float)f[c*BLOCK_SIZE + e] * time_by_mass;
+			const float position_change = p[(VEL_X + c)*BLOCK_SIZE + e] * time_interval + velocity_change * 0.5f * time_interval;
+			p[(VEL_X + c)*BLOCK_SIZE + e] += velocity_change;
+			p[(POS_X + c)*BLOCK_SIZE + e] += position_change;
+		}
+	}
+}
+
+static int emu_check_calc_forces_update(int repetitions)
+{
+	const unsigned long long block1 = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long block2 = emu_alloc(PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long forces = emu_alloc(FORCE_FPGABLOCK_SIZE*sizeof(float));
+	emu_init_particles(emu_ptr(block1), 7);
+	emu_init_particles(emu_ptr(block2), 8);
+
+	// Partial forces of the previous source blocks
+	std::vector<double> reference_forces(FORCE_FPGABLOCK_SIZE, 0.0);
+	emu_reference_forces(reference_forces.data(), emu_ptr(block1), emu_ptr(block1));
+	for (int e = 0; e < FORCE_FPGABLOCK_SIZE; e++) emu_ptr(forces)[e] = reference_forces[e];
+	const std::vector<float> partial(emu_ptr(forces), emu_ptr(forces) + FORCE_FPGABLOCK_SIZE);
+
+	std::vector<float> reference(emu_ptr(block1), emu_ptr(block1) + PARTICLES_FPGABLOCK_SIZE);
+	double time = 0.0;
+	for (int r = 0; r < repetitions; r++) {
+		std::vector<double> f(partial.begin(), partial.end());
+		emu_reference_forces(f.data(), reference.data(), emu_ptr(block2));
+		emu_reference_update(reference.data(), f.data());
+
+		emu_task_t task;
+		task.type = EMU_TYPE_CALC_FORCES_UPD;
+		for (int c = 0; c < 3; c++) {
+			emu_arg_t a = {forces + c*BLOCK_SIZE*sizeof(float), EMU_ARG_COPY_IN};
+			task.args.push_back(a);
+		}
+		emu_arg_t particles_arg = {block1, EMU_ARG_COPY_IN | EMU_ARG_COPY_OUT};
+		task.args.push_back(particles_arg);
+		const int fields2[] = {POS_X, POS_Y, POS_Z, WEIGHT};
+		for (int f = 0; f < 4; f++) {
+			emu_arg_t a = {block2 + fields2[f]*BLOCK_SIZE*sizeof(float), EMU_ARG_COPY_IN};
+			task.args.push_back(a);
+		}
+		union { float f; unsigned int u; } dt = {time_interval};
+		emu_arg_t dt_arg = {dt.u, 0};
+		task.args.push_back(dt_arg);
+
+		const double start = get_time();
+		emu_run_task(task);
+		time += get_time() - start;
+	}
+
+	double error = emu_compare_velocities(emu_ptr(block1), reference.data(), 1);
+	// The forces are consumed on chip and the constant fields are not written
+	if (memcmp(emu_ptr(forces), partial.data(), FORCE_FPGABLOCK_SIZE*sizeof(float))) error = INFINITY;
+	if (memcmp(emu_ptr(block1) + MASS*BLOCK_SIZE, reference.data() + MASS*BLOCK_SIZE, BLOCK_SIZE*sizeof(float))) error = INFINITY;
+	if (memcmp(emu_ptr(block1) + WEIGHT*BLOCK_SIZE, reference.data() + WEIGHT*BLOCK_SIZE, BLOCK_SIZE*sizeof(float))) error = INFINITY;
+	return emu_report("calc_forces_update", error, time, repetitions);
+}
+
+static int emu_check_calc_forces_stationary(int repetitions, int num_blocks)
+{
+	const unsigned long long particles = emu_alloc(num_blocks*PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long forces = emu_alloc(FORCE_FPGABLOCK_SIZE*sizeof(float));
+	for (int b = 0; b < num_blocks; b++) {
+		emu_init_particles(emu_ptr(particles) + b*PARTICLES_FPGABLOCK_SIZE, 9 + b);
+	}
+
+	// Forces of the first block over all the blocks, overwritten by every task
+	std::vector<double> reference(FORCE_FPGABLOCK_SIZE, 0.0);
+	for (int i = 0; i < num_blocks; i++) {
+		emu_reference_forces(reference.data(), emu_ptr(particles), emu_ptr(particles) + i*PARTICLES_FPGABLOCK_SIZE);
+	}
+
+	emu_task_t task;
+	task.type = EMU_TYPE_CALC_FORCES_OS;
+	for (int c = 0; c < 3; c++) {
+		emu_arg_t a = {forces + c*BLOCK_SIZE*sizeof(float), EMU_ARG_COPY_OUT};
+		task.args.push_back(a);
+	}
+	const int fields1[] = {POS_X, POS_Y, POS_Z, MASS};
+	for (int f = 0; f < 4; f++) {
+		emu_arg_t a = {particles + fields1[f]*BLOCK_SIZE*sizeof(float), EMU_ARG_COPY_IN};
+		task.args.push_back(a);
+	}
+	emu_arg_t particles_arg = {particles, 0};
+	emu_arg_t num_blocks_arg = {(unsigned long long)num_blocks, 0};
+	task.args.push_back(particles_arg);
+	task.args.push_back(num_blocks_arg);
+
+	for (int e = 0; e < FORCE_FPGABLOCK_SIZE; e++) emu_ptr(forces)[e] = NAN;
+	const double start = get_time();
+	for (int r = 0; r < repetitions; r++) emu_run_task(task);
+	const double end = get_time();
+
+	return emu_report("calc_forces_stationary", emu_compare_forces(emu_ptr(forces), reference.data()), end - start, repetitions);
+}
+
+// Force kernel of calc_forces built with the given precision, whatever
+// NBODY_PRECISION the wrapper was built with
+template<int PRECISION>
+static int emu_check_precision_variant(const char *name, const float *block1, const float *block2,
+	const double *reference, int repetitions)
+{
+	typedef typename nbody_precision<PRECISION>::acc_t acc_t;
+	static float target[4][BLOCK_SIZE];
+	static float source[4][BLOCK_SIZE];
+	static acc_t forces[3][BLOCK_SIZE];
+	memcpy(target, block1 + MASS*BLOCK_SIZE, sizeof(target));
+	memcpy(source, block2 + POS_X*BLOCK_SIZE, sizeof(source));
+
+	double time = 0.0;
+	for (int r = 0; r < repetitions; r++) {
+		std::fill(&forces[0][0], &forces[0][0] + FORCE_FPGABLOCK_SIZE, (acc_t)0);
+		const double start = get_time();
+		nbody_calculate_forces<PRECISION, BLOCK_SIZE>(forces, target, source);
+		time += get_time() - start;
+	}
+	std::vector<float> result(&forces[0][0], &forces[0][0] + FORCE_FPGABLOCK_SIZE);
+	return emu_report_tolerance(name, emu_compare_forces(result.data(), reference), emu_precision_tolerance<PRECISION>(), time, repetitions);
+}
+
+static int emu_check_precision(int repetitions)
+{
+	std::vector<float> block1(PARTICLES_FPGABLOCK_SIZE), block2(PARTICLES_FPGABLOCK_SIZE);
+	emu_init_particles(block1.data(), 1);
+	emu_init_particles(block2.data(), 2);
+	std::vector<double> reference(FORCE_FPGABLOCK_SIZE, 0.0);
+	emu_reference_forces(reference.data(), block1.data(), block2.data());
+
+	int ok = 1;
+	ok &= emu_check_precision_variant<NBODY_PRECISION_FLOAT>("precision float", block1.data(), block2.data(), reference.data(), repetitions);
+	ok &= emu_check_precision_variant<NBODY_PRECISION_MIXED>("precision mixed", block1.data(), block2.data(), reference.data(), repetitions);
+	ok &= emu_check_precision_variant<NBODY_PRECISION_HALF>("precision half", block1.data(), block2.data(), reference.data(), repetitions);
+	ok &= emu_check_precision_variant<NBODY_PRECISION_FIXED>("precision fixed", block1.data(), block2.data(), reference.data(), repetitions);
+	return ok;
+}
+
+// Forces of nbody_solve: the force blocks, the packed positions of the
+// compressed exchange, the owner of each block and the configuration
+// record, as laid out by the host. The host does not copy the force blocks,
+// so they start as NaN here and nbody_solve has to clear the ones of its rank
+static size_t emu_config_offset(int num_blocks)
+{
+	return num_blocks*(FORCE_FPGABLOCK_SIZE + PACKED_FPGABLOCK_SIZE)*sizeof(float) + (num_blocks + 63)/64*64;
+}
+
+static unsigned long long emu_alloc_solve_forces(int num_blocks, const std::vector<unsigned char>& owners)
+{
+	const size_t owners_offset = num_blocks*(FORCE_FPGABLOCK_SIZE + PACKED_FPGABLOCK_SIZE)*sizeof(float);
+	const unsigned long long forces = emu_alloc(emu_config_offset(num_blocks) + NBODY_CONFIG_RECORD_SIZE);
+	std::fill(emu_ptr(forces), emu_ptr(forces) + num_blocks*FORCE_FPGABLOCK_SIZE, NAN);
+	memcpy((char *)emu_ptr(forces) + owners_offset, owners.data(), num_blocks);
+	return forces;
+}
+
+// Full simulation driven by the nbody_solve accelerator and compared with
+// a host simulation with the same operations
+// Runs nbody_solve as rank of a cluster of size ranks and returns the tasks it creates
+static void emu_spawn_nbody_solve(unsigned long long particles, unsigned long long forces, int num_blocks, int timesteps, int flags,
+	unsigned char rank, unsigned char size, std::vector<emu_task_t>& tasks)
+{
+	hls::stream<ap_uint<64> > in;
+	hls::stream<mcxx_outaxis> out;
+	hls::stream<ap_uint<8> > spawn_in;
+	union { float f; unsigned int u; } dt = {time_interval};
+	emu_task_t solve;
+	solve.type = 0;
+	const emu_arg_t args[] = {{particles, 0}, {forces, 0}, {(unsigned long long)num_blocks, 0},
+		{(unsigned long long)timesteps, 0}, {dt.u, 0}, {(unsigned long long)flags, 0}};
+	solve.args.assign(args, args + 6);
+
+	const unsigned long long id = emu_task_id++;
+	emu_send_task(in, solve, id);
+	// Acknowledge of the taskwaits, two per step in the stationary mode and the final one
+	const int expected_taskwaits = (flags & 4) ? 2*timesteps + 1 : 1;
+	for (int w = 0; w < expected_taskwaits; w++) spawn_in.write(1);
+	nbody_solve_wrapper(in, out, spawn_in, emu_memory.data(), rank, size);
+
+	int taskwaits = 0;
+	emu_read_spawned(out, tasks, &taskwaits);
+	emu_check_finish(out, id, solve.parent);
+	assert(taskwaits == expected_taskwaits);
+}
+
+static int emu_check_nbody_solve(int num_blocks, int timesteps, int flags, int last_block)
+{
+	const unsigned long long particles = emu_alloc(num_blocks*PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long forces = emu_alloc_solve_forces(num_blocks, std::vector<unsigned char>(num_blocks, 0));
+	for (int b = 0; b < num_blocks; b++) {
+		emu_init_particles(emu_ptr(particles) + b*PARTICLES_FPGABLOCK_SIZE, 6 + b);
+	}
+	emu_pad_particles(emu_ptr(particles) + (num_blocks - 1)*PARTICLES_FPGABLOCK_SIZE, last_block);
+
+	std::vector<float> reference(emu_ptr(particles), emu_ptr(particles) + num_blocks*PARTICLES_FPGABLOCK_SIZE);
+	std::vector<double> reference_forces(num_blocks*FORCE_FPGABLOCK_SIZE);
+	for (int t = 0; t < timesteps; t++) {
+		std::fill(reference_forces.begin(), reference_forces.end(), 0.0);
+		for (int j = 0; j < num_blocks; j++) {
+			for (int i = 0; i < num_blocks; i++) {
+				emu_reference_forces(reference_forces.data() + j*FORCE_FPGABLOCK_SIZE,
+					reference.data() + j*PARTICLES_FPGABLOCK_SIZE, reference.data() + i*PARTICLES_FPGABLOCK_SIZE);
+			}
+		}
+		for (int b = 0; b < num_blocks; b++) {
+			emu_reference_update(reference.data() + b*PARTICLES_FPGABLOCK_SIZE, reference_forces.data() + b*FORCE_FPGABLOCK_SIZE);
+		}
+	}
+
+	const double start = get_time();
+	std::vector<emu_task_t> tasks;
+	emu_spawn_nbody_solve(particles, forces, num_blocks, timesteps, flags, 0, 1, tasks);
+
+	int ompif = 0;
+	for (size_t t = 0; t < tasks.size(); t++) {
+		// A single rank owns all the blocks, so the broadcasts are no-ops
+		if (tasks[t].type == EMU_TYPE_OMPIF_SEND_ALL || tasks[t].type == EMU_TYPE_OMPIF_RECV) {
+			ompif++;
+			continue;
+		}
+		emu_run_task(tasks[t]);
+	}
+	const double end = get_time();
+
+	// The record the host checks against its own configuration
+	const unsigned int expected[NBODY_CONFIG_FIELDS] = NBODY_CONFIG_RECORD;
+	const int config_ok = !memcmp((char *)emu_ptr(forces) + emu_config_offset(num_blocks), expected, sizeof(expected));
+	if (!config_ok) printf("nbody_solve: wrong configuration record\n");
+
+	const double error = config_ok ? emu_compare_velocities(emu_ptr(particles), reference.data(), num_blocks) : INFINITY;
+	printf("nbody_solve: %zu tasks (%d OMPIF), %d blocks, %d particles in the last one, %d timesteps%s%s%s%s%s\n", tasks.size(), ompif,
+		num_blocks, last_block, timesteps, (flags & 1) ? ", symmetric" : "", (flags & 2) ? ", fused" : "",
+		(flags & 4) ? ", output stationary" : "", (flags & 8) ? ", ring" : "", (flags & 16) ? ", compressed" : "");
+	return emu_report_tolerance("nbody_solve", error, emu_precision_tolerance<NBODY_PRECISION>(), end - start, 1);
+}
+
+// Checks the messages of the position broadcasts of all the ranks: every
+// send must have a matching receive in the same order, and every rank must
+// receive each block it does not own once per step
+static int emu_check_ompif(int num_blocks, int timesteps, int flags, int ranks, const int *weights, int distribution)
+{
+	std::vector<unsigned char> owners(num_blocks);
+	nbody_block_owners(num_blocks, ranks, weights, distribution, owners.data());
+	const unsigned long long particles = emu_alloc(num_blocks*PARTICLES_FPGABLOCK_SIZE*sizeof(float));
+	const unsigned long long forces = emu_alloc_solve_forces(num_blocks, owners);
+	const unsigned long long packed = forces + num_blocks*FORCE_FPGABLOCK_SIZE*sizeof(float);
+	const bool compress = (flags & 16) && ranks > 1;
+
+	// Addresses sent and received by each pair of ranks, in order
+	std::vector<std::vector<std::vector<unsigned long long> > > sent(ranks, std::vector<std::vector<unsigned long long> >(ranks));
+	std::vector<std::vector<std::vector<unsigned long long> > > received(ranks, std::vector<std::vector<unsigned long long> >(ranks));
+	std::vector<int> messages(ranks, 0);
+	std::vector<unsigned long long> bytes(ranks, 0);
+	const double start = get_time();
+	int ok = 1;
+	for (int r = 0; r < ranks; r++) {
+		std::vector<emu_task_t> tasks;
+		emu_spawn_nbody_solve(particles, forces, num_blocks, timesteps, flags, r, ranks, tasks);
+		std::vector<int> block_receives(num_blocks, 0), block_unpacks(num_blocks, 0);
+		for (size_t t = 0; t < tasks.size(); t++) {
+			// Every packed block received is unpacked
+			if (tasks[t].type == EMU_TYPE_COMPRESS && tasks[t].args[2].value) {
+				block_unpacks[(tasks[t].args[1].value - packed)/(PACKED_FPGABLOCK_SIZE*sizeof(float))]++;
+			}
+			if (tasks[t].type != EMU_TYPE_OMPIF_SEND_ALL && tasks[t].type != EMU_TYPE_OMPIF_RECV) continue;
+			const ap_uint<64> command = tasks[t].args[0].value;
+			const unsigned long long addr = command(63,24);
+			const unsigned long long size = tasks[t].args[1].value;
+			const int peer = command(23,16);
+			if (size != (compress ? PACKED_FPGABLOCK_SIZE : 3*BLOCK_SIZE)*sizeof(float)) ok = 0;
+			// Only the positions of the particle blocks are exchanged
+			if (!compress && (addr - particles)%(PARTICLES_FPGABLOCK_SIZE*sizeof(float)) != POS_X*BLOCK_SIZE*sizeof(float)) ok = 0;
+			if (tasks[t].type == EMU_TYPE_OMPIF_RECV) {
+				received[peer][r].push_back(addr);
+				if (compress)
+					block_receives[(addr - packed)/(PACKED_FPGABLOCK_SIZE*sizeof(float))]++;
+				else
+					block_receives[(addr - particles)/(PARTICLES_FPGABLOCK_SIZE*sizeof(float))]++;
+			} else if (command(7,0) == 1) {
+				for (int p = 0; p < ranks; p++) {
+					if (p != r) sent[r][p].push_back(addr);
+				}
+				messages[r] += ranks - 1;
+				bytes[r] += (ranks - 1)*size;
+			} else {
+				sent[r][peer].push_back(addr);
+				messages[r]++;
+				bytes[r] += size;
+			}
+		}
+		for (int b = 0; b < num_blocks; b++) {
+			if (block_receives[b] != (owners[b] == r ? 0 : timesteps)) ok = 0;
+			if (block_unpacks[b] != (compress ? block_receives[b] : 0)) ok = 0;
+		}
+	}
+	for (int src = 0; src < ranks; src++) {
+		for (int dst = 0; dst < ranks; dst++) {
+			if (sent[src][dst] != received[src][dst]) ok = 0;
+		}
+	}
+	const double end = get_time();
+
+	int max_messages = 0, min_messages = messages[0], max_peers = 0;
+	unsigned long long max_bytes = 0;
+	std::vector<int> counts(ranks, 0);
+	for (int b = 0; b < num_blocks; b++) counts[owners[b]]++;
+	for (int r = 0; r < ranks; r++) {
+		max_bytes = std::max(max_bytes, bytes[r]);
+		max_messages = std::max(max_messages, messages[r]);
+		min_messages = std::min(min_messages, messages[r]);
+		int peers = 0;
+		for (int p = 0; p < ranks; p++) peers += !sent[r][p].empty();
+		max_peers = std::max(max_peers, peers);
+	}
+	printf("ompif: %d ranks, %d blocks (%d to %d per rank, %s), %d timesteps%s%s, %d to %d messages sent per rank to up to %d ranks, up to %llu bytes\n",
+		ranks, num_blocks, *std::min_element(counts.begin(), counts.end()), *std::max_element(counts.begin(), counts.end()),
+		distribution == NBODY_DIST_CONTIGUOUS ? "contiguous" : "cyclic", timesteps, (flags & 8) ? ", ring" : "", (flags & 16) ? ", compressed" : "",
+		min_messages, max_messages, max_peers, max_bytes);
+	return emu_report("ompif", ok ? 0.0 : INFINITY, end - start, 1);
+}
+
+static void emu_print_usage(char **argv)
+{
+	fprintf(stderr, "Usage: %s [OPTION]...\n", argv[0]);
+	fprintf(stderr, "Software emulation of the HLS accelerators\n\n");
+	fprintf(stderr, "  -k, --kernel=KERNEL\t\trun only KERNEL: calc_forces, calc_forces_sym, calc_forces_update,\n\t\t\t\tcalc_forces_stationary, update_particles,\n\t\t\t\tcompress_positions, precision, nbody_solve or ompif\n");
+	fprintf(stderr, "  -r, --repetitions=N\t\trun each kernel N times to measure the time (default: 1)\n");
+	fprintf(stderr, "  -b, --blocks=BLOCKS\t\tnumber of blocks of nbody_solve (default: 2)\n");
+	fprintf(stderr, "  -t, --timesteps=TIMESTEPS\tnumber of timesteps of nbody_solve (default: 2)\n");
+	fprintf(stderr, "  -l, --last-block=PARTICLES\tparticles of the last block of nbody_solve, the rest is padding (default: all)\n");
+	fprintf(stderr, "  -S, --symmetric\t\tuse the symmetric mode in nbody_solve\n");
+	fprintf(stderr, "  -F, --fused\t\t\tuse the fused force and update mode in nbody_solve\n");
+	fprintf(stderr, "  -O, --output-stationary\tuse the output stationary mode in nbody_solve\n");
+	fprintf(stderr, "  -R, --ring\t\t\tforward the positions along a ring of ranks in nbody_solve\n");
+	fprintf(stderr, "  -C, --compress\t\texchange packed 16-bit positions in nbody_solve\n");
+	fprintf(stderr, "  -n, --ranks=RANKS\t\tnumber of ranks of the ompif check (default: 4)\n");
+	fprintf(stderr, "  -w, --weights=W0,W1,...\tshare of the blocks of each rank of the ompif check (default: all 1)\n");
+	fprintf(stderr, "  -c, --contiguous\t\tgive each rank of the ompif check a range of blocks instead of cycling\n");
+	fprintf(stderr, "  -h, --help\t\t\tdisplay this help and exit\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *kernel = NULL;
+	int repetitions = 1, num_blocks = 2, timesteps = 2, flags = 0, ranks = 4, last_block = BLOCK_SIZE;
+	int distribution = NBODY_DIST_CYCLIC, num_weights = 0, total_weight = 0;
+	int weights[NBODY_MAX_RANKS];
+
+	static struct option long_options[] = {
+		{"kernel",		required_argument,	0, 'k'},
+		{"repetitions",	required_argument,	0, 'r'},
+		{"blocks",		required_argument,	0, 'b'},
+		{"timesteps",	required_argument,	0, 't'},
+		{"last-block",	required_argument,	0, 'l'},
+		{"symmetric",	no_argument,		0, 'S'},
+		{"fused",		no_argument,		0, 'F'},
+		{"output-stationary",	no_argument,	0, 'O'},
+		{"ring",		no_argument,		0, 'R'},
+		{"compress",	no_argument,		0, 'C'},
+		{"ranks",		required_argument,	0, 'n'},
+		{"weights",		required_argument,	0, 'w'},
+		{"contiguous",	no_argument,		0, 'c'},
+		{"help",		no_argument,		0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "hSFORCck:r:b:t:l:n:w:", long_options, NULL)) != -1) {
+		switch (c) {
+			case 'k':
+				kernel = optarg;
+				break;
+			case 'r':
+				repetitions = atoi(optarg);
+				break;
+			case 'b':
+				num_blocks = atoi(optarg);
+				break;
+			case 't':
+				timesteps = atoi(optarg);
+				break;
+			case 'l':
+				last_block = atoi(optarg);
+				break;
+			case 'S':
+				flags |= 1;
+				break;
+			case 'F':
+				flags |= 2;
+				break;
+			case 'O':
+				flags |= 4;
+				break;
+			case 'R':
+				flags |= 8;
+				break;
+			case 'C':
+				flags |= 16;
+				break;
+			case 'n':
+				ranks = atoi(optarg);
+				break;
+			case 'w':
+				for (char *w = strtok(optarg, ","); w && num_weights < NBODY_MAX_RANKS; w = strtok(NULL, ",")) {
+					weights[num_weights] = atoi(w);
+					if (weights[num_weights] < 0) total_weight = -1;
+					if (total_weight >= 0) total_weight += weights[num_weights];
+					num_weights++;
+				}
+				break;
+			case 'c':
+				distribution = NBODY_DIST_CONTIGUOUS;
+				break;
+			case 'h':
+				emu_print_usage(argv);
+				return 0;
+			default:
+				emu_print_usage(argv);
+				return 1;
+		}
+	}
+	if (repetitions <= 0 || num_blocks <= 0 || num_blocks > NBODY_MAX_BLOCKS || timesteps <= 0 || last_block <= 0 || last_block > BLOCK_SIZE || ranks <= 0 || ranks > NBODY_MAX_RANKS
+		|| num_weights > ranks || (num_weights && total_weight <= 0)) {
+		emu_print_usage(argv);
+		return 1;
+	}
+	for (int r = num_weights; r < ranks; r++) weights[r] = 1;
+
+	int ok = 1;
+	if (!kernel || !strcmp(kernel, "calc_forces"))
+		ok &= emu_check_calc_forces(repetitions);
+	if (!kernel || !strcmp(kernel, "calc_forces_sym"))
+		ok &= emu_check_calc_forces_sym(repetitions);
+	if (!kernel || !strcmp(kernel, "calc_forces_update"))
+		ok &= emu_check_calc_forces_update(repetitions);
+	if (!kernel || !strcmp(kernel, "calc_forces_stationary"))
+		ok &= emu_check_calc_forces_stationary(repetitions, num_blocks);
+	if (!kernel || !strcmp(kernel, "update_particles"))
+		ok &= emu_check_update_particles(repetitions);
+	if (!kernel || !strcmp(kernel, "compress_positions"))
+		ok &= emu_check_compress_positions(repetitions);
+	if (!kernel || !strcmp(kernel, "precision"))
+		ok &= emu_check_precision(repetitions);
+	if (!kernel || !strcmp(kernel, "nbody_solve"))
+		ok &= emu_check_nbody_solve(num_blocks, timesteps, flags, last_block);
+	if (!kernel || !strcmp(kernel, "ompif"))
+		ok &= emu_check_ompif(num_blocks, timesteps, flags, ranks, weights, distribution);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+// Host stand-in of the Vitis HLS half precision type. The value is kept in
+// a float, rounded to the nearest fp16 value after every operation.
+
+#ifndef EMU_HLS_HALF_H
+#define EMU_HLS_HALF_H
+
+#include <math.h>
+
+struct half {
+	float val;
+
+	half() : val(0.0f) {}
+	half(float v) : val(round(v)) {}
+
+	operator float() const
+	{
+		return val;
+	}
+
+	// Nearest fp16 value: 11 significant bits, subnormals below 2^-14 and
+	// infinity above the largest finite value
+	static float round(float v)
+	{
+		const float a = fabsf(v);
+		if (isnan(v)) return v;
+		if (a >= 65520.0f) return copysignf(INFINITY, v);
+		const float ulp = a < 6.103515625e-05f ? 5.9604644775390625e-08f : ldexpf(1.0f, ilogbf(a) - 10);
+		return copysignf(nearbyintf(a / ulp) * ulp, v);
+	}
+};
+
+static inline half operator+(half a, half b) { return half(a.val + b.val); }
+static inline half operator-(half a, half b) { return half(a.val - b.val); }
+static inline half operator*(half a, half b) { return half(a.val * b.val); }
+static inline half operator/(half a, half b) { return half(a.val / b.val); }
+
+#endif // EMU_HLS_HALF_H
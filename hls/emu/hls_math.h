@@ -0,0 +1,39 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+// Host stand-in of the Vitis HLS math functions used by the kernels
+
+#ifndef EMU_HLS_MATH_H
+#define EMU_HLS_MATH_H
+
+#include <math.h>
+
+namespace hls {
+
+static inline float rsqrtf(float x)
+{
+	return 1.0f/::sqrtf(x);
+}
+
+static inline float sqrtf(float x)
+{
+	return ::sqrtf(x);
+}
+
+static inline float frexpf(float x, int *exp)
+{
+	return ::frexpf(x, exp);
+}
+
+static inline float ldexpf(float x, int exp)
+{
+	return ::ldexpf(x, exp);
+}
+
+} // namespace hls
+
+#endif // EMU_HLS_MATH_H
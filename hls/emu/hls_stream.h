@@ -0,0 +1,57 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+// Host stand-in of the Vitis HLS streams and of ap_wait. Streams are
+// unbounded FIFOs, and reading an empty stream is a protocol error
+// because the emulated accelerator would block forever.
+
+#ifndef EMU_HLS_STREAM_H
+#define EMU_HLS_STREAM_H
+
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+
+static inline void ap_wait() {}
+
+namespace hls {
+
+template<typename T>
+class stream {
+	std::deque<T> fifo;
+
+public:
+	T read()
+	{
+		if (fifo.empty()) {
+			fprintf(stderr, "emu: read from an empty stream, the accelerator would hang\n");
+			abort();
+		}
+		T v = fifo.front();
+		fifo.pop_front();
+		return v;
+	}
+
+	void write(const T &v)
+	{
+		fifo.push_back(v);
+	}
+
+	bool empty() const
+	{
+		return fifo.empty();
+	}
+
+	size_t size() const
+	{
+		return fifo.size();
+	}
+};
+
+} // namespace hls
+
+#endif // EMU_HLS_STREAM_H
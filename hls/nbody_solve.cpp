@@ -15,6 +15,8 @@
 #include <hls_stream.h>
 #include <ap_int.h>
 #include <ap_axi_sdata.h>
+#include "nbody_build_config.h"
+#include "../src/nbody_config.h"
 
 static ap_uint<64> __mcxx_taskId;
 template<class T>
@@ -37,6 +39,7 @@ struct __fpga_copyinfo_t {
 struct __data_owner_info_t {
 	unsigned long long int size;
 	unsigned char owner;
+	unsigned int offset;
 };
 void mcxx_task_create(const ap_uint<64> type, const ap_uint<8> instanceNum, const ap_uint<8> numArgs, const unsigned long long int args[], const ap_uint<8> numDeps, const unsigned long long int deps[], const ap_uint<8> numCopies, const __fpga_copyinfo_t copies[], int numDataOwners, __data_owner_info_t data_owners[], hls::stream<mcxx_outaxis>& mcxx_outPort, unsigned char ompif_rank, unsigned char ompif_size, unsigned char owner);
 void mcxx_task_create(const ap_uint<64> type, const ap_uint<8> instanceNum, const ap_uint<8> numArgs, const unsigned long long int args[], const ap_uint<8> numDeps, const unsigned long long int deps[], const ap_uint<8> numCopies, const __fpga_copyinfo_t copies[], hls::stream<mcxx_outaxis>& mcxx_outPort);
@@ -71,20 +74,76 @@ void OMPIF_Send(const void *data, unsigned int size, int destination, const ap_u
 void OMPIF_Bcast(const void *data, unsigned int size, const ap_uint<8> numDeps, const unsigned long long int deps[], hls::stream<mcxx_outaxis>& mcxx_outPort);
 void OMPIF_Recv(void *data, unsigned int size, int source, const ap_uint<8> numDeps, const unsigned long long int deps[], hls::stream<mcxx_outaxis>& mcxx_outPort);
 
-static const unsigned int PARTICLES_FPGABLOCK_POS_X_OFFSET = 0 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_POS_Y_OFFSET = 1 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_POS_Z_OFFSET = 2 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_MASS_OFFSET = 6 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_WEIGHT_OFFSET = 7 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_SIZE = 8 * 2048;
-static const unsigned int FORCE_FPGABLOCK_X_OFFSET = 0 * 2048;
-static const unsigned int FORCE_FPGABLOCK_Y_OFFSET = 1 * 2048;
-static const unsigned int FORCE_FPGABLOCK_Z_OFFSET = 2 * 2048;
-static const unsigned int FORCE_FPGABLOCK_SIZE = 3 * 2048;
-static void update_particles_moved(__mcxx_ptr_t<float> particles, __mcxx_ptr_t<float> forces, const int num_blocks, const float time_interval, unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+static const int BLOCK_SIZE = NBODY_BLOCK_SIZE;
+static constexpr unsigned int FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
+static const unsigned int PARTICLES_FPGABLOCK_MASS_OFFSET = 0 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_X_OFFSET = 1 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_Y_OFFSET = 2 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_Z_OFFSET = 3 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_WEIGHT_OFFSET = 4 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_SIZE = 8 * BLOCK_SIZE;
+static const unsigned int FORCE_FPGABLOCK_X_OFFSET = 0 * BLOCK_SIZE;
+static const unsigned int FORCE_FPGABLOCK_Y_OFFSET = 1 * BLOCK_SIZE;
+static const unsigned int FORCE_FPGABLOCK_Z_OFFSET = 2 * BLOCK_SIZE;
+static const unsigned int FORCE_FPGABLOCK_SIZE = 3 * BLOCK_SIZE;
+static const int NBODY_SOLVE_SYMMETRIC = 0x1;
+static const int NBODY_SOLVE_FUSED = 0x2;
+static const int NBODY_SOLVE_STATIONARY = 0x4;
+static const int NBODY_SOLVE_RING = 0x8;
+static const int NBODY_SOLVE_COMPRESS = 0x10;
+//NOTE: Data owners of the updated positions. All the other ranks receive
+//      them from the owner, or from the previous rank in the ring
+static const unsigned char OMPIF_OWNER_BCAST = 255;
+static const unsigned char OMPIF_OWNER_RING = 254;
+//NOTE: Owner rank of each block, written by the host after the packed
+//      positions in the forces allocation
+static const int MAX_BLOCKS = NBODY_MAX_BLOCKS;
+static const unsigned int PARTICLES_FPGABLOCK_POS_SIZE = 3 * BLOCK_SIZE;
+static const unsigned int PACKED_FPGABLOCK_SIZE = 16 + 3 * BLOCK_SIZE / 2;
+//The owner packs the positions of the block and broadcasts the packed
+//block, and the other ranks unpack it into their copy of the particles
+static void compress_positions_moved(__mcxx_ptr_t<float> block, __mcxx_ptr_t<float> packed, const int flags, unsigned char owner, unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+{
+#pragma HLS inline
+	{
+		unsigned long long int __mcxx_args[3L];
+		unsigned long long int __mcxx_deps[2L];
+		__fpga_copyinfo_t __mcxx_copies[2L];
+		__mcxx_args[0] = (block + PARTICLES_FPGABLOCK_POS_X_OFFSET).val;
+		const __fpga_copyinfo_t copy1 = {.copy_address = 0, .arg_idx = 0, .flags = 1, .size = 0};
+		__mcxx_copies[0] = copy1;
+		__mcxx_args[1] = packed.val;
+		const __fpga_copyinfo_t copy2 = {.copy_address = 0, .arg_idx = 1, .flags = 2, .size = 0};
+		__mcxx_copies[1] = copy2;
+		__mcxx_args[2] = 0;
+		//The packed block goes first, it is the one broadcast to the other ranks
+		__mcxx_deps[0] = 2LLU << 58 | packed.val;
+		__mcxx_deps[1] = 1LLU << 58 | block.val;
+		__data_owner_info_t data_owners[1];
+		const __data_owner_info_t data_owner_0 = {.size = PACKED_FPGABLOCK_SIZE*sizeof(float), .owner = (flags & NBODY_SOLVE_RING) ? OMPIF_OWNER_RING : OMPIF_OWNER_BCAST, .offset = 0};
+		data_owners[0] = data_owner_0;
+		mcxx_task_create(4294967304LLU, 255, 3, __mcxx_args, 2, __mcxx_deps, 2, __mcxx_copies, 1, data_owners, mcxx_outPort, __ompif_rank, __ompif_size, owner);
+	}
+	if (owner != __ompif_rank) {
+		unsigned long long int __mcxx_args[3L];
+		unsigned long long int __mcxx_deps[2L];
+		__fpga_copyinfo_t __mcxx_copies[2L];
+		__mcxx_args[0] = (block + PARTICLES_FPGABLOCK_POS_X_OFFSET).val;
+		const __fpga_copyinfo_t copy1 = {.copy_address = 0, .arg_idx = 0, .flags = 2, .size = 0};
+		__mcxx_copies[0] = copy1;
+		__mcxx_args[1] = packed.val;
+		const __fpga_copyinfo_t copy2 = {.copy_address = 0, .arg_idx = 1, .flags = 1, .size = 0};
+		__mcxx_copies[1] = copy2;
+		__mcxx_args[2] = 1;
+		__mcxx_deps[0] = 1LLU << 58 | packed.val;
+		__mcxx_deps[1] = 3LLU << 58 | block.val;
+		mcxx_task_create(4294967304LLU, 255, 3, __mcxx_args, 2, __mcxx_deps, 2, __mcxx_copies, mcxx_outPort);
+	}
+}
+static void update_particles_moved(__mcxx_ptr_t<float> particles, __mcxx_ptr_t<float> forces, const int num_blocks, const float time_interval, unsigned char forces_flags, __mcxx_ptr_t<float> packed, const int flags, const unsigned char block_owner[MAX_BLOCKS], unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
 {
 	const unsigned char cluster_size = __ompif_size;
-	const int blocks_per_rank = num_blocks/cluster_size;
+	const bool compress = (flags & NBODY_SOLVE_COMPRESS) && cluster_size > 1;
 	update_particles:
 	for (int i = 0; i < num_blocks; i++)
 	{
@@ -95,12 +154,12 @@ static void update_particles_moved(__mcxx_ptr_t<float> particles, __mcxx_ptr_t<f
 			__mcxx_ptr_t<float> __mcxx_arg_0;
 			__mcxx_arg_0 = particles + i * PARTICLES_FPGABLOCK_SIZE;
 			__mcxx_args[0] = __mcxx_arg_0.val;
-			const __fpga_copyinfo_t tmp_0 = {.copy_address = __mcxx_arg_0.val, .arg_idx = 0, .flags = 3, .size = 16384L * sizeof(float)};
+			const __fpga_copyinfo_t tmp_0 = {.copy_address = __mcxx_arg_0.val, .arg_idx = 0, .flags = 3, .size = PARTICLES_FPGABLOCK_SIZE * sizeof(float)};
 			__mcxx_copies[0] = tmp_0;
 			__mcxx_ptr_t<float> __mcxx_arg_1;
 			__mcxx_arg_1 = forces + i * FORCE_FPGABLOCK_SIZE;
 			__mcxx_args[1] = __mcxx_arg_1.val;
-			const __fpga_copyinfo_t tmp_1 = {.copy_address = __mcxx_arg_1.val, .arg_idx = 1, .flags = 3, .size = 6144L * sizeof(float)};
+			const __fpga_copyinfo_t tmp_1 = {.copy_address = __mcxx_arg_1.val, .arg_idx = 1, .flags = forces_flags, .size = FORCE_FPGABLOCK_SIZE * sizeof(float)};
 			__mcxx_copies[1] = tmp_1;
 			__mcxx_cast<float> cast_param_2;
 			cast_param_2.typed = time_interval;
@@ -112,116 +171,397 @@ static void update_particles_moved(__mcxx_ptr_t<float> particles, __mcxx_ptr_t<f
 			__mcxx_dep_1 = forces + i * FORCE_FPGABLOCK_SIZE + 0L / 4U;
 			__mcxx_deps[1] = 3LLU << 58 | __mcxx_dep_1.val;
 			__data_owner_info_t data_owners[1];
-			const __data_owner_info_t data_owner_0 = {.size = FORCE_FPGABLOCK_SIZE*sizeof(float), .owner = 255};
+			const __data_owner_info_t data_owner_0 = {.size = PARTICLES_FPGABLOCK_POS_SIZE*sizeof(float), .owner = (flags & NBODY_SOLVE_RING) ? OMPIF_OWNER_RING : OMPIF_OWNER_BCAST, .offset = PARTICLES_FPGABLOCK_POS_X_OFFSET*sizeof(float)};
 			data_owners[0] = data_owner_0;
-			mcxx_task_create(4294967298LLU, 255, 3, __mcxx_args, 2, __mcxx_deps, 2, __mcxx_copies, 1, data_owners, mcxx_outPort, __ompif_rank, __ompif_size, i%cluster_size);
+			mcxx_task_create(4294967298LLU, 255, 3, __mcxx_args, 2, __mcxx_deps, 2, __mcxx_copies, compress ? 0 : 1, data_owners, mcxx_outPort, __ompif_rank, __ompif_size, block_owner[i]);
 		}
+		if (compress)
+			compress_positions_moved(particles + i * PARTICLES_FPGABLOCK_SIZE, packed + i * PACKED_FPGABLOCK_SIZE, flags, block_owner[i], __ompif_rank, __ompif_size, mcxx_outPort);
 		;
 	}
 
 }
-static void calculate_forces_N2_moved(__mcxx_ptr_t<float> forces, __mcxx_ptr_t<const float> particles, const int num_blocks, unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+static void calc_forces_task_create(__mcxx_ptr_t<float> forcesTarget, __mcxx_ptr_t<const float> block1, __mcxx_ptr_t<const float> block2, unsigned char forces_flags, const int step, unsigned char owner, unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+{
+#pragma HLS inline
+	{
+		unsigned long long int __mcxx_args[4L];
+		unsigned long long int __mcxx_deps[3L];
+		__fpga_copyinfo_t __mcxx_copies[3L];
+		__mcxx_ptr_t<float> __mcxx_arg_0;
+		__mcxx_arg_0 = forcesTarget;
+		__mcxx_args[0] = __mcxx_arg_0.val;
+		const __fpga_copyinfo_t copy1 = {.copy_address = 0, .arg_idx = 0, .flags = forces_flags, .size = 0};
+		__mcxx_copies[0] = copy1;
+		//The hot part of the target block, from the mass to the z positions
+		__mcxx_ptr_t<float> __mcxx_arg_1;
+		__mcxx_arg_1 = block1 + PARTICLES_FPGABLOCK_MASS_OFFSET;
+		__mcxx_args[1] = __mcxx_arg_1.val;
+		const __fpga_copyinfo_t copy2 = {.copy_address = 0, .arg_idx = 1, .flags = 1, .size = 0};
+		__mcxx_copies[1] = copy2;
+		//The hot part of the source block, from the x positions to the weights
+		__mcxx_ptr_t<float> __mcxx_arg_2;
+		__mcxx_arg_2 = block2 + PARTICLES_FPGABLOCK_POS_X_OFFSET;
+		__mcxx_args[2] = __mcxx_arg_2.val;
+		const __fpga_copyinfo_t copy3 = {.copy_address = 0, .arg_idx = 2, .flags = 1, .size = 0};
+		__mcxx_copies[2] = copy3;
+		__mcxx_cast<int> cast_param_3;
+		cast_param_3.typed = step;
+		__mcxx_args[3] = cast_param_3.raw;
+		__mcxx_ptr_t<float> __mcxx_dep_0;
+		__mcxx_dep_0 = block2;
+		__mcxx_deps[0] = 1LLU << 58 | __mcxx_dep_0.val;
+		__mcxx_ptr_t<float> __mcxx_dep_1;
+		__mcxx_dep_1 = block1;
+		__mcxx_deps[1] = 1LLU << 58 | __mcxx_dep_1.val;
+		__mcxx_ptr_t<float> __mcxx_dep_2;
+		__mcxx_dep_2 = forcesTarget;
+		__mcxx_deps[2] = 3LLU << 58 | __mcxx_dep_2.val;
+
+		mcxx_task_create(4294967297LLU, 255, 4, __mcxx_args, 3, __mcxx_deps, 3, __mcxx_copies, 0, 0, mcxx_outPort, __ompif_rank, __ompif_size, owner);
+	}
+}
+static void calc_forces_sym_task_create(__mcxx_ptr_t<float> forces1, __mcxx_ptr_t<float> forces2, __mcxx_ptr_t<const float> block1, __mcxx_ptr_t<const float> block2, unsigned char owner, unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+{
+#pragma HLS inline
+	{
+		unsigned long long int __mcxx_args[14L];
+		unsigned long long int __mcxx_deps[4L];
+		__fpga_copyinfo_t __mcxx_copies[14L];
+		__mcxx_ptr_t<float> __mcxx_arg_0;
+		__mcxx_arg_0 = forces1 + FORCE_FPGABLOCK_X_OFFSET;
+		__mcxx_args[0] = __mcxx_arg_0.val;
+		const __fpga_copyinfo_t copy1 = {.copy_address = 0, .arg_idx = 0, .flags = 3, .size = 0};
+		__mcxx_copies[0] = copy1;
+		__mcxx_ptr_t<float> __mcxx_arg_1;
+		__mcxx_arg_1 = forces1 + FORCE_FPGABLOCK_Y_OFFSET;
+		__mcxx_args[1] = __mcxx_arg_1.val;
+		const __fpga_copyinfo_t copy2 = {.copy_address = 0, .arg_idx = 1, .flags = 3, .size = 0};
+		__mcxx_copies[1] = copy2;
+		__mcxx_ptr_t<float> __mcxx_arg_2;
+		__mcxx_arg_2 = forces1 + FORCE_FPGABLOCK_Z_OFFSET;
+		__mcxx_args[2] = __mcxx_arg_2.val;
+		const __fpga_copyinfo_t copy3 = {.copy_address = 0, .arg_idx = 2, .flags = 3, .size = 0};
+		__mcxx_copies[2] = copy3;
+		__mcxx_ptr_t<float> __mcxx_arg_3;
+		__mcxx_arg_3 = forces2 + FORCE_FPGABLOCK_X_OFFSET;
+		__mcxx_args[3] = __mcxx_arg_3.val;
+		const __fpga_copyinfo_t copy4 = {.copy_address = 0, .arg_idx = 3, .flags = 3, .size = 0};
+		__mcxx_copies[3] = copy4;
+		__mcxx_ptr_t<float> __mcxx_arg_4;
+		__mcxx_arg_4 = forces2 + FORCE_FPGABLOCK_Y_OFFSET;
+		__mcxx_args[4] = __mcxx_arg_4.val;
+		const __fpga_copyinfo_t copy5 = {.copy_address = 0, .arg_idx = 4, .flags = 3, .size = 0};
+		__mcxx_copies[4] = copy5;
+		__mcxx_ptr_t<float> __mcxx_arg_5;
+		__mcxx_arg_5 = forces2 + FORCE_FPGABLOCK_Z_OFFSET;
+		__mcxx_args[5] = __mcxx_arg_5.val;
+		const __fpga_copyinfo_t copy6 = {.copy_address = 0, .arg_idx = 5, .flags = 3, .size = 0};
+		__mcxx_copies[5] = copy6;
+		__mcxx_ptr_t<float> __mcxx_arg_6;
+		__mcxx_arg_6 = block1 + PARTICLES_FPGABLOCK_POS_X_OFFSET;
+		__mcxx_args[6] = __mcxx_arg_6.val;
+		const __fpga_copyinfo_t copy7 = {.copy_address = 0, .arg_idx = 6, .flags = 1, .size = 0};
+		__mcxx_copies[6] = copy7;
+		__mcxx_ptr_t<float> __mcxx_arg_7;
+		__mcxx_arg_7 = block1 + PARTICLES_FPGABLOCK_POS_Y_OFFSET;
+		__mcxx_args[7] = __mcxx_arg_7.val;
+		const __fpga_copyinfo_t copy8 = {.copy_address = 0, .arg_idx = 7, .flags = 1, .size = 0};
+		__mcxx_copies[7] = copy8;
+		__mcxx_ptr_t<float> __mcxx_arg_8;
+		__mcxx_arg_8 = block1 + PARTICLES_FPGABLOCK_POS_Z_OFFSET;
+		__mcxx_args[8] = __mcxx_arg_8.val;
+		const __fpga_copyinfo_t copy9 = {.copy_address = 0, .arg_idx = 8, .flags = 1, .size = 0};
+		__mcxx_copies[8] = copy9;
+		__mcxx_ptr_t<float> __mcxx_arg_9;
+		__mcxx_arg_9 = block1 + PARTICLES_FPGABLOCK_MASS_OFFSET;
+		__mcxx_args[9] = __mcxx_arg_9.val;
+		const __fpga_copyinfo_t copy10 = {.copy_address = 0, .arg_idx = 9, .flags = 1, .size = 0};
+		__mcxx_copies[9] = copy10;
+		__mcxx_ptr_t<float> __mcxx_arg_10;
+		__mcxx_arg_10 = block2 + PARTICLES_FPGABLOCK_POS_X_OFFSET;
+		__mcxx_args[10] = __mcxx_arg_10.val;
+		const __fpga_copyinfo_t copy11 = {.copy_address = 0, .arg_idx = 10, .flags = 1, .size = 0};
+		__mcxx_copies[10] = copy11;
+		__mcxx_ptr_t<float> __mcxx_arg_11;
+		__mcxx_arg_11 = block2 + PARTICLES_FPGABLOCK_POS_Y_OFFSET;
+		__mcxx_args[11] = __mcxx_arg_11.val;
+		const __fpga_copyinfo_t copy12 = {.copy_address = 0, .arg_idx = 11, .flags = 1, .size = 0};
+		__mcxx_copies[11] = copy12;
+		__mcxx_ptr_t<float> __mcxx_arg_12;
+		__mcxx_arg_12 = block2 + PARTICLES_FPGABLOCK_POS_Z_OFFSET;
+		__mcxx_args[12] = __mcxx_arg_12.val;
+		const __fpga_copyinfo_t copy13 = {.copy_address = 0, .arg_idx = 12, .flags = 1, .size = 0};
+		__mcxx_copies[12] = copy13;
+		__mcxx_ptr_t<float> __mcxx_arg_13;
+		__mcxx_arg_13 = block2 + PARTICLES_FPGABLOCK_WEIGHT_OFFSET;
+		__mcxx_args[13] = __mcxx_arg_13.val;
+		const __fpga_copyinfo_t copy14 = {.copy_address = 0, .arg_idx = 13, .flags = 1, .size = 0};
+		__mcxx_copies[13] = copy14;
+		__mcxx_ptr_t<float> __mcxx_dep_0;
+		__mcxx_dep_0 = block2;
+		__mcxx_deps[0] = 1LLU << 58 | __mcxx_dep_0.val;
+		__mcxx_ptr_t<float> __mcxx_dep_1;
+		__mcxx_dep_1 = block1;
+		__mcxx_deps[1] = 1LLU << 58 | __mcxx_dep_1.val;
+		__mcxx_ptr_t<float> __mcxx_dep_2;
+		__mcxx_dep_2 = forces1;
+		__mcxx_deps[2] = 3LLU << 58 | __mcxx_dep_2.val;
+		__mcxx_ptr_t<float> __mcxx_dep_3;
+		__mcxx_dep_3 = forces2;
+		__mcxx_deps[3] = 3LLU << 58 | __mcxx_dep_3.val;
+
+		mcxx_task_create(4294967301LLU, 255, 14, __mcxx_args, 4, __mcxx_deps, 14, __mcxx_copies, 0, 0, mcxx_outPort, __ompif_rank, __ompif_size, owner);
+	}
+}
+static void calc_forces_update_task_create(__mcxx_ptr_t<float> forcesTarget, __mcxx_ptr_t<float> block1, __mcxx_ptr_t<const float> block2, unsigned char forces_flags, const float time_interval, const int flags, unsigned char owner, unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+{
+#pragma HLS inline
+	{
+		unsigned long long int __mcxx_args[9L];
+		unsigned long long int __mcxx_deps[3L];
+		__fpga_copyinfo_t __mcxx_copies[8L];
+		__mcxx_ptr_t<float> __mcxx_arg_0;
+		__mcxx_arg_0 = forcesTarget + FORCE_FPGABLOCK_X_OFFSET;
+		__mcxx_args[0] = __mcxx_arg_0.val;
+		const __fpga_copyinfo_t copy1 = {.copy_address = 0, .arg_idx = 0, .flags = forces_flags, .size = 0};
+		__mcxx_copies[0] = copy1;
+		__mcxx_ptr_t<float> __mcxx_arg_1;
+		__mcxx_arg_1 = forcesTarget + FORCE_FPGABLOCK_Y_OFFSET;
+		__mcxx_args[1] = __mcxx_arg_1.val;
+		const __fpga_copyinfo_t copy2 = {.copy_address = 0, .arg_idx = 1, .flags = forces_flags, .size = 0};
+		__mcxx_copies[1] = copy2;
+		__mcxx_ptr_t<float> __mcxx_arg_2;
+		__mcxx_arg_2 = forcesTarget + FORCE_FPGABLOCK_Z_OFFSET;
+		__mcxx_args[2] = __mcxx_arg_2.val;
+		const __fpga_copyinfo_t copy3 = {.copy_address = 0, .arg_idx = 2, .flags = forces_flags, .size = 0};
+		__mcxx_copies[2] = copy3;
+		__mcxx_ptr_t<float> __mcxx_arg_3;
+		__mcxx_arg_3 = block1;
+		__mcxx_args[3] = __mcxx_arg_3.val;
+		const __fpga_copyinfo_t copy4 = {.copy_address = 0, .arg_idx = 3, .flags = 3, .size = 0};
+		__mcxx_copies[3] = copy4;
+		__mcxx_ptr_t<float> __mcxx_arg_4;
+		__mcxx_arg_4 = block2 + PARTICLES_FPGABLOCK_POS_X_OFFSET;
+		__mcxx_args[4] = __mcxx_arg_4.val;
+		const __fpga_copyinfo_t copy5 = {.copy_address = 0, .arg_idx = 4, .flags = 1, .size = 0};
+		__mcxx_copies[4] = copy5;
+		__mcxx_ptr_t<float> __mcxx_arg_5;
+		__mcxx_arg_5 = block2 + PARTICLES_FPGABLOCK_POS_Y_OFFSET;
+		__mcxx_args[5] = __mcxx_arg_5.val;
+		const __fpga_copyinfo_t copy6 = {.copy_address = 0, .arg_idx = 5, .flags = 1, .size = 0};
+		__mcxx_copies[5] = copy6;
+		__mcxx_ptr_t<float> __mcxx_arg_6;
+		__mcxx_arg_6 = block2 + PARTICLES_FPGABLOCK_POS_Z_OFFSET;
+		__mcxx_args[6] = __mcxx_arg_6.val;
+		const __fpga_copyinfo_t copy7 = {.copy_address = 0, .arg_idx = 6, .flags = 1, .size = 0};
+		__mcxx_copies[6] = copy7;
+		__mcxx_ptr_t<float> __mcxx_arg_7;
+		__mcxx_arg_7 = block2 + PARTICLES_FPGABLOCK_WEIGHT_OFFSET;
+		__mcxx_args[7] = __mcxx_arg_7.val;
+		const __fpga_copyinfo_t copy8 = {.copy_address = 0, .arg_idx = 7, .flags = 1, .size = 0};
+		__mcxx_copies[7] = copy8;
+		__mcxx_cast<float> cast_param_8;
+		cast_param_8.typed = time_interval;
+		__mcxx_args[8] = cast_param_8.raw;
+		//The particle block goes first, it is the one broadcast to the other ranks
+		__mcxx_ptr_t<float> __mcxx_dep_0;
+		__mcxx_dep_0 = block1;
+		__mcxx_deps[0] = 3LLU << 58 | __mcxx_dep_0.val;
+		__mcxx_ptr_t<float> __mcxx_dep_1;
+		__mcxx_dep_1 = forcesTarget;
+		__mcxx_deps[1] = 3LLU << 58 | __mcxx_dep_1.val;
+		__mcxx_ptr_t<float> __mcxx_dep_2;
+		__mcxx_dep_2 = block2;
+		__mcxx_deps[2] = 1LLU << 58 | __mcxx_dep_2.val;
+		//The source block is already a dependence when it is the target block
+		const ap_uint<8> num_deps = block1.val == block2.val ? 2 : 3;
+		__data_owner_info_t data_owners[1];
+		const __data_owner_info_t data_owner_0 = {.size = PARTICLES_FPGABLOCK_POS_SIZE*sizeof(float), .owner = (flags & NBODY_SOLVE_RING) ? OMPIF_OWNER_RING : OMPIF_OWNER_BCAST, .offset = PARTICLES_FPGABLOCK_POS_X_OFFSET*sizeof(float)};
+		data_owners[0] = data_owner_0;
+		//The packed positions are broadcast instead
+		const bool compress = (flags & NBODY_SOLVE_COMPRESS) && __ompif_size > 1;
+
+		mcxx_task_create(4294967302LLU, 255, 9, __mcxx_args, num_deps, __mcxx_deps, 8, __mcxx_copies, compress ? 0 : 1, data_owners, mcxx_outPort, __ompif_rank, __ompif_size, owner);
+	}
+}
+static void calc_forces_stationary_task_create(__mcxx_ptr_t<float> forcesTarget, __mcxx_ptr_t<const float> block1, __mcxx_ptr_t<const float> particles, const int num_blocks, unsigned char owner, unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+{
+#pragma HLS inline
+	{
+		unsigned long long int __mcxx_args[9L];
+		unsigned long long int __mcxx_deps[2L];
+		__fpga_copyinfo_t __mcxx_copies[7L];
+		__mcxx_ptr_t<float> __mcxx_arg_0;
+		__mcxx_arg_0 = forcesTarget + FORCE_FPGABLOCK_X_OFFSET;
+		__mcxx_args[0] = __mcxx_arg_0.val;
+		const __fpga_copyinfo_t copy1 = {.copy_address = 0, .arg_idx = 0, .flags = 2, .size = 0};
+		__mcxx_copies[0] = copy1;
+		__mcxx_ptr_t<float> __mcxx_arg_1;
+		__mcxx_arg_1 = forcesTarget + FORCE_FPGABLOCK_Y_OFFSET;
+		__mcxx_args[1] = __mcxx_arg_1.val;
+		const __fpga_copyinfo_t copy2 = {.copy_address = 0, .arg_idx = 1, .flags = 2, .size = 0};
+		__mcxx_copies[1] = copy2;
+		__mcxx_ptr_t<float> __mcxx_arg_2;
+		__mcxx_arg_2 = forcesTarget + FORCE_FPGABLOCK_Z_OFFSET;
+		__mcxx_args[2] = __mcxx_arg_2.val;
+		const __fpga_copyinfo_t copy3 = {.copy_address = 0, .arg_idx = 2, .flags = 2, .size = 0};
+		__mcxx_copies[2] = copy3;
+		__mcxx_ptr_t<float> __mcxx_arg_3;
+		__mcxx_arg_3 = block1 + PARTICLES_FPGABLOCK_POS_X_OFFSET;
+		__mcxx_args[3] = __mcxx_arg_3.val;
+		const __fpga_copyinfo_t copy4 = {.copy_address = 0, .arg_idx = 3, .flags = 1, .size = 0};
+		__mcxx_copies[3] = copy4;
+		__mcxx_ptr_t<float> __mcxx_arg_4;
+		__mcxx_arg_4 = block1 + PARTICLES_FPGABLOCK_POS_Y_OFFSET;
+		__mcxx_args[4] = __mcxx_arg_4.val;
+		const __fpga_copyinfo_t copy5 = {.copy_address = 0, .arg_idx = 4, .flags = 1, .size = 0};
+		__mcxx_copies[4] = copy5;
+		__mcxx_ptr_t<float> __mcxx_arg_5;
+		__mcxx_arg_5 = block1 + PARTICLES_FPGABLOCK_POS_Z_OFFSET;
+		__mcxx_args[5] = __mcxx_arg_5.val;
+		const __fpga_copyinfo_t copy6 = {.copy_address = 0, .arg_idx = 5, .flags = 1, .size = 0};
+		__mcxx_copies[5] = copy6;
+		__mcxx_ptr_t<float> __mcxx_arg_6;
+		__mcxx_arg_6 = block1 + PARTICLES_FPGABLOCK_MASS_OFFSET;
+		__mcxx_args[6] = __mcxx_arg_6.val;
+		const __fpga_copyinfo_t copy7 = {.copy_address = 0, .arg_idx = 6, .flags = 1, .size = 0};
+		__mcxx_copies[6] = copy7;
+		//The source blocks are read by the accelerator, without copies
+		__mcxx_ptr_t<float> __mcxx_arg_7;
+		__mcxx_arg_7 = particles;
+		__mcxx_args[7] = __mcxx_arg_7.val;
+		__mcxx_cast<int> cast_param_8;
+		cast_param_8.typed = num_blocks;
+		__mcxx_args[8] = cast_param_8.raw;
+		__mcxx_ptr_t<float> __mcxx_dep_0;
+		__mcxx_dep_0 = block1;
+		__mcxx_deps[0] = 1LLU << 58 | __mcxx_dep_0.val;
+		__mcxx_ptr_t<float> __mcxx_dep_1;
+		__mcxx_dep_1 = forcesTarget;
+		__mcxx_deps[1] = 2LLU << 58 | __mcxx_dep_1.val;
+
+		mcxx_task_create(4294967303LLU, 255, 9, __mcxx_args, 2, __mcxx_deps, 7, __mcxx_copies, 0, 0, mcxx_outPort, __ompif_rank, __ompif_size, owner);
+	}
+}
+static void calculate_forces_N2_moved(__mcxx_ptr_t<float> forces, __mcxx_ptr_t<const float> particles, const int num_blocks, const int step, const unsigned char block_owner[MAX_BLOCKS], unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
 {
 #pragma HLS inline
-	unsigned char cluster_size = __ompif_size;
-	unsigned char cluster_rank = __ompif_rank;
-	const unsigned int size = num_blocks/cluster_size;
-	const int lower_bound = cluster_rank*size;
-	const int upper_bound = cluster_rank*size + size;
 	calc_forces_outer:
 	for (int i = 0; i < num_blocks; i++)
 	{
 		calc_forces_inner:
 		for (int j = 0; j < num_blocks; j++)
 		{
-#pragma HLS pipeline II=39 //3+11+3+11*2 calc_forces
+#pragma HLS pipeline II=16 //3+4+3+3*2 calc_forces
 			__mcxx_ptr_t<float> forcesTarget = forces + j * FORCE_FPGABLOCK_SIZE;
 			__mcxx_ptr_t<const float> block1 = particles + j * PARTICLES_FPGABLOCK_SIZE;
 			__mcxx_ptr_t<const float> block2 = particles + i * PARTICLES_FPGABLOCK_SIZE;
-			{
-				unsigned long long int __mcxx_args[11L];
-				unsigned long long int __mcxx_deps[3L];
-				__fpga_copyinfo_t __mcxx_copies[11L];
-				__mcxx_ptr_t<float> __mcxx_arg_0;
-				__mcxx_arg_0 = forcesTarget + FORCE_FPGABLOCK_X_OFFSET;
-				__mcxx_args[0] = __mcxx_arg_0.val;
-				const __fpga_copyinfo_t copy1 = {.copy_address = 0, .flags = 3, .arg_idx = 0, .size = 0};
-				__mcxx_copies[0] = copy1;
-				__mcxx_ptr_t<float> __mcxx_arg_1;
-				__mcxx_arg_1 = forcesTarget + FORCE_FPGABLOCK_Y_OFFSET;
-				__mcxx_args[1] = __mcxx_arg_1.val;
-				const __fpga_copyinfo_t copy2 = {.copy_address = 0, .flags = 3, .arg_idx = 1, .size = 0};
-				__mcxx_copies[1] = copy2;
-				__mcxx_ptr_t<float> __mcxx_arg_2;
-				__mcxx_arg_2 = forcesTarget + FORCE_FPGABLOCK_Z_OFFSET;
-				__mcxx_args[2] = __mcxx_arg_2.val;
-				const __fpga_copyinfo_t copy3 = {.copy_address = 0, .flags = 3, .arg_idx = 2, .size = 0};
-				__mcxx_copies[2] = copy3;
-				__mcxx_ptr_t<float> __mcxx_arg_3;
-				__mcxx_arg_3 = block1 + PARTICLES_FPGABLOCK_POS_X_OFFSET;
-				__mcxx_args[3] = __mcxx_arg_3.val;
-				const __fpga_copyinfo_t copy4 = {.copy_address = 0, .flags = 1, .arg_idx = 3, .size = 0};
-				__mcxx_copies[3] = copy4;
-				__mcxx_ptr_t<float> __mcxx_arg_4;
-				__mcxx_arg_4 = block1 + PARTICLES_FPGABLOCK_POS_Y_OFFSET;
-				__mcxx_args[4] = __mcxx_arg_4.val;
-				const __fpga_copyinfo_t copy5 = {.copy_address = 0, .flags = 1, .arg_idx = 4, .size = 0};
-				__mcxx_copies[4] = copy5;
-				__mcxx_ptr_t<float> __mcxx_arg_5;
-				__mcxx_arg_5 = block1 + PARTICLES_FPGABLOCK_POS_Z_OFFSET;
-				__mcxx_args[5] = __mcxx_arg_5.val;
-				const __fpga_copyinfo_t copy6 = {.copy_address = 0, .flags = 1, .arg_idx = 5, .size = 0};
-				__mcxx_copies[5] = copy6;
-				__mcxx_ptr_t<float> __mcxx_arg_6;
-				__mcxx_arg_6 = block1 + PARTICLES_FPGABLOCK_MASS_OFFSET;
-				__mcxx_args[6] = __mcxx_arg_6.val;
-				const __fpga_copyinfo_t copy7 = {.copy_address = 0, .flags = 1, .arg_idx = 6, .size = 0};
-				__mcxx_copies[6] = copy7;
-				__mcxx_ptr_t<float> __mcxx_arg_7;
-				__mcxx_arg_7 = block2 + PARTICLES_FPGABLOCK_POS_X_OFFSET;
-				__mcxx_args[7] = __mcxx_arg_7.val;
-				const __fpga_copyinfo_t copy8 = {.copy_address = 0, .flags = 1, .arg_idx = 7, .size = 0};
-				__mcxx_copies[7] = copy8;
-				__mcxx_ptr_t<float> __mcxx_arg_8;
-				__mcxx_arg_8 = block2 + PARTICLES_FPGABLOCK_POS_Y_OFFSET;
-				__mcxx_args[8] = __mcxx_arg_8.val;
-				const __fpga_copyinfo_t copy9 = {.copy_address = 0, .flags = 1, .arg_idx = 8, .size = 0};
-				__mcxx_copies[8] = copy9;
-				__mcxx_ptr_t<float> __mcxx_arg_9;
-				__mcxx_arg_9 = block2 + PARTICLES_FPGABLOCK_POS_Z_OFFSET;
-				__mcxx_args[9] = __mcxx_arg_9.val;
-				const __fpga_copyinfo_t copy10 = {.copy_address = 0, .flags = 1, .arg_idx = 9, .size = 0};
-				__mcxx_copies[9] = copy10;
-				__mcxx_ptr_t<float> __mcxx_arg_10;
-				__mcxx_arg_10 = block2 + PARTICLES_FPGABLOCK_WEIGHT_OFFSET;
-				__mcxx_args[10] = __mcxx_arg_10.val;
-				const __fpga_copyinfo_t copy11 = {.copy_address = 0, .flags = 1, .arg_idx = 10, .size = 0};
-				__mcxx_copies[10] = copy11;
-				__mcxx_ptr_t<float> __mcxx_dep_0;
-				__mcxx_dep_0 = block2;
-				__mcxx_deps[0] = 1LLU << 58 | __mcxx_dep_0.val;
-				__mcxx_ptr_t<float> __mcxx_dep_1;
-				__mcxx_dep_1 = block1;
-				__mcxx_deps[1] = 1LLU << 58 | __mcxx_dep_1.val;
-				__mcxx_ptr_t<float> __mcxx_dep_2;
-				__mcxx_dep_2 = forcesTarget;
-				__mcxx_deps[2] = 3LLU << 58 | __mcxx_dep_2.val;
-
-				mcxx_task_create(4294967297LLU, 255, 11, __mcxx_args, 3, __mcxx_deps, 11, __mcxx_copies, 0, 0, mcxx_outPort, __ompif_rank, __ompif_size, j%cluster_size);
+			calc_forces_task_create(forcesTarget, block1, block2, 3, step, block_owner[j], __ompif_rank, __ompif_size, mcxx_outPort);
+		}
+	}
+}
+//Same order as calculate_forces_N2_moved, but the first source block of
+//each force block does not read the previous forces and the last one is a
+//calc_forces_update task that also updates the particles, so the forces
+//never go back to memory and there are no update_particles tasks.
+static void calculate_forces_fused_moved(__mcxx_ptr_t<float> forces, __mcxx_ptr_t<float> particles, const int num_blocks, const float time_interval, const int step, __mcxx_ptr_t<float> packed, const int flags, const unsigned char block_owner[MAX_BLOCKS], unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+{
+#pragma HLS inline
+	unsigned char cluster_size = __ompif_size;
+	calc_forces_fused_outer:
+	for (int i = 0; i < num_blocks; i++)
+	{
+		calc_forces_fused_inner:
+		for (int j = 0; j < num_blocks; j++)
+		{
+#pragma HLS pipeline II=16 //3+4+3+3*2 calc_forces
+			__mcxx_ptr_t<float> forcesTarget = forces + j * FORCE_FPGABLOCK_SIZE;
+			__mcxx_ptr_t<float> block1 = particles + j * PARTICLES_FPGABLOCK_SIZE;
+			__mcxx_ptr_t<const float> block2 = particles + i * PARTICLES_FPGABLOCK_SIZE;
+			//Copy out only for the first contribution, no copies when it is also the last one
+			const unsigned char forces_flags = i == 0 ? 2 : 3;
+			if (i == num_blocks - 1) {
+				calc_forces_update_task_create(forcesTarget, block1, block2, forces_flags & 1, time_interval, flags, block_owner[j], __ompif_rank, __ompif_size, mcxx_outPort);
+				if ((flags & NBODY_SOLVE_COMPRESS) && cluster_size > 1)
+					compress_positions_moved(block1, packed + j * PACKED_FPGABLOCK_SIZE, flags, block_owner[j], __ompif_rank, __ompif_size, mcxx_outPort);
+			}
+			else
+				calc_forces_task_create(forcesTarget, block1, block2, forces_flags, step, block_owner[j], __ompif_rank, __ompif_size, mcxx_outPort);
+		}
+	}
+}
+//One task per force block that streams all the source blocks. The tasks
+//cannot have a dependence on every particle block, so the whole step is
+//ordered with taskwaits: all the forces are computed before any block is
+//updated, and all the updates and broadcasts finish before the next step.
+static void calculate_forces_stationary_moved(__mcxx_ptr_t<float> forces, __mcxx_ptr_t<const float> particles, const int num_blocks, const unsigned char block_owner[MAX_BLOCKS], unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+{
+#pragma HLS inline
+	calc_forces_stationary:
+	for (int j = 0; j < num_blocks; j++)
+	{
+		__mcxx_ptr_t<float> forcesTarget = forces + j * FORCE_FPGABLOCK_SIZE;
+		__mcxx_ptr_t<const float> block1 = particles + j * PARTICLES_FPGABLOCK_SIZE;
+		calc_forces_stationary_task_create(forcesTarget, block1, particles, num_blocks, block_owner[j], __ompif_rank, __ompif_size, mcxx_outPort);
+	}
+}
+//Each unordered pair of blocks is visited once. When both blocks belong to
+//the same rank, a single calc_forces_sym task accumulates the equal and
+//opposite forces into both force blocks. Otherwise each rank computes the
+//forces over its own block, since the force blocks are not shared.
+static void calculate_forces_sym_moved(__mcxx_ptr_t<float> forces, __mcxx_ptr_t<const float> particles, const int num_blocks, const int step, const unsigned char block_owner[MAX_BLOCKS], unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<mcxx_outaxis>& mcxx_outPort)
+{
+#pragma HLS inline
+	calc_forces_sym_outer:
+	for (int i = 0; i < num_blocks; i++)
+	{
+		calc_forces_sym_inner:
+		for (int j = i; j < num_blocks; j++)
+		{
+			__mcxx_ptr_t<float> forces1 = forces + j * FORCE_FPGABLOCK_SIZE;
+			__mcxx_ptr_t<float> forces2 = forces + i * FORCE_FPGABLOCK_SIZE;
+			__mcxx_ptr_t<const float> block1 = particles + j * PARTICLES_FPGABLOCK_SIZE;
+			__mcxx_ptr_t<const float> block2 = particles + i * PARTICLES_FPGABLOCK_SIZE;
+			if (i == j) {
+				calc_forces_task_create(forces1, block1, block2, 3, step, block_owner[j], __ompif_rank, __ompif_size, mcxx_outPort);
+			}
+			else if (block_owner[i] == block_owner[j]) {
+				calc_forces_sym_task_create(forces1, forces2, block1, block2, block_owner[j], __ompif_rank, __ompif_size, mcxx_outPort);
+			}
+			else {
+				calc_forces_task_create(forces1, block1, block2, 3, step, block_owner[j], __ompif_rank, __ompif_size, mcxx_outPort);
+				calc_forces_task_create(forces2, block2, block1, 3, step, block_owner[i], __ompif_rank, __ompif_size, mcxx_outPort);
 			}
-			;
 		}
 	}
 }
 typedef unsigned char __uint8_t;
 typedef __uint8_t uint8_t;
-void nbody_solve_moved(__mcxx_ptr_t<float> particles, __mcxx_ptr_t<float> forces, const int num_blocks, const int timesteps, const float time_interval, unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<ap_uint<8> >& mcxx_spawnInPort, hls::stream<mcxx_outaxis>& mcxx_outPort)
+void nbody_solve_moved(__mcxx_ptr_t<float> particles, __mcxx_ptr_t<float> forces, const int num_blocks, const int timesteps, const float time_interval, const int flags, const unsigned char block_owner[MAX_BLOCKS], unsigned char __ompif_rank, unsigned char __ompif_size, hls::stream<ap_uint<8> >& mcxx_spawnInPort, hls::stream<mcxx_outaxis>& mcxx_outPort)
 {
 #pragma HLS inline
+  //The packed positions of the compressed exchange follow the force blocks
+  const __mcxx_ptr_t<float> packed = forces + num_blocks * FORCE_FPGABLOCK_SIZE;
   for (int t = 0; t < timesteps; t++)
     {
-      calculate_forces_N2_moved(forces, particles, num_blocks, __ompif_rank, __ompif_size, mcxx_outPort);
-      update_particles_moved(particles, forces, num_blocks, time_interval, __ompif_rank, __ompif_size, mcxx_outPort);
+      if (flags & NBODY_SOLVE_SYMMETRIC) {
+        calculate_forces_sym_moved(forces, particles, num_blocks, t, block_owner, __ompif_rank, __ompif_size, mcxx_outPort);
+        update_particles_moved(particles, forces, num_blocks, time_interval, 3, packed, flags, block_owner, __ompif_rank, __ompif_size, mcxx_outPort);
+      }
+      else if (flags & NBODY_SOLVE_STATIONARY) {
+        calculate_forces_stationary_moved(forces, particles, num_blocks, block_owner, __ompif_rank, __ompif_size, mcxx_outPort);
+        mcxx_taskwait(mcxx_spawnInPort, mcxx_outPort);
+        //The forces are overwritten every step, no need to clear them
+        update_particles_moved(particles, forces, num_blocks, time_interval, 1, packed, flags, block_owner, __ompif_rank, __ompif_size, mcxx_outPort);
+        mcxx_taskwait(mcxx_spawnInPort, mcxx_outPort);
+      }
+      else if (flags & NBODY_SOLVE_FUSED)
+        calculate_forces_fused_moved(forces, particles, num_blocks, time_interval, t, packed, flags, block_owner, __ompif_rank, __ompif_size, mcxx_outPort);
+      else {
+        calculate_forces_N2_moved(forces, particles, num_blocks, t, block_owner, __ompif_rank, __ompif_size, mcxx_outPort);
+        update_particles_moved(particles, forces, num_blocks, time_interval, 3, packed, flags, block_owner, __ompif_rank, __ompif_size, mcxx_outPort);
+      }
     }
   mcxx_taskwait(mcxx_spawnInPort, mcxx_outPort);
 }
@@ -234,11 +574,12 @@ void mcxx_write_out_port(const ap_uint<64> data, const ap_uint<2> dest, const ap
    axis_word.last = last;
    mcxx_outPort.write(axis_word);
 }
-void nbody_solve_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, hls::stream<ap_uint<8> >& mcxx_spawnInPort, unsigned char ompif_rank, unsigned char ompif_size) {
+void nbody_solve_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, hls::stream<ap_uint<8> >& mcxx_spawnInPort, ap_uint<FPGA_PWIDTH>* mcxx_memport, unsigned char ompif_rank, unsigned char ompif_size) {
 #pragma HLS interface ap_ctrl_none port=return
 #pragma HLS interface axis port=mcxx_inPort
 #pragma HLS interface axis port=mcxx_outPort
 #pragma HLS interface axis port=mcxx_spawnInPort
+#pragma HLS interface m_axi port=mcxx_memport
 #pragma HLS stable variable=ompif_rank
 #pragma HLS stable variable=ompif_size
    mcxx_inPort.read(); //command word
@@ -249,6 +590,7 @@ void nbody_solve_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcx
    int num_blocks;
    int timesteps;
    float time_interval;
+   int flags;
    {
       #pragma HLS protocol fixed
       {
@@ -299,8 +641,57 @@ void nbody_solve_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcx
          time_interval = mcxx_arg_4.typed;
       }
       ap_wait();
+      {
+         ap_uint<8> mcxx_flags_5;
+         ap_uint<64> mcxx_offset_5;
+         mcxx_flags_5 = mcxx_inPort.read()(7,0);
+         ap_wait();
+         __mcxx_cast<int> mcxx_arg_5;
+         mcxx_arg_5.raw = mcxx_inPort.read();
+         flags = mcxx_arg_5.typed;
+      }
+      ap_wait();
    }
-   nbody_solve_moved(particles, forces, num_blocks, timesteps, time_interval, ompif_rank, ompif_size, mcxx_spawnInPort, mcxx_outPort);
+   static unsigned char block_owner[MAX_BLOCKS];
+   const ap_uint<64> mcxx_offset_owners = forces.val + num_blocks * (FORCE_FPGABLOCK_SIZE + PACKED_FPGABLOCK_SIZE) * sizeof(float);
+   //The configuration of the bitstream, after the owners padded to 64 bytes,
+   //which the host reads back before the simulation
+   {
+      const ap_uint<64> mcxx_offset_config = mcxx_offset_owners + (num_blocks + 63)/64*64;
+      const unsigned int __config[NBODY_CONFIG_FIELDS] = NBODY_CONFIG_RECORD;
+      for (int __i = 0; __i < NBODY_CONFIG_RECORD_SIZE/sizeof(ap_uint<FPGA_PWIDTH>); ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer = 0;
+         for (int __j = 0; __j < FPGA_PWIDTH/32; ++__j) {
+            if (__i*(FPGA_PWIDTH/32) + __j < NBODY_CONFIG_FIELDS)
+               __tmpBuffer((__j+1)*32-1, __j*32) = __config[__i*(FPGA_PWIDTH/32) + __j];
+         }
+         *(mcxx_memport + mcxx_offset_config/sizeof(ap_uint<FPGA_PWIDTH>) + __i) = __tmpBuffer;
+      }
+   }
+   {
+      for (int __i = 0; __i < (num_blocks - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
+      #pragma HLS pipeline II=1
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_owners/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j = 0; __j < sizeof(ap_uint<FPGA_PWIDTH>); ++__j) {
+            if (__i*sizeof(ap_uint<FPGA_PWIDTH>) + __j < MAX_BLOCKS)
+               block_owner[__i*sizeof(ap_uint<FPGA_PWIDTH>) + __j] = __tmpBuffer((__j+1)*8-1, __j*8);
+         }
+      }
+   }
+   //The host does not copy the force blocks, each rank clears its own
+   {
+      const int __words = FORCE_FPGABLOCK_SIZE * sizeof(float) / sizeof(ap_uint<FPGA_PWIDTH>);
+      for (int __b = 0; __b < num_blocks; ++__b) {
+         if (block_owner[__b] != ompif_rank) continue;
+         for (int __i = 0; __i < __words; ++__i) {
+         #pragma HLS pipeline II=1
+            *(mcxx_memport + forces.val/sizeof(ap_uint<FPGA_PWIDTH>) + __b*__words + __i) = 0;
+         }
+      }
+   }
+   nbody_solve_moved(particles, forces, num_blocks, timesteps, time_interval, flags, block_owner, ompif_rank, ompif_size, mcxx_spawnInPort, mcxx_outPort);
    {
       #pragma HLS protocol fixed
       ap_uint<64> header = 0x03;
@@ -344,16 +735,29 @@ void mcxx_task_create(const ap_uint<64> type, const ap_uint<8> instanceNum, cons
 		const unsigned char data_owner = data_owners[i].owner;
 		const unsigned int size = data_owners[i].size;
 		const bool is_out = (deps[i] >> 59) & 0x1;
-		if (owner == rank && data_owner == 255 && is_out) { //broadcast
-			const unsigned long long addr = deps[i] & 0x00FFFFFFFFFFFFFF;
-			const unsigned long long int dep[2] = {addr | (1LLU << 58), 0x0000100000000000LLU | (3LLU << 58)};
-			unsigned char j = rank + 1 == ompif_size ? 0 : rank+1;
-			OMPIF_Bcast((void*)addr, size, 2, dep, mcxx_outPort);
+		const unsigned long long addr = deps[i] & 0x00FFFFFFFFFFFFFF;
+		//The dependence is on the whole block, but only the data from the
+		//offset is exchanged
+		const unsigned long long data = addr + data_owners[i].offset;
+		const unsigned long long int send_dep[2] = {addr | (1LLU << 58), 0x0000100000000000LLU | (3LLU << 58)};
+		const unsigned long long int recv_dep[2] = {addr | (2LLU << 58), 0x0000200000000000LLU | (3LLU << 58)};
+		if (owner == rank && data_owner == OMPIF_OWNER_BCAST && is_out) {
+			OMPIF_Bcast((void*)data, size, 2, send_dep, mcxx_outPort);
 		}
-		else if (owner != rank && data_owner == 255 && is_out) {
-			const unsigned long long addr = deps[i] & 0x00FFFFFFFFFFFFFF;
-			const unsigned long long int dep[2] = {addr | (2LLU << 58), 0x0000200000000000LLU | (3LLU << 58)};
-			OMPIF_Recv((void*)addr, size, owner, 2, dep, mcxx_outPort);
+		else if (owner != rank && data_owner == OMPIF_OWNER_BCAST && is_out) {
+			OMPIF_Recv((void*)data, size, owner, 2, recv_dep, mcxx_outPort);
+		}
+		else if (ompif_size > 1 && data_owner == OMPIF_OWNER_RING && is_out) {
+			//Each rank receives the block from the previous one and forwards
+			//it to the next one, until it gets back to the owner. The sends
+			//and receives are issued in the same order in all the ranks, so
+			//every link carries one message per block.
+			const unsigned char next = rank + 1 == ompif_size ? 0 : rank + 1;
+			const unsigned char prev = rank == 0 ? ompif_size - 1 : rank - 1;
+			if (owner != rank)
+				OMPIF_Recv((void*)data, size, prev, 2, recv_dep, mcxx_outPort);
+			if (next != owner)
+				OMPIF_Send((void*)data, size, next, 2, send_dep, mcxx_outPort);
 		}
 	}
 }
@@ -406,6 +810,17 @@ void OMPIF_Recv(void *data, unsigned int size, int source, const ap_uint<8> numD
 	mcxx_task_create(4294967300LU, 0xFF, 2, args, numDeps, deps, 0, 0, mcxx_outPort);
 }
 
+void OMPIF_Send(const void *data, unsigned int size, int destination, const ap_uint<8> numDeps, const unsigned long long int deps[], hls::stream<mcxx_outaxis>& mcxx_outPort) {
+#pragma HLS inline
+	ap_uint<64> command;
+	command(7,0) = 0; //SEND
+	command(15,8) = 0;
+	command(23,16) = destination;
+	command(63, 24) = (unsigned long long int)data;
+	unsigned long long int args[2] = {command, (unsigned long long int)size};
+	mcxx_task_create(4294967299LU, 0xFF, 2, args, numDeps, deps, 0, 0, mcxx_outPort);
+}
+
 void OMPIF_Bcast(const void *data, unsigned int size, const ap_uint<8> numDeps, const unsigned long long int deps[], hls::stream<mcxx_outaxis>& mcxx_outPort) {
 #pragma HLS inline
 	ap_uint<64> command;
@@ -14,6 +14,8 @@
 #include <hls_stream.h>
 #include <ap_int.h>
 #include <ap_axi_sdata.h>
+#include "nbody_build_config.h"
+#include "../src/nbody_config.h"
 
 static ap_uint<64> __mcxx_taskId;
 template<class T>
@@ -30,23 +32,24 @@ typedef ap_axiu<64, 1, 1, 2> mcxx_outaxis;
 void mcxx_set_lock(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort);
 void mcxx_unset_lock(hls::stream<mcxx_outaxis>& mcxx_outPort);
 
-static const unsigned int FPGA_PWIDTH = 128;
-static const unsigned int PARTICLES_FPGABLOCK_POS_X_OFFSET = 0 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_POS_Y_OFFSET = 1 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_POS_Z_OFFSET = 2 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_VEL_X_OFFSET = 3 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_VEL_Y_OFFSET = 4 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_VEL_Z_OFFSET = 5 * 2048;
-static const unsigned int PARTICLES_FPGABLOCK_MASS_OFFSET = 6 * 2048;
-static const unsigned int FORCE_FPGABLOCK_X_OFFSET = 0 * 2048;
-static const unsigned int FORCE_FPGABLOCK_Y_OFFSET = 1 * 2048;
-static const unsigned int FORCE_FPGABLOCK_Z_OFFSET = 2 * 2048;
-static void update_particles_block_moved(float particles[16384L], float forces[6144L], const float time_interval)
+static const unsigned int FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
+static const int BLOCK_SIZE = NBODY_BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_MASS_OFFSET = 0 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_X_OFFSET = 1 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_Y_OFFSET = 2 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_Z_OFFSET = 3 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_X_OFFSET = 5 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_Y_OFFSET = 6 * BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_Z_OFFSET = 7 * BLOCK_SIZE;
+static const unsigned int FORCE_FPGABLOCK_X_OFFSET = 0 * BLOCK_SIZE;
+static const unsigned int FORCE_FPGABLOCK_Y_OFFSET = 1 * BLOCK_SIZE;
+static const unsigned int FORCE_FPGABLOCK_Z_OFFSET = 2 * BLOCK_SIZE;
+static void update_particles_block_moved(float particles[8 * BLOCK_SIZE], float forces[3 * BLOCK_SIZE], const float time_interval)
 {
 #pragma HLS inline
 #pragma HLS array_partition variable=forces cyclic factor=FPGA_PWIDTH/64
 #pragma HLS array_partition variable=particles cyclic factor=FPGA_PWIDTH/64
-  for (int e = 0; e < 2048; e++)
+  for (int e = 0; e < BLOCK_SIZE; e++)
     {
 #pragma HLS pipeline II=7
 #pragma HLS dependence variable=particles inter false
@@ -58,7 +61,8 @@ static void update_particles_block_moved(float particles[16384L], float forces[6
       const float position_x = particles[PARTICLES_FPGABLOCK_POS_X_OFFSET + e];
       const float position_y = particles[PARTICLES_FPGABLOCK_POS_Y_OFFSET + e];
       const float position_z = particles[PARTICLES_FPGABLOCK_POS_Z_OFFSET + e];
-      const float time_by_mass = time_interval / mass;
+      //The padding of a partial block has no mass and does not move
+      const float time_by_mass = mass == 0.0f ? 0.0f : time_interval / mass;
       const float half_time_interval = 5.000000000000000000000000e-01f * time_interval;
       const float velocity_change_x = forces[FORCE_FPGABLOCK_X_OFFSET + e] * time_by_mass;
       const float velocity_change_y = forces[FORCE_FPGABLOCK_Y_OFFSET + e] * time_by_mass;
@@ -86,13 +90,13 @@ void mcxx_write_out_port(const ap_uint<64> data, const ap_uint<2> dest, const ap
    axis_word.last = last;
    mcxx_outPort.write(axis_word);
 }
-void update_particles_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, ap_uint<128>* mcxx_memport) {
+void update_particles_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::stream<mcxx_outaxis>& mcxx_outPort, ap_uint<FPGA_PWIDTH>* mcxx_memport) {
 #pragma HLS interface ap_ctrl_none port=return
 #pragma HLS interface axis port=mcxx_inPort
 #pragma HLS interface axis port=mcxx_outPort
 #pragma HLS interface m_axi port=mcxx_memport
-   static float forces[6144L];
-   static float particles[16384L];
+   static float forces[3 * BLOCK_SIZE];
+   static float particles[8 * BLOCK_SIZE];
    mcxx_inPort.read(); //command word
    __mcxx_taskId = mcxx_inPort.read();
    ap_uint<64> __mcxx_parent_taskId = mcxx_inPort.read();
@@ -128,26 +132,26 @@ void update_particles_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::strea
    }
    //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
    if (mcxx_flags_1[4]) {
-      for (int __i = 0; __i < (((4L) * (6144L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+      for (int __i = 0; __i < (((4L) * (3L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
             __mcxx_cast<float> cast_tmp;
             cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            forces[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
+            forces[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
          }
       }
    }
    if (mcxx_flags_0[4]) {
-      for (int __i = 0; __i < (((4L) * (16384L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+      for (int __i = 0; __i < (((4L) * (8L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         __tmpBuffer = *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<128>) + __i);
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         __tmpBuffer = *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>) + __i);
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
             __mcxx_cast<float> cast_tmp;
             cast_tmp.raw = __tmpBuffer((__j+1)*4*8-1,__j*4*8);
-            particles[__i*(sizeof(ap_uint<128>)/4)+__j] = cast_tmp.typed;
+            particles[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j] = cast_tmp.typed;
          }
       }
    }
@@ -155,27 +159,27 @@ void update_particles_wrapper(hls::stream<ap_uint<64> >& mcxx_inPort, hls::strea
    update_particles_block_moved(particles, forces, time_interval);
    //mcxx_set_lock(mcxx_inPort, mcxx_outPort);
    if (mcxx_flags_1[5]) {
-      for (int __i = 0; __i < (((4L) * (6144L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+      for (int __i = 0; __i < (((4L) * (3L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
             __mcxx_cast<float> cast_tmp;
-            cast_tmp.typed = forces[__i*(sizeof(ap_uint<128>)/4)+__j];
+            cast_tmp.typed = forces[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
             __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
          }
-         *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<128>)+ __i) = __tmpBuffer;
+         *(mcxx_memport + mcxx_offset_1/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
       }
    }
    if (mcxx_flags_0[5]) {
-      for (int __i = 0; __i < (((4L) * (16384L)) - 1)/sizeof(ap_uint<128>)+1; ++__i) {
+      for (int __i = 0; __i < (((4L) * (8L * BLOCK_SIZE)) - 1)/sizeof(ap_uint<FPGA_PWIDTH>)+1; ++__i) {
       #pragma HLS pipeline II=1
-         ap_uint<128> __tmpBuffer;
-         for (int __j=0; __j <(sizeof(ap_uint<128>)/4); __j++) {
+         ap_uint<FPGA_PWIDTH> __tmpBuffer;
+         for (int __j=0; __j <(sizeof(ap_uint<FPGA_PWIDTH>)/4); __j++) {
             __mcxx_cast<float> cast_tmp;
-            cast_tmp.typed = particles[__i*(sizeof(ap_uint<128>)/4)+__j];
+            cast_tmp.typed = particles[__i*(sizeof(ap_uint<FPGA_PWIDTH>)/4)+__j];
             __tmpBuffer((__j+1)*4*8-1,__j*4*8) = cast_tmp.raw;
          }
-         *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<128>)+ __i) = __tmpBuffer;
+         *(mcxx_memport + mcxx_offset_0/sizeof(ap_uint<FPGA_PWIDTH>)+ __i) = __tmpBuffer;
       }
    }
    //mcxx_unset_lock(mcxx_outPort);
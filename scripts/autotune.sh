@@ -0,0 +1,115 @@
+#!/bin/bash
+#
+# This file is part of NBody and is licensed under the terms contained
+# in the LICENSE file.
+#
+# Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+#
+# Block size and unroll factor of the accelerators for a problem size.
+#
+# Usage: scripts/autotune.sh PARTICLES [DEVICES]
+#
+# Every pair of BLOCK_SIZES and NCALCFORCES_LIST that fits the resources of
+# one force accelerator is rated with a cost model of a timestep on the most
+# loaded device, so the padding of the last block counts as work:
+#   force tasks  blocks_per_device*blocks*(block_size^2/ncalcforces + copies)
+#                cycles, spread over the force accelerators
+#   updates      blocks_per_device copies of a particle and a force block
+#   exchange     the positions of the blocks of the other devices
+#   overhead     TASK_OVERHEAD_US per task
+# The copies move FPGA_MEMORY_PORT_WIDTH bits per cycle. The candidates are
+# written from best to worst, followed by the make command of the best one.
+#
+# The model is configured with environment variables:
+#   BLOCK_SIZES            candidate block sizes (default: 128 256 512 1024 2048 4096)
+#   NCALCFORCES_LIST       candidate NBODY_NCALCFORCES (default: 4 8 16 32 64)
+#   FPGA_CLOCK             accelerator frequency in MHz (default: 300)
+#   FPGA_MEMORY_PORT_WIDTH memory port bit-width (default: 128)
+#   NBODY_NUM_FBLOCK_ACCS  force accelerators per device (default: 1)
+#   DSPS_PER_FORCE         DSPs of one force of the main loop (default: 40)
+#   DSP_BUDGET             DSPs of one force accelerator (default: 3000)
+#   BRAM_BUDGET            BRAM18 of one force accelerator (default: 1300)
+#   TASK_OVERHEAD_US       task creation and completion time (default: 2)
+#   LINK_GBPS              bandwidth between devices in Gbit/s (default: 100)
+#   EMULATE                if 1, build nbody_emu with the best configuration
+#                          and check a simulation of its blocks (default: 0)
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 PARTICLES [DEVICES]" >&2
+	exit 1
+fi
+
+PARTICLES=$1
+DEVICES=${2:-1}
+BLOCK_SIZES=${BLOCK_SIZES:-128 256 512 1024 2048 4096}
+NCALCFORCES_LIST=${NCALCFORCES_LIST:-4 8 16 32 64}
+FPGA_CLOCK=${FPGA_CLOCK:-300}
+FPGA_MEMORY_PORT_WIDTH=${FPGA_MEMORY_PORT_WIDTH:-128}
+NBODY_NUM_FBLOCK_ACCS=${NBODY_NUM_FBLOCK_ACCS:-1}
+DSPS_PER_FORCE=${DSPS_PER_FORCE:-40}
+DSP_BUDGET=${DSP_BUDGET:-3000}
+BRAM_BUDGET=${BRAM_BUDGET:-1300}
+TASK_OVERHEAD_US=${TASK_OVERHEAD_US:-2}
+LINK_GBPS=${LINK_GBPS:-100}
+EMULATE=${EMULATE:-0}
+
+# block_size ncalcforces pairs that satisfy src/nbody_config.h
+candidates() {
+	for bs in $BLOCK_SIZES; do
+		if [ $((bs*16 % FPGA_MEMORY_PORT_WIDTH)) -ne 0 ]; then
+			continue
+		fi
+		for ncf in $NCALCFORCES_LIST; do
+			if [ $ncf -le $bs ]; then
+				echo $bs $ncf
+			fi
+		done
+	done
+}
+
+RESULTS=$(candidates | awk -v n=$PARTICLES -v devices=$DEVICES -v clock=$FPGA_CLOCK -v pwidth=$FPGA_MEMORY_PORT_WIDTH \
+	-v accs=$NBODY_NUM_FBLOCK_ACCS -v dsp_force=$DSPS_PER_FORCE -v dsp_budget=$DSP_BUDGET -v bram_budget=$BRAM_BUDGET \
+	-v overhead=$TASK_OVERHEAD_US -v link=$LINK_GBPS '
+	function ceil(x) { return x == int(x) ? x : int(x) + 1 }
+	# BRAM18 of an array of size floats split in factor banks of 512 floats
+	function bram(size, factor) { return factor*ceil(size/factor/512) }
+	{
+		bs = $1; ncf = $2
+		blocks = ceil(n/bs)
+		local = ceil(blocks/devices)
+		dsp = ncf*dsp_force
+		# Target cache of 4 blocks and the source block of hls/calc_forces.cpp,
+		# and the force block
+		brams = 16*bram(bs, ncf/2) + 4*bram(bs, pwidth/64) + 3*bram(bs, ncf)
+		if (dsp > dsp_budget || brams > bram_budget) next
+		floats_per_cycle = pwidth/32
+		# The target block is kept while its row of tasks runs
+		force_cycles = bs*bs/ncf + (4*bs + 6*bs + 4*bs/blocks)/floats_per_cycle
+		force = local*blocks*(force_cycles/(clock*1e6) + overhead*1e-6)/accs
+		update = local*(22*bs/floats_per_cycle/(clock*1e6) + overhead*1e-6)
+		exchange = devices > 1 ? (blocks - local)*3*bs*4*8/(link*1e9) : 0
+		time = force + update + exchange
+		printf "%d,%d,%d,%d,%d,%d,%e,%e\n", bs, ncf, blocks, local, dsp, brams, time, n*n/time
+	}' | sort -t, -k7,7g -k1,1nr)
+
+if [ -z "$RESULTS" ]; then
+	echo "No block size of BLOCK_SIZES fits the budgets" >&2
+	exit 1
+fi
+
+echo "block_size,ncalcforces,blocks,blocks_per_device,dsps,bram18,time_per_timestep,interactions_per_second"
+echo "$RESULTS"
+
+BEST_BS=$(echo "$RESULTS" | head -1 | cut -d, -f1)
+BEST_NCF=$(echo "$RESULTS" | head -1 | cut -d, -f2)
+BEST_BLOCKS=$(echo "$RESULTS" | head -1 | cut -d, -f3)
+echo "Best: make BS=$BEST_BS NBODY_NCALCFORCES=$BEST_NCF FPGA_MEMORY_PORT_WIDTH=$FPGA_MEMORY_PORT_WIDTH" >&2
+
+if [ "$EMULATE" = 1 ]; then
+	# The emulator runs the force loop sequentially, so it checks the
+	# configuration but its times do not rank it
+	make -B emu BS=$BEST_BS NBODY_NCALCFORCES=$BEST_NCF FPGA_MEMORY_PORT_WIDTH=$FPGA_MEMORY_PORT_WIDTH >&2
+	./nbody_emu -k nbody_solve -b $((BEST_BLOCKS < 4 ? BEST_BLOCKS : 4)) -t 1 >&2
+fi
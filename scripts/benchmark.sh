@@ -0,0 +1,169 @@
+#!/bin/bash
+#
+# This file is part of NBody and is licensed under the terms contained
+# in the LICENSE file.
+#
+# Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+#
+# Scaling benchmark of the N-body simulation.
+#
+# Usage: scripts/benchmark.sh [sweep|strong|weak|all]
+#
+# The experiments are configured with environment variables (lists are
+# separated by spaces):
+#   SOLVER            solver passed to --solver (default: fpga)
+#   TIMESTEPS         timesteps of every run (default: 10)
+#   REPETITIONS       runs of every configuration (default: 3)
+#   BLOCK_SIZES       host block sizes, every one is a separate build (default: 2048)
+#   NCALCFORCES_LIST  NBODY_NCALCFORCES of the bitstreams (default: 16)
+#   DEVICES           device counts (default: 1)
+#   PARTICLES         total particles of the sweep (default: 16384 32768 65536)
+#   STRONG_PARTICLES  total particles of the strong scaling (default: 65536)
+#   WEAK_PARTICLES    particles per device of the weak scaling (default: 16384)
+#   LAUNCHER          command that runs the binary on {devices} devices, e.g.
+#                     "mpirun -np {devices}" (default: run it directly)
+#   BITSTREAM_LOAD    command run before the runs of each {ncalcforces}, e.g.
+#                     to program the matching bitstream (default: none)
+#   TAG               label of the records, e.g. the bitstream revision
+#   RESULTS_DIR       output directory (default: bench_results)
+#
+# Every run appends a record to RESULTS_DIR/<experiment>.csv.
+# The strong and weak experiments also write <experiment>_scaling.csv with
+# the best time of every configuration, the speedup and the efficiency with
+# respect to the smallest device count.
+
+set -e
+
+EXPERIMENT=${1:-all}
+SOLVER=${SOLVER:-fpga}
+TIMESTEPS=${TIMESTEPS:-10}
+REPETITIONS=${REPETITIONS:-3}
+BLOCK_SIZES=${BLOCK_SIZES:-2048}
+NCALCFORCES_LIST=${NCALCFORCES_LIST:-16}
+DEVICES=${DEVICES:-1}
+PARTICLES=${PARTICLES:-16384 32768 65536}
+STRONG_PARTICLES=${STRONG_PARTICLES:-65536}
+WEAK_PARTICLES=${WEAK_PARTICLES:-16384}
+LAUNCHER=${LAUNCHER:-}
+BITSTREAM_LOAD=${BITSTREAM_LOAD:-}
+TAG=${TAG:-}
+RESULTS_DIR=${RESULTS_DIR:-bench_results}
+
+case $EXPERIMENT in
+	sweep|strong|weak|all) ;;
+	*)
+		echo "Usage: $0 [sweep|strong|weak|all]" >&2
+		exit 1
+		;;
+esac
+
+mkdir -p $RESULTS_DIR/bin
+
+binary() {
+	echo $RESULTS_DIR/bin/nbody.$1.$2.exe
+}
+
+build() {
+	local bs=$1 ncf=$2
+	make -B BS=$bs NBODY_NCALCFORCES=$ncf nbody_ompss.$bs.exe
+	mv nbody_ompss.$bs.exe $(binary $bs $ncf)
+}
+
+# run <experiment> <block size> <ncalcforces> <devices> <particles>
+run() {
+	local experiment=$1 bs=$2 ncf=$3 devices=$4 particles=$5
+	local launcher=${LAUNCHER//\{devices\}/$devices}
+	for r in $(seq $REPETITIONS); do
+		echo "$experiment: solver $SOLVER bs $bs ncalcforces $ncf devices $devices particles $particles run $r" >&2
+		$launcher $(binary $bs $ncf) -f -p $particles -t $TIMESTEPS -s $SOLVER -P \
+			--report=csv --report-file=$RESULTS_DIR/$experiment.csv --report-tag="$TAG" >/dev/null
+	done
+}
+
+# Report columns of the solver modes. Runs that differ in any of them are
+# different configurations, and are not merged in the scaling results.
+MODE_COLUMNS="symmetric fused stationary ring compress distribution"
+
+# scaling <experiment> <weak>: best time per configuration and its scaling
+# with respect to the smallest device count of the same configuration
+scaling() {
+	local experiment=$1 weak=$2
+	# Columns of the configuration, before block_size and ncalcforces
+	local n=$((2 + $(echo $MODE_COLUMNS | wc -w)))
+	awk -F, -v weak=$weak -v modes="$MODE_COLUMNS" '
+		NR == 1 {
+			for (i = 1; i <= NF; i++) col[$i] = i
+			nmodes = split(modes, mode, " ")
+			header = "tag,solver"
+			for (m = 1; m <= nmodes; m++) header = header "," mode[m]
+			print header ",block_size,ncalcforces,devices,particles,solve_time,time_per_timestep,interactions_per_second,speedup,efficiency"
+			next
+		}
+		{
+			config = $col["tag"] "," $col["solver"]
+			for (m = 1; m <= nmodes; m++) config = config "," $col[mode[m]]
+			config = config "," $col["block_size"] "," $col["ncalcforces"]
+			key = config
+			if (!weak) key = key "," $col["particles"]
+			run = key SUBSEP $col["devices"]
+			t = $col["solve_time"] + 0
+			if (!(run in best) || t < best[run]) {
+				best[run] = t
+				row[run] = $col["particles"] "," $col["solve_time"] "," $col["time_per_timestep"] "," $col["interactions_per_second"]
+			}
+			if (!(key in base_devices) || $col["devices"] + 0 < base_devices[key]) base_devices[key] = $col["devices"] + 0
+			devices[run] = $col["devices"] + 0
+			keys[run] = key
+			configs[run] = config
+		}
+		END {
+			for (run in best) {
+				key = keys[run]
+				base = best[key SUBSEP base_devices[key]]
+				if (weak) {
+					speedup = base/best[run]*devices[run]/base_devices[key]
+					efficiency = base/best[run]
+				} else {
+					speedup = base/best[run]
+					efficiency = speedup*base_devices[key]/devices[run]
+				}
+				printf "%s,%d,%s,%f,%f\n", configs[run], devices[run], row[run], speedup, efficiency
+			}
+		}' $RESULTS_DIR/$experiment.csv | (read -r header; echo "$header";
+			sort -t, -k1,$n -k$((n+1)),$((n+1))n -k$((n+2)),$((n+2))n -k$((n+4)),$((n+4))n -k$((n+3)),$((n+3))n) > $RESULTS_DIR/${experiment}_scaling.csv
+}
+
+for bs in $BLOCK_SIZES; do
+	for ncf in $NCALCFORCES_LIST; do
+		build $bs $ncf
+	done
+done
+
+for ncf in $NCALCFORCES_LIST; do
+	if [ -n "$BITSTREAM_LOAD" ]; then
+		eval "${BITSTREAM_LOAD//\{ncalcforces\}/$ncf}"
+	fi
+	for bs in $BLOCK_SIZES; do
+		for devices in $DEVICES; do
+			if [ $EXPERIMENT = sweep -o $EXPERIMENT = all ]; then
+				for particles in $PARTICLES; do
+					run sweep $bs $ncf $devices $particles
+				done
+			fi
+			if [ $EXPERIMENT = strong -o $EXPERIMENT = all ]; then
+				run strong $bs $ncf $devices $STRONG_PARTICLES
+			fi
+			if [ $EXPERIMENT = weak -o $EXPERIMENT = all ]; then
+				run weak $bs $ncf $devices $((WEAK_PARTICLES*devices))
+			fi
+		done
+	done
+done
+
+for experiment in strong weak; do
+	if [ -f $RESULTS_DIR/$experiment.csv ] && [ $EXPERIMENT = $experiment -o $EXPERIMENT = all ]; then
+		scaling $experiment $([ $experiment = weak ] && echo 1 || echo 0)
+	fi
+done
+
+echo "Results in $RESULTS_DIR" >&2
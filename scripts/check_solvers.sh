@@ -0,0 +1,46 @@
+#!/bin/bash
+#
+# This file is part of NBody and is licensed under the terms contained
+# in the LICENSE file.
+#
+# Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+#
+# Validation of the solver modes against the same fp64 reference.
+#
+# Usage: scripts/check_solvers.sh [BINARY]
+#
+# Every mode runs the same particles with -c and a time interval other than
+# 1, so an update that drops the time interval from v*dt fails the check.
+# The fpga modes run the host mirrors of the accelerators on a host build.
+# The checks are configured with environment variables:
+#   PARTICLES      particles of every run (default: 4096)
+#   TIMESTEPS      timesteps of every run (default: 4)
+#   TIME_INTERVAL  seconds per timestep, not 1 (default: 1000)
+#   MODES          solver options of each run, separated by commas
+#                  (default: every fpga and smp mode, and bh with an
+#                  opening angle small enough for the tolerance; the
+#                  particles spread out over the timesteps, which also
+#                  checks the range of its quadrupole forces)
+
+set -e
+
+BINARY=${1:-./nbody_ompss.2048.exe}
+PARTICLES=${PARTICLES:-4096}
+TIMESTEPS=${TIMESTEPS:-4}
+TIME_INTERVAL=${TIME_INTERVAL:-1000}
+MODES=${MODES:--s fpga,-s fpga -S,-s fpga -F,-s fpga --output-stationary,-s smp,-s smp -S,-s bh --theta=0.25}
+
+FAILED=0
+IFS=, read -ra MODE_LIST <<< "$MODES"
+for mode in "${MODE_LIST[@]}"; do
+	OUTPUT=$($BINARY -p $PARTICLES -t $TIMESTEPS --time-interval=$TIME_INTERVAL -c $mode 2>&1)
+	if echo "$OUTPUT" | grep -q "Result validation: OK"; then
+		echo "OK     $mode"
+	else
+		echo "ERROR  $mode"
+		echo "$OUTPUT" | grep -E "relative error|ulp error" >&2 || true
+		FAILED=1
+	fi
+done
+
+exit $FAILED
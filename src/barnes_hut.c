@@ -0,0 +1,484 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+#include "nbody.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Maximum number of particles in a leaf
+#define BH_LEAF_SIZE 16
+// Maximum depth of the octree, deeper nodes become leaves
+#define BH_MAX_DEPTH 32
+// Subtrees with more particles than this are built by a separate task
+#define BH_TASK_THRESHOLD 4096
+// Maximum number of target particles of a traversal task
+#define BH_GROUP_SIZE MIN(BLOCK_SIZE, 256)
+
+typedef struct {
+	float center[3];  // Geometric center of the cube
+	float half;       // Half of the side of the cube
+	float com[3];     // Center of mass
+	float weight;     // Gravitational constant times the total mass
+	float quad[6];    // Traceless quadrupole xx, xy, xz, yy, yz, zz per unit of weight
+	int first;        // First particle of the node in tree order
+	int count;        // Number of particles of the node
+	int child[8];     // Child nodes, -1 if the octant is empty
+	int leaf;
+} bh_node_t;
+
+// Range of particles in tree order that share an interaction list
+typedef struct {
+	int first;
+	int count;
+} bh_group_t;
+
+typedef struct {
+	bh_node_t *nodes;
+	int num_nodes;    // Allocated nodes, updated atomically while building
+	int max_nodes;
+	int *index;       // Tree order to particle index permutation
+	int *tmp;         // Scratch space to partition the permutation
+	// Particles in tree order, so that the particles of a node are contiguous
+	float *x, *y, *z, *mass, *weight;
+	int num_particles;
+	bh_group_t *groups;  // Target groups of the traversal
+	int num_groups;
+} bh_tree_t;
+
+static inline const particles_block_t *bh_block(const particles_block_t *particles, int p)
+{
+	return particles + p/BLOCK_SIZE;
+}
+
+static int bh_alloc_nodes(bh_tree_t *tree, int n)
+{
+	const int first = __atomic_fetch_add(&tree->num_nodes, n, __ATOMIC_RELAXED);
+	return (first + n <= tree->max_nodes) ? first : -1;
+}
+
+// Moments of a leaf computed directly from its particles
+static void bh_leaf_moments(bh_tree_t *tree, bh_node_t *node, const particles_block_t *particles)
+{
+	double w = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+	for (int k = node->first; k < node->first + node->count; k++) {
+		const int p = tree->index[k];
+		const particles_block_t *block = bh_block(particles, p);
+		const int e = p%BLOCK_SIZE;
+		w += block->weight[e];
+		cx += (double)block->weight[e] * block->position_x[e];
+		cy += (double)block->weight[e] * block->position_y[e];
+		cz += (double)block->weight[e] * block->position_z[e];
+	}
+	node->weight = w;
+	node->com[0] = w > 0.0 ? cx/w : node->center[0];
+	node->com[1] = w > 0.0 ? cy/w : node->center[1];
+	node->com[2] = w > 0.0 ? cz/w : node->center[2];
+
+	double q[6] = {0};
+	for (int k = node->first; k < node->first + node->count; k++) {
+		const int p = tree->index[k];
+		const particles_block_t *block = bh_block(particles, p);
+		const int e = p%BLOCK_SIZE;
+		const double dx = block->position_x[e] - node->com[0];
+		const double dy = block->position_y[e] - node->com[1];
+		const double dz = block->position_z[e] - node->com[2];
+		const double d2 = dx*dx + dy*dy + dz*dz;
+		const double pw = block->weight[e];
+		q[0] += pw*(3.0*dx*dx - d2);
+		q[1] += pw*(3.0*dx*dy);
+		q[2] += pw*(3.0*dx*dz);
+		q[3] += pw*(3.0*dy*dy - d2);
+		q[4] += pw*(3.0*dy*dz);
+		q[5] += pw*(3.0*dz*dz - d2);
+	}
+	// Normalized so that the weighted moments do not overflow in single precision
+	for (int m = 0; m < 6; m++) node->quad[m] = w > 0.0 ? q[m]/w : 0.0;
+}
+
+// Moments of an inner node from the moments of its children, shifting the
+// quadrupoles with the parallel axis theorem
+static void bh_inner_moments(bh_tree_t *tree, bh_node_t *node)
+{
+	double w = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+	for (int c = 0; c < 8; c++) {
+		if (node->child[c] < 0) continue;
+		const bh_node_t *child = tree->nodes + node->child[c];
+		w += child->weight;
+		cx += (double)child->weight * child->com[0];
+		cy += (double)child->weight * child->com[1];
+		cz += (double)child->weight * child->com[2];
+	}
+	node->weight = w;
+	node->com[0] = w > 0.0 ? cx/w : node->center[0];
+	node->com[1] = w > 0.0 ? cy/w : node->center[1];
+	node->com[2] = w > 0.0 ? cz/w : node->center[2];
+
+	double q[6] = {0};
+	for (int c = 0; c < 8; c++) {
+		if (node->child[c] < 0) continue;
+		const bh_node_t *child = tree->nodes + node->child[c];
+		const double sx = child->com[0] - node->com[0];
+		const double sy = child->com[1] - node->com[1];
+		const double sz = child->com[2] - node->com[2];
+		const double s2 = sx*sx + sy*sy + sz*sz;
+		const double cw = child->weight;
+		q[0] += cw*(child->quad[0] + 3.0*sx*sx - s2);
+		q[1] += cw*(child->quad[1] + 3.0*sx*sy);
+		q[2] += cw*(child->quad[2] + 3.0*sx*sz);
+		q[3] += cw*(child->quad[3] + 3.0*sy*sy - s2);
+		q[4] += cw*(child->quad[4] + 3.0*sy*sz);
+		q[5] += cw*(child->quad[5] + 3.0*sz*sz - s2);
+	}
+	for (int m = 0; m < 6; m++) node->quad[m] = w > 0.0 ? q[m]/w : 0.0;
+}
+
+static inline int bh_octant(const bh_node_t *node, const particles_block_t *particles, int p)
+{
+	const particles_block_t *block = bh_block(particles, p);
+	const int e = p%BLOCK_SIZE;
+	return (block->position_x[e] >= node->center[0]) |
+	       ((block->position_y[e] >= node->center[1]) << 1) |
+	       ((block->position_z[e] >= node->center[2]) << 2);
+}
+
+// Splits the particles of the node in its 8 octants and builds the
+// children. Children are disjoint ranges of the permutation, so large
+// subtrees are built in parallel.
+static void bh_build(bh_tree_t *tree, int n, const particles_block_t *particles, int depth)
+{
+	bh_node_t *node = tree->nodes + n;
+	for (int c = 0; c < 8; c++) node->child[c] = -1;
+
+	const int children = (node->count > BH_LEAF_SIZE && depth < BH_MAX_DEPTH) ? bh_alloc_nodes(tree, 8) : -1;
+	node->leaf = (children < 0);
+	if (node->leaf) {
+		bh_leaf_moments(tree, node, particles);
+		return;
+	}
+
+	int count[8] = {0};
+	for (int k = node->first; k < node->first + node->count; k++) {
+		count[bh_octant(node, particles, tree->index[k])]++;
+	}
+	int offset[8];
+	offset[0] = node->first;
+	for (int c = 1; c < 8; c++) offset[c] = offset[c-1] + count[c-1];
+	for (int k = node->first; k < node->first + node->count; k++) {
+		const int p = tree->index[k];
+		tree->tmp[offset[bh_octant(node, particles, p)]++] = p;
+	}
+	memcpy(tree->index + node->first, tree->tmp + node->first, node->count*sizeof(int));
+
+	int first = node->first;
+	for (int c = 0; c < 8; c++) {
+		if (count[c] == 0) {
+			continue;
+		}
+		bh_node_t *child = tree->nodes + children + c;
+		child->half = 0.5f*node->half;
+		child->center[0] = node->center[0] + ((c & 1) ? child->half : -child->half);
+		child->center[1] = node->center[1] + ((c & 2) ? child->half : -child->half);
+		child->center[2] = node->center[2] + ((c & 4) ? child->half : -child->half);
+		child->first = first;
+		child->count = count[c];
+		node->child[c] = children + c;
+		first += count[c];
+
+		if (count[c] > BH_TASK_THRESHOLD) {
+			#pragma oss task label("bh_build")
+			bh_build(tree, children + c, particles, depth + 1);
+		} else {
+			bh_build(tree, children + c, particles, depth + 1);
+		}
+	}
+	#pragma oss taskwait
+
+	bh_inner_moments(tree, node);
+}
+
+static void bh_collect_groups(bh_tree_t *tree, int n)
+{
+	const bh_node_t *node = tree->nodes + n;
+	if (node->count <= BH_GROUP_SIZE || node->leaf) {
+		// Leaves at the maximum depth may hold more than a group
+		for (int first = 0; first < node->count; first += BH_GROUP_SIZE) {
+			tree->groups[tree->num_groups].first = node->first + first;
+			tree->groups[tree->num_groups].count = MIN(BH_GROUP_SIZE, node->count - first);
+			tree->num_groups++;
+		}
+		return;
+	}
+	for (int c = 0; c < 8; c++) {
+		if (node->child[c] >= 0) bh_collect_groups(tree, node->child[c]);
+	}
+}
+
+static void bh_tree_build(bh_tree_t *tree, const particles_block_t *particles, const int num_blocks)
+{
+	// Only the particles before the padding of the last block are in the tree
+	float bmin[num_blocks][3], bmax[num_blocks][3];
+	for (int b = 0; b < num_blocks; b++) {
+		const int count = nbody_block_particles(tree->num_particles, b);
+		#pragma oss task label("bh_bounding_box") in(particles[b]) out(bmin[b], bmax[b])
+		{
+			float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+			for (int e = 0; e < count; e++) {
+				lo[0] = MIN(lo[0], particles[b].position_x[e]); hi[0] = MAX(hi[0], particles[b].position_x[e]);
+				lo[1] = MIN(lo[1], particles[b].position_y[e]); hi[1] = MAX(hi[1], particles[b].position_y[e]);
+				lo[2] = MIN(lo[2], particles[b].position_z[e]); hi[2] = MAX(hi[2], particles[b].position_z[e]);
+			}
+			memcpy(bmin[b], lo, sizeof(lo));
+			memcpy(bmax[b], hi, sizeof(hi));
+		}
+		#pragma oss task label("bh_index") out(tree->index[b*BLOCK_SIZE;count])
+		for (int e = 0; e < count; e++) {
+			tree->index[b*BLOCK_SIZE + e] = b*BLOCK_SIZE + e;
+		}
+	}
+	#pragma oss taskwait
+
+	float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+	for (int b = 0; b < num_blocks; b++) {
+		for (int d = 0; d < 3; d++) {
+			lo[d] = MIN(lo[d], bmin[b][d]);
+			hi[d] = MAX(hi[d], bmax[b][d]);
+		}
+	}
+
+	bh_node_t *root = tree->nodes;
+	tree->num_nodes = 1;
+	root->half = 0.0f;
+	for (int d = 0; d < 3; d++) {
+		root->center[d] = 0.5f*(lo[d] + hi[d]);
+		root->half = MAX(root->half, 0.5f*(hi[d] - lo[d]));
+	}
+	// Slightly enlarged so that the particles on the upper faces are inside
+	root->half *= 1.0001f;
+	root->first = 0;
+	root->count = tree->num_particles;
+
+	bh_build(tree, 0, particles, 0);
+
+	// Particles in tree order for the traversal
+	for (int b = 0; b < num_blocks; b++) {
+		const int count = nbody_block_particles(tree->num_particles, b);
+		#pragma oss task label("bh_reorder") out(tree->x[b*BLOCK_SIZE;count])
+		for (int k = b*BLOCK_SIZE; k < b*BLOCK_SIZE + count; k++) {
+			const int p = tree->index[k];
+			const particles_block_t *block = bh_block(particles, p);
+			const int e = p%BLOCK_SIZE;
+			tree->x[k] = block->position_x[e];
+			tree->y[k] = block->position_y[e];
+			tree->z[k] = block->position_z[e];
+			tree->mass[k] = block->mass[e];
+			tree->weight[k] = block->weight[e];
+		}
+	}
+
+	tree->num_groups = 0;
+	bh_collect_groups(tree, 0);
+	#pragma oss taskwait
+}
+
+// Interaction list of a target group: accepted nodes are pseudo-particles
+// at their center of mass, opened leaves contribute their particles
+typedef struct {
+	float *x, *y, *z, *w;
+	int size, capacity;
+	int *nodes;
+	int num_nodes, nodes_capacity;
+} bh_list_t;
+
+static void bh_list_reserve(bh_list_t *list, int n)
+{
+	if (list->size + n <= list->capacity) return;
+	int capacity = MAX(2*list->capacity, list->size + n);
+	list->x = realloc(list->x, capacity*sizeof(float));
+	list->y = realloc(list->y, capacity*sizeof(float));
+	list->z = realloc(list->z, capacity*sizeof(float));
+	list->w = realloc(list->w, capacity*sizeof(float));
+	assert(list->x && list->y && list->z && list->w);
+	list->capacity = capacity;
+}
+
+static void bh_list_add_node(bh_list_t *list, const bh_tree_t *tree, int n)
+{
+	const bh_node_t *node = tree->nodes + n;
+	bh_list_reserve(list, 1);
+	list->x[list->size] = node->com[0];
+	list->y[list->size] = node->com[1];
+	list->z[list->size] = node->com[2];
+	list->w[list->size] = node->weight;
+	list->size++;
+
+	if (list->num_nodes == list->nodes_capacity) {
+		list->nodes_capacity = MAX(64, 2*list->nodes_capacity);
+		list->nodes = realloc(list->nodes, list->nodes_capacity*sizeof(int));
+		assert(list->nodes);
+	}
+	list->nodes[list->num_nodes++] = n;
+}
+
+static void bh_list_add_leaf(bh_list_t *list, const bh_tree_t *tree, int n)
+{
+	const bh_node_t *node = tree->nodes + n;
+	bh_list_reserve(list, node->count);
+	memcpy(list->x + list->size, tree->x + node->first, node->count*sizeof(float));
+	memcpy(list->y + list->size, tree->y + node->first, node->count*sizeof(float));
+	memcpy(list->z + list->size, tree->z + node->first, node->count*sizeof(float));
+	memcpy(list->w + list->size, tree->weight + node->first, node->count*sizeof(float));
+	list->size += node->count;
+}
+
+// Distance from a point to the bounding box of the group
+static inline float bh_box_distance(const float *p, const float *lo, const float *hi)
+{
+	float d2 = 0.0f;
+	for (int d = 0; d < 3; d++) {
+		const float v = p[d] < lo[d] ? lo[d] - p[d] : (p[d] > hi[d] ? p[d] - hi[d] : 0.0f);
+		d2 += v*v;
+	}
+	return sqrtf(d2);
+}
+
+static void bh_interaction_list(const bh_tree_t *tree, const float *lo, const float *hi, const float theta, bh_list_t *list)
+{
+	int stack[8*BH_MAX_DEPTH + 8];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const int n = stack[--top];
+		const bh_node_t *node = tree->nodes + n;
+		const float d = bh_box_distance(node->com, lo, hi);
+		if (2.0f*node->half < theta*d) {
+			bh_list_add_node(list, tree, n);
+		} else if (node->leaf) {
+			bh_list_add_leaf(list, tree, n);
+		} else {
+			for (int c = 0; c < 8; c++) {
+				if (node->child[c] >= 0) stack[top++] = node->child[c];
+			}
+		}
+	}
+}
+
+// Quadrupole correction of the accepted nodes: G*(Q r/r^5 - 5/2 (r.Q.r) r/r^7)
+// with r going from the center of mass to the target
+static void bh_quadrupole_forces(const bh_tree_t *tree, const bh_list_t *list,
+	float *fx, float *fy, float *fz,
+	const float *x, const float *y, const float *z, const float *m, const int n)
+{
+	for (int k = 0; k < list->num_nodes; k++) {
+		const bh_node_t *node = tree->nodes + list->nodes[k];
+		const float *q = node->quad;
+		for (int j = 0; j < n; j++) {
+			const float rx = x[j] - node->com[0];
+			const float ry = y[j] - node->com[1];
+			const float rz = z[j] - node->com[2];
+			const float r2 = rx*rx + ry*ry + rz*rz;
+			const float inv_r = 1.0f / sqrtf(r2);
+			const float inv_r2 = inv_r*inv_r;
+			// Same evaluation order as the monopole to stay within the float range
+			const float s = node->weight*inv_r2*inv_r;
+			// Q·r and r·Q·r of the unit vector, since r·Q·r overflows with
+			// the distances of spread out particles
+			const float ux = rx*inv_r, uy = ry*inv_r, uz = rz*inv_r;
+			const float qx = q[0]*ux + q[1]*uy + q[2]*uz;
+			const float qy = q[1]*ux + q[3]*uy + q[4]*uz;
+			const float qz = q[2]*ux + q[4]*uy + q[5]*uz;
+			const float radial = 2.5f*(ux*qx + uy*qy + uz*qz);
+			fx[j] += m[j]*(s*((qx - radial*ux)*inv_r));
+			fy[j] += m[j]*(s*((qy - radial*uy)*inv_r));
+			fz[j] += m[j]*(s*((qz - radial*uz)*inv_r));
+		}
+	}
+}
+
+static void bh_calculate_forces(const bh_tree_t *tree, forces_block_t *forces, const float theta)
+{
+	for (int g = 0; g < tree->num_groups; g++) {
+		#pragma oss task label("bh_traversal") firstprivate(g)
+		{
+			const bh_group_t *group = tree->groups + g;
+			const int n = group->count;
+			const float *x = tree->x + group->first;
+			const float *y = tree->y + group->first;
+			const float *z = tree->z + group->first;
+			const float *m = tree->mass + group->first;
+
+			float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+			for (int j = 0; j < n; j++) {
+				lo[0] = MIN(lo[0], x[j]); hi[0] = MAX(hi[0], x[j]);
+				lo[1] = MIN(lo[1], y[j]); hi[1] = MAX(hi[1], y[j]);
+				lo[2] = MIN(lo[2], z[j]); hi[2] = MAX(hi[2], z[j]);
+			}
+
+			bh_list_t list = {0};
+			bh_interaction_list(tree, lo, hi, theta, &list);
+
+			float fx[BH_GROUP_SIZE] = {0}, fy[BH_GROUP_SIZE] = {0}, fz[BH_GROUP_SIZE] = {0};
+			calculate_forces_kernel_smp(fx, fy, fz, x, y, z, m, n, list.x, list.y, list.z, list.w, list.size);
+			bh_quadrupole_forces(tree, &list, fx, fy, fz, x, y, z, m, n);
+
+			// Groups are disjoint, so no other task writes these forces
+			for (int j = 0; j < n; j++) {
+				const int p = tree->index[group->first + j];
+				forces_block_t *force = forces + p/BLOCK_SIZE;
+				force->x[p%BLOCK_SIZE] += fx[j];
+				force->y[p%BLOCK_SIZE] += fy[j];
+				force->z[p%BLOCK_SIZE] += fz[j];
+			}
+
+			free(list.x); free(list.y); free(list.z); free(list.w);
+			free(list.nodes);
+		}
+	}
+	#pragma oss taskwait
+}
+
+void nbody_solve_bh(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles, const int timesteps, const float time_interval, const float theta)
+{
+	nbody_smp_init();
+
+	bh_tree_t tree;
+	tree.num_particles = num_particles;
+	// Inner nodes allocate their 8 children at once
+	tree.max_nodes = 8*(tree.num_particles/BH_LEAF_SIZE + 1)*2 + 1;
+	tree.nodes = malloc(tree.max_nodes*sizeof(bh_node_t));
+	tree.index = malloc(tree.num_particles*sizeof(int));
+	tree.tmp = malloc(tree.num_particles*sizeof(int));
+	tree.x = malloc(tree.num_particles*sizeof(float));
+	tree.y = malloc(tree.num_particles*sizeof(float));
+	tree.z = malloc(tree.num_particles*sizeof(float));
+	tree.mass = malloc(tree.num_particles*sizeof(float));
+	tree.weight = malloc(tree.num_particles*sizeof(float));
+	tree.groups = malloc(tree.num_particles*sizeof(bh_group_t));
+	assert(tree.nodes && tree.index && tree.tmp && tree.groups);
+	assert(tree.x && tree.y && tree.z && tree.mass && tree.weight);
+
+	for (int t = 0; t < timesteps; t++) {
+		bh_tree_build(&tree, particles, num_blocks);
+		bh_calculate_forces(&tree, forces, theta);
+		update_particles_smp(particles, forces, num_blocks, num_particles, time_interval);
+		#pragma oss taskwait
+	}
+
+	free(tree.nodes);
+	free(tree.index);
+	free(tree.tmp);
+	free(tree.x);
+	free(tree.y);
+	free(tree.z);
+	free(tree.mass);
+	free(tree.weight);
+	free(tree.groups);
+}
@@ -0,0 +1,203 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+#include "nbody.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC "NBODYCK1"
+
+// First page of a checkpoint file, followed by the particle blocks
+typedef struct {
+	char magic[8];
+	char layout[8];
+	int block_size;
+	int num_particles;
+	int num_blocks;
+	int step;             // timesteps simulated when the snapshot was taken
+	float time_interval;
+} nbody_checkpoint_header_t;
+
+// The solver thread copies the particles to the snapshot and a writer thread
+// puts it on disk while the next timesteps run. The solver only waits for the
+// writer when a write takes longer than the interval between checkpoints
+struct nbody_checkpoint_t {
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	particles_block_t *snapshot;
+	size_t size;
+	nbody_checkpoint_header_t header;
+	int pending;
+	int finish;
+	int written;
+	double write_time;
+	char name[1024];
+};
+
+// Written to a temporary file and renamed, so a failure in the middle of a
+// write keeps the previous checkpoint
+static int nbody_checkpoint_write(const nbody_checkpoint_t *ckpt, const nbody_checkpoint_header_t *header)
+{
+	char tmp[1100];
+	sprintf(tmp, "%s.tmp", ckpt->name);
+
+	const int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) return 0;
+
+	char page[PAGE_SIZE] = {0};
+	memcpy(page, header, sizeof(*header));
+
+	int ok = nbody_write_all(fd, page, PAGE_SIZE);
+	ok = ok && nbody_write_all(fd, ckpt->snapshot, ckpt->size);
+	ok = ok && !fsync(fd);
+	ok = !close(fd) && ok;
+	return ok && !rename(tmp, ckpt->name);
+}
+
+static void * nbody_checkpoint_writer(void *arg)
+{
+	nbody_checkpoint_t *ckpt = arg;
+
+	pthread_mutex_lock(&ckpt->lock);
+	while (1) {
+		while (!ckpt->pending && !ckpt->finish) {
+			pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+		}
+		if (!ckpt->pending) break;
+
+		const nbody_checkpoint_header_t header = ckpt->header;
+		pthread_mutex_unlock(&ckpt->lock);
+
+		const double start = get_time();
+		const int ok = nbody_checkpoint_write(ckpt, &header);
+		const double end = get_time();
+
+		pthread_mutex_lock(&ckpt->lock);
+		if (ok) {
+			ckpt->written++;
+		} else {
+			fprintf(stderr, "Warning: cannot write the checkpoint %s of step %d\n", ckpt->name, header.step);
+		}
+		ckpt->write_time += end - start;
+		ckpt->pending = 0;
+		pthread_cond_broadcast(&ckpt->cond);
+	}
+	pthread_mutex_unlock(&ckpt->lock);
+	return NULL;
+}
+
+nbody_checkpoint_t * nbody_checkpoint_create(const nbody_t *nbody, const nbody_conf_t *conf)
+{
+	nbody_checkpoint_t *ckpt = malloc(sizeof(nbody_checkpoint_t));
+	assert(ckpt != NULL);
+
+	memset(ckpt, 0, sizeof(nbody_checkpoint_t));
+	struct stat st = {0};
+	if (stat("data", &st) == -1) {
+		mkdir("data", 0755);
+	}
+	sprintf(ckpt->name, "%s.ckpt", nbody->file.name);
+	ckpt->size = nbody->num_blocks * sizeof(particles_block_t);
+	ckpt->snapshot = nbody_alloc(ckpt->size);
+
+	memcpy(ckpt->header.magic, CHECKPOINT_MAGIC, sizeof(ckpt->header.magic));
+	strncpy(ckpt->header.layout, PARTICLES_LAYOUT_NAME, sizeof(ckpt->header.layout));
+	ckpt->header.block_size = BLOCK_SIZE;
+	ckpt->header.num_particles = nbody->num_particles;
+	ckpt->header.num_blocks = nbody->num_blocks;
+	ckpt->header.time_interval = conf->time_interval;
+
+	int err = pthread_mutex_init(&ckpt->lock, NULL);
+	err |= pthread_cond_init(&ckpt->cond, NULL);
+	err |= pthread_create(&ckpt->writer, NULL, nbody_checkpoint_writer, ckpt);
+	assert(!err);
+
+	return ckpt;
+}
+
+void nbody_checkpoint_save(nbody_checkpoint_t *ckpt, const particles_block_t *particles, int step)
+{
+	pthread_mutex_lock(&ckpt->lock);
+	while (ckpt->pending) {
+		pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+	}
+	memcpy(ckpt->snapshot, particles, ckpt->size);
+	ckpt->header.step = step;
+	ckpt->pending = 1;
+	pthread_cond_signal(&ckpt->cond);
+	pthread_mutex_unlock(&ckpt->lock);
+}
+
+void nbody_checkpoint_finish(nbody_checkpoint_t *ckpt)
+{
+	pthread_mutex_lock(&ckpt->lock);
+	ckpt->finish = 1;
+	pthread_cond_signal(&ckpt->cond);
+	pthread_mutex_unlock(&ckpt->lock);
+
+	int err = pthread_join(ckpt->writer, NULL);
+	assert(!err);
+
+	fprintf(stderr, "Checkpoints %d written to %s in %fs\n", ckpt->written, ckpt->name, ckpt->write_time);
+
+	nbody_dealloc(ckpt->snapshot, ckpt->size);
+	err = pthread_cond_destroy(&ckpt->cond);
+	err |= pthread_mutex_destroy(&ckpt->lock);
+	assert(!err);
+	free(ckpt);
+}
+
+int nbody_checkpoint_load(const nbody_conf_t *conf, particles_block_t *particles)
+{
+	const char *fname = conf->restart_file;
+	const int fd = open(fname, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open checkpoint %s\n", fname);
+		exit(1);
+	}
+
+	const size_t size = conf->num_blocks * sizeof(particles_block_t);
+	struct stat st;
+	int err = fstat(fd, &st);
+	assert(!err);
+
+	nbody_checkpoint_header_t header;
+	if ((size_t)st.st_size != PAGE_SIZE + size || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+			|| memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic))
+			|| strncmp(header.layout, PARTICLES_LAYOUT_NAME, sizeof(header.layout))) {
+		fprintf(stderr, "%s is not a checkpoint of %d particles in blocks of %d\n", fname, conf->num_particles, BLOCK_SIZE);
+		exit(1);
+	}
+	if (header.block_size != BLOCK_SIZE || header.num_particles != conf->num_particles || header.num_blocks != conf->num_blocks) {
+		fprintf(stderr, "Checkpoint %s has %d particles in blocks of %d, not %d in blocks of %d\n", fname,
+				header.num_particles, header.block_size, conf->num_particles, BLOCK_SIZE);
+		exit(1);
+	}
+	if (header.step >= conf->timesteps) {
+		fprintf(stderr, "Checkpoint %s is at step %d, past the %d timesteps\n", fname, header.step, conf->timesteps);
+		exit(1);
+	}
+	if (header.time_interval != conf->time_interval) {
+		fprintf(stderr, "Warning: checkpoint %s was taken with a time interval of %e\n", fname, header.time_interval);
+	}
+
+	nbody_read_blocks(fd, PAGE_SIZE, particles, conf->num_blocks);
+
+	err = close(fd);
+	assert(!err);
+
+	fprintf(stderr, "Restarting from step %d of %s\n", header.step, fname);
+	return header.step;
+}
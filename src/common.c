@@ -6,23 +6,99 @@
 //
 
 #include "common.h"
+#include "nbody_config.h"
 
 #include <assert.h>
 #include <getopt.h>
 #include <ieee754.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
 
+// Long options without a short form
+enum {
+	OPT_THETA = 256,
+	OPT_FMM_ORDER,
+	OPT_OUTPUT_STATIONARY,
+	OPT_RING,
+	OPT_COMPRESS,
+	OPT_REPORT,
+	OPT_REPORT_FILE,
+	OPT_REPORT_TAG,
+	OPT_DISTRIBUTION,
+	OPT_WEIGHTS,
+	OPT_CHECKPOINT,
+	OPT_RESTART,
+	OPT_TRAJECTORY,
+	OPT_TRAJECTORY_FORMAT,
+	OPT_SEED,
+	OPT_CHECK_ULP,
+	OPT_OUT_OF_CORE,
+	OPT_TIME_INTERVAL,
+	OPT_BLOCK_TIMESTEPS,
+	OPT_TIMESTEP_ACCURACY
+};
+
+static size_t nbody_alloc_length(size_t size)
+{
+	return size >= HUGE_PAGE_SIZE ? ROUNDUP(size, (size_t)HUGE_PAGE_SIZE) : ROUNDUP(size, (size_t)PAGE_SIZE);
+}
+
+// Allocations of a huge page or more are aligned to huge pages and backed by
+// transparent huge pages, or by explicit ones with NBODY_HUGEPAGES=explicit
+// when some are reserved. NBODY_HUGEPAGES=none gives plain pages. Every
+// allocation is at least page-aligned, which covers the cache lines and the
+// memory ports of the accelerators. The pages are not touched here, so they
+// land on the NUMA node of the task that first writes each of them
 void * nbody_alloc(size_t size)
 {
-	void *addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	const size_t length = nbody_alloc_length(size);
+	const char *mode = getenv("NBODY_HUGEPAGES");
+
+	if (length < HUGE_PAGE_SIZE || (mode && !strcmp(mode, "none"))) {
+		void *addr = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		assert(addr != MAP_FAILED);
+		return addr;
+	}
+
+	if (mode && !strcmp(mode, "explicit")) {
+		void *addr = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (addr != MAP_FAILED) return addr;
+		fprintf(stderr, "Warning: no explicit huge pages for %zu bytes, using transparent ones\n", length);
+	}
+
+	// Aligned by hand, since mmap only aligns to pages
+	char *raw = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	assert(raw != MAP_FAILED);
+	char *addr = (char *)ROUNDUP((uintptr_t)raw, (uintptr_t)HUGE_PAGE_SIZE);
+	int err = 0;
+	if (addr > raw) err |= munmap(raw, addr - raw);
+	if (raw + HUGE_PAGE_SIZE > addr) err |= munmap(addr + length, raw + HUGE_PAGE_SIZE - addr);
+	assert(!err);
+
+	madvise(addr, length, MADV_HUGEPAGE);
+	return addr;
+}
+
+// Plain pages, so the ones given back with MADV_DONTNEED are freed whole.
+// Released with nbody_dealloc
+void * nbody_reserve(size_t size)
+{
+	void *addr = mmap(NULL, nbody_alloc_length(size), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
 	assert(addr != MAP_FAILED);
 	return addr;
 }
 
+void nbody_dealloc(void *addr, size_t size)
+{
+	int err = munmap(addr, nbody_alloc_length(size));
+	assert(!err);
+}
+
 void nbody_print_usage(int argc, char **argv)
 {
 	fprintf(stderr, "Usage: %s <-p particles> <-t timesteps> [OPTION]...\n", argv[0]);
@@ -32,13 +108,63 @@ void nbody_print_usage(int argc, char **argv)
 	fprintf(stderr, "Optional parameters:\n");
 	fprintf(stderr, "  -f, --force-generation\t\t\t\talways force the generation of particles without the usage of files(disabled by default)\n");
 	fprintf(stderr, "  -c, --check\t\t\t\tcheck the correctness of the result (disabled by default)\n");
+	fprintf(stderr, "      --check-ulp=ULPS\t\tpass the check when no position is more than ULPS units in the last place away (default: relative error)\n");
 	fprintf(stderr, "  -C, --no-check\t\t\tdo not check the correctness of the result\n");
 	fprintf(stderr, "  -o, --output\t\t\t\tsave the computed particles to the default output file (disabled by default)\n");
 	fprintf(stderr, "  -O, --no-output\t\t\tdo not save the computed particles to the default output file\n");
+	fprintf(stderr, "  -s, --solver=SOLVER\t\t\tuse SOLVER to compute the simulation: fpga, smp, bh or fmm (default: fpga)\n");
+	fprintf(stderr, "  -S, --symmetric\t\t\tcompute each pair of blocks once and apply Newton's third law (disabled by default)\n");
+	fprintf(stderr, "  -F, --fused\t\t\t\tupdate the particles in the last force task of each block (disabled by default)\n");
+	fprintf(stderr, "      --output-stationary\t\tkeep each force block on chip while all the source blocks stream through (disabled by default)\n");
+	fprintf(stderr, "      --ring				forward the updated positions along a ring of devices instead of broadcasting them (disabled by default)\n");
+	fprintf(stderr, "      --compress\t\t\texchange the positions as 16-bit offsets within each block, half the volume (disabled by default)\n");
+	fprintf(stderr, "      --distribution=MAPPING\t\tassign the blocks to the devices in turn (cyclic) or in ranges (contiguous) (default: cyclic)\n");
+	fprintf(stderr, "      --weights=W0,W1,...\t\tshare of the blocks of each device, 1 for the devices not given (default: all 1)\n");
+	fprintf(stderr, "      --seed=SEED\t\t\tgenerate the particles with SEED, which is part of the file names (default: %d)\n", default_seed);
+	fprintf(stderr, "      --checkpoint=STEPS\t\tsave the particles every STEPS timesteps to the .ckpt file, in the background (disabled by default)\n");
+	fprintf(stderr, "      --restart=FILE\t\t\tcontinue the simulation from the checkpoint FILE up to the given timesteps\n");
+	fprintf(stderr, "      --trajectory=STEPS\t\tappend a frame every STEPS timesteps to the .traj file, in the background (disabled by default)\n");
+	fprintf(stderr, "      --trajectory-format=FORMAT\tframes of full blocks, positions or packed 16-bit positions (default: full)\n");
+	fprintf(stderr, "      --out-of-core=MB\t\tstream the .in file to the devices in chunks of MB megabytes, never holding all the particles on the host (disabled by default)\n");
+	fprintf(stderr, "      --time-interval=SECONDS\t\tadvance the simulation SECONDS per timestep (default: %g)\n", default_time_interval);
+	fprintf(stderr, "      --block-timesteps=LEVELS\t\tsplit each timestep in up to 2^(LEVELS-1) substeps per block, smp solver only (default: 1)\n");
+	fprintf(stderr, "      --timestep-accuracy=ETA\t\tfraction of the mean particle spacing that a*dt^2/2 may reach in a block timestep (default: %g)\n", default_timestep_accuracy);
+	fprintf(stderr, "      --theta=THETA\t\t\topening angle of the Barnes-Hut solver (default: 0.5)\n");
+	fprintf(stderr, "      --fmm-order=ORDER\t\texpansion order of the FMM solver, from 1 to %d (default: 4)\n", FMM_MAX_ORDER);
+	fprintf(stderr, "      --report=FORMAT\t\t\tappend a json or csv record with the run parameters and timings (disabled by default)\n");
+	fprintf(stderr, "      --report-file=FILE\t\twrite the record to FILE instead of the standard output\n");
+	fprintf(stderr, "      --report-tag=TAG\t\tlabel the record with TAG, e.g. the bitstream revision\n");
 	fprintf(stderr, "  -P, --parse\t\t\t\tdisplay only the time in seconds\n");
 	fprintf(stderr, "  -h, --help\t\t\t\tdisplay this help and exit\n\n");
 }
 
+// Comma separated list of non-negative weights, at least one of them positive
+static int nbody_parse_weights(nbody_conf_t *conf, const char *list)
+{
+	int total = 0;
+	conf->num_weights = 0;
+	while (*list) {
+		char *end;
+		const long weight = strtol(list, &end, 10);
+		if (end == list || weight < 0 || weight > 1000000 || conf->num_weights == NBODY_MAX_RANKS) {
+			return 0;
+		}
+		conf->weights[conf->num_weights++] = weight;
+		total += weight;
+		if (*end == ',') end++;
+		else if (*end) return 0;
+		list = end;
+	}
+	return total > 0;
+}
+
+void nbody_device_weights(const nbody_conf_t *conf, int devices, int *weights)
+{
+	for (int i = 0; i < devices; ++i) {
+		weights[i] = i < conf->num_weights ? conf->weights[i] : 1;
+	}
+}
+
 nbody_conf_t nbody_get_conf(int *ok, int argc, char **argv)
 {
 	*ok = 1;
@@ -55,7 +181,28 @@ nbody_conf_t nbody_get_conf(int *ok, int argc, char **argv)
 	conf.timesteps        = default_timesteps;
 	conf.save_result      = default_save_result;
 	conf.check_result     = default_check_result;
+	conf.check_ulp        = default_check_ulp;
 	conf.force_generation = default_force_generation;
+	conf.solver           = default_solver;
+	conf.symmetric        = default_symmetric;
+	conf.fused            = default_fused;
+	conf.stationary       = default_stationary;
+	conf.ring             = default_ring;
+	conf.compress         = default_compress;
+	conf.theta            = default_theta;
+	conf.fmm_order        = default_fmm_order;
+	conf.report_format    = default_report_format;
+	conf.report_file      = NULL;
+	conf.report_tag       = "";
+	conf.distribution     = default_distribution;
+	conf.num_weights      = 0;
+	conf.checkpoint_interval = default_checkpoint;
+	conf.restart_file     = NULL;
+	conf.trajectory_interval = default_trajectory;
+	conf.trajectory_format = default_trajectory_format;
+	conf.out_of_core      = default_out_of_core;
+	conf.timestep_levels  = default_timestep_levels;
+	conf.timestep_accuracy = default_timestep_accuracy;
 	conf.parse            = 0;
 	
 	static struct option long_options[] = {
@@ -66,6 +213,29 @@ nbody_conf_t nbody_get_conf(int *ok, int argc, char **argv)
 		{"no-check",	no_argument,		0, 'C'},
 		{"output",		no_argument,		0, 'o'},
 		{"no-output",	no_argument,		0, 'O'},
+		{"solver",		required_argument,	0, 's'},
+		{"symmetric",	no_argument,		0, 'S'},
+		{"fused",		no_argument,		0, 'F'},
+		{"output-stationary",	no_argument,	0, OPT_OUTPUT_STATIONARY},
+		{"ring",		no_argument,		0, OPT_RING},
+		{"compress",	no_argument,		0, OPT_COMPRESS},
+		{"distribution",	required_argument,	0, OPT_DISTRIBUTION},
+		{"weights",		required_argument,	0, OPT_WEIGHTS},
+		{"seed",		required_argument,	0, OPT_SEED},
+		{"check-ulp",	required_argument,	0, OPT_CHECK_ULP},
+		{"checkpoint",	required_argument,	0, OPT_CHECKPOINT},
+		{"restart",		required_argument,	0, OPT_RESTART},
+		{"trajectory",	required_argument,	0, OPT_TRAJECTORY},
+		{"trajectory-format",	required_argument,	0, OPT_TRAJECTORY_FORMAT},
+		{"out-of-core",	required_argument,	0, OPT_OUT_OF_CORE},
+		{"time-interval",	required_argument,	0, OPT_TIME_INTERVAL},
+		{"block-timesteps",	required_argument,	0, OPT_BLOCK_TIMESTEPS},
+		{"timestep-accuracy",	required_argument,	0, OPT_TIMESTEP_ACCURACY},
+		{"theta",		required_argument,	0, OPT_THETA},
+		{"fmm-order",	required_argument,	0, OPT_FMM_ORDER},
+		{"report",		required_argument,	0, OPT_REPORT},
+		{"report-file",	required_argument,	0, OPT_REPORT_FILE},
+		{"report-tag",	required_argument,	0, OPT_REPORT_TAG},
 		{"parse", no_argument, 0, 'P'},
 		{"help",		no_argument,		0, 'h'},
 		{0, 0, 0, 0}
@@ -73,7 +243,7 @@ nbody_conf_t nbody_get_conf(int *ok, int argc, char **argv)
 	
 	int c;
 	int index;
-	while ((c = getopt_long(argc, argv, "hfoOcCPp:t:", long_options, &index)) != -1) {
+	while ((c = getopt_long(argc, argv, "hfoOcCPSFp:t:s:", long_options, &index)) != -1) {
 		switch (c) {
 			case 'h':
 				nbody_print_usage(argc, argv);
@@ -96,12 +266,154 @@ nbody_conf_t nbody_get_conf(int *ok, int argc, char **argv)
 			case 'P':
 				conf.parse = 1;
 				break;
+			case 'S':
+				conf.symmetric = 1;
+				break;
+			case 'F':
+				conf.fused = 1;
+				break;
 			case 'p':
 				conf.num_particles = atoi(optarg);
 				break;
 			case 't':
 				conf.timesteps = atoi(optarg);
 				break;
+			case 's':
+				if (!strcmp(optarg, "fpga")) {
+					conf.solver = NBODY_SOLVER_FPGA;
+				} else if (!strcmp(optarg, "smp")) {
+					conf.solver = NBODY_SOLVER_SMP;
+				} else if (!strcmp(optarg, "bh")) {
+					conf.solver = NBODY_SOLVER_BARNES_HUT;
+				} else if (!strcmp(optarg, "fmm")) {
+					conf.solver = NBODY_SOLVER_FMM;
+				} else {
+					fprintf(stderr, "Unknown solver %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_OUTPUT_STATIONARY:
+				conf.stationary = 1;
+				break;
+			case OPT_RING:
+				conf.ring = 1;
+				break;
+			case OPT_COMPRESS:
+				conf.compress = 1;
+				break;
+			case OPT_DISTRIBUTION:
+				if (!strcmp(optarg, "cyclic")) {
+					conf.distribution = NBODY_DIST_CYCLIC;
+				} else if (!strcmp(optarg, "contiguous")) {
+					conf.distribution = NBODY_DIST_CONTIGUOUS;
+				} else {
+					fprintf(stderr, "Unknown distribution %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_WEIGHTS:
+				if (!nbody_parse_weights(&conf, optarg)) {
+					fprintf(stderr, "Invalid weights %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_SEED:
+				conf.seed = atoi(optarg);
+				break;
+			case OPT_CHECK_ULP:
+				conf.check_ulp = atoi(optarg);
+				if (conf.check_ulp < 0) {
+					fprintf(stderr, "Invalid ULP tolerance %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_CHECKPOINT:
+				conf.checkpoint_interval = atoi(optarg);
+				if (conf.checkpoint_interval <= 0) {
+					fprintf(stderr, "Invalid checkpoint interval %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_RESTART:
+				conf.restart_file = optarg;
+				break;
+			case OPT_TRAJECTORY:
+				conf.trajectory_interval = atoi(optarg);
+				if (conf.trajectory_interval <= 0) {
+					fprintf(stderr, "Invalid trajectory interval %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_TRAJECTORY_FORMAT:
+				if (!strcmp(optarg, "full")) {
+					conf.trajectory_format = NBODY_TRAJECTORY_FULL;
+				} else if (!strcmp(optarg, "positions")) {
+					conf.trajectory_format = NBODY_TRAJECTORY_POSITIONS;
+				} else if (!strcmp(optarg, "packed")) {
+					conf.trajectory_format = NBODY_TRAJECTORY_PACKED;
+				} else {
+					fprintf(stderr, "Unknown trajectory format %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_OUT_OF_CORE:
+				conf.out_of_core = atoi(optarg);
+				if (conf.out_of_core <= 0) {
+					fprintf(stderr, "Invalid out-of-core chunk size %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_TIME_INTERVAL:
+				conf.time_interval = atof(optarg);
+				if (!(conf.time_interval > 0.0f)) {
+					fprintf(stderr, "Invalid time interval %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_BLOCK_TIMESTEPS:
+				conf.timestep_levels = atoi(optarg);
+				if (conf.timestep_levels < 1 || conf.timestep_levels > NBODY_MAX_TIMESTEP_LEVELS) {
+					fprintf(stderr, "Invalid number of timestep levels %s, from 1 to %d\n", optarg, NBODY_MAX_TIMESTEP_LEVELS);
+					*ok = 0;
+				}
+				break;
+			case OPT_TIMESTEP_ACCURACY:
+				conf.timestep_accuracy = atof(optarg);
+				if (!(conf.timestep_accuracy > 0.0f)) {
+					fprintf(stderr, "Invalid timestep accuracy %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_THETA:
+				conf.theta = atof(optarg);
+				if (conf.theta <= 0.0f) {
+					fprintf(stderr, "Invalid opening angle %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_FMM_ORDER:
+				conf.fmm_order = atoi(optarg);
+				if (conf.fmm_order < 1 || conf.fmm_order > FMM_MAX_ORDER) {
+					fprintf(stderr, "Invalid FMM order %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_REPORT:
+				if (!strcmp(optarg, "json")) {
+					conf.report_format = NBODY_REPORT_JSON;
+				} else if (!strcmp(optarg, "csv")) {
+					conf.report_format = NBODY_REPORT_CSV;
+				} else {
+					fprintf(stderr, "Unknown report format %s\n", optarg);
+					*ok = 0;
+				}
+				break;
+			case OPT_REPORT_FILE:
+				conf.report_file = optarg;
+				break;
+			case OPT_REPORT_TAG:
+				conf.report_tag = optarg;
+				break;
 			case '?':
 				*ok = 0;
 				break;
@@ -111,6 +423,31 @@ nbody_conf_t nbody_get_conf(int *ok, int argc, char **argv)
 		}
 	}
 	
+	if (conf.symmetric + conf.fused + conf.stationary > 1) {
+		fprintf(stderr, "Only one of the symmetric, fused and output stationary modes can be used\n");
+		*ok = 0;
+	}
+	
+	// Their accelerators do not use the force kernel of calc_forces
+	if (conf.solver == NBODY_SOLVER_FPGA && NBODY_PRECISION != NBODY_PRECISION_FLOAT
+			&& (conf.symmetric || conf.fused || conf.stationary)) {
+		fprintf(stderr, "The symmetric, fused and output stationary accelerators are fp32, and calc_forces is not\n");
+		*ok = 0;
+	}
+	
+	// The particles only exist on the devices, so there is nothing to solve
+	// on the host or to take snapshots from
+	if (conf.out_of_core && (conf.solver != NBODY_SOLVER_FPGA || conf.force_generation || conf.restart_file
+			|| conf.checkpoint_interval || conf.trajectory_interval)) {
+		fprintf(stderr, "The out-of-core mode needs the fpga solver and the .in file, without restart, checkpoints or trajectory\n");
+		*ok = 0;
+	}
+	
+	if (conf.timestep_levels > 1 && (conf.solver != NBODY_SOLVER_SMP || conf.symmetric)) {
+		fprintf(stderr, "The block timesteps need the smp solver without the symmetric mode\n");
+		*ok = 0;
+	}
+	
 	if (!conf.num_particles || !conf.timesteps) {
 		nbody_print_usage(argc, argv);
 		*ok = 0;
@@ -119,7 +456,7 @@ nbody_conf_t nbody_get_conf(int *ok, int argc, char **argv)
 	return conf;
 }
 
-double nbody_compute_throughput(int num_particles, int timesteps, double elapsed_time)
+double nbody_compute_throughput(int solver, int num_particles, int timesteps, double elapsed_time)
 {
 	double interactions_per_timestep = 0;
 #if defined(_BIGO_N2)
@@ -128,6 +465,19 @@ double nbody_compute_throughput(int num_particles, int timesteps, double elapsed
 	interactions_per_timestep = (double)(num_particles)*(double)(LOG2(num_particles));
 #elif defined(_BIGO_N)
 	interactions_per_timestep = (double)(num_particles);
+#else
+	// Otherwise the complexity is the one of the solver
+	switch (solver) {
+		case NBODY_SOLVER_BARNES_HUT:
+			interactions_per_timestep = (double)(num_particles)*(double)(LOG2(num_particles));
+			break;
+		case NBODY_SOLVER_FMM:
+			interactions_per_timestep = (double)(num_particles);
+			break;
+		default:
+			interactions_per_timestep = (double)(num_particles)*(double)(num_particles);
+			break;
+	}
 #endif
 	return (((interactions_per_timestep * (double)timesteps) / elapsed_time) / 1000000000.0);
 }
@@ -8,13 +8,41 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include "distribution.h"
+
 #include <stddef.h>
 
 #define PART 1024
 #define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2*1024*1024)
 
 #define TOLERATED_ERROR 0.0008
 
+// Highest expansion order of the FMM solver
+#define FMM_MAX_ORDER 8
+
+// Most power-of-two timestep levels of the block timesteps
+#define NBODY_MAX_TIMESTEP_LEVELS 16
+
+typedef enum {
+	NBODY_SOLVER_FPGA = 0,
+	NBODY_SOLVER_SMP,
+	NBODY_SOLVER_BARNES_HUT,
+	NBODY_SOLVER_FMM
+} nbody_solver_t;
+
+typedef enum {
+	NBODY_TRAJECTORY_FULL = 0,  // whole particle blocks
+	NBODY_TRAJECTORY_POSITIONS, // fp32 positions
+	NBODY_TRAJECTORY_PACKED     // 16-bit offsets within the extent of each block
+} nbody_trajectory_format_t;
+
+typedef enum {
+	NBODY_REPORT_NONE = 0,
+	NBODY_REPORT_JSON,
+	NBODY_REPORT_CSV
+} nbody_report_format_t;
+
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 #define LOG2(a) (31-__builtin_clz((a)))
@@ -23,6 +51,9 @@
     const typeof(y) __y = y;         \
     (((x) + (__y - 1)) / __y) * __y; \
 })
+// Blocks written by each first-touch task, so a huge page of a 2 MB aligned
+// allocation is never split between two tasks
+#define TOUCH_BLOCKS(block_size) MAX(1, (int)(HUGE_PAGE_SIZE / (block_size)))
 
 static const float gravitational_constant   = 6.6726e-11f; /* N(m/kg)2 */
 static const float default_domain_size_x    = 1.0e+10; /* m  */
@@ -37,6 +68,23 @@ static const int   default_timesteps        = 0;
 static const int   default_save_result      = 0;
 static const int   default_check_result     = 0;
 static const int   default_force_generation = 0;
+static const int   default_solver           = NBODY_SOLVER_FPGA;
+static const int   default_symmetric        = 0;
+static const int   default_fused            = 0;
+static const int   default_stationary       = 0;
+static const int   default_ring             = 0;
+static const int   default_compress         = 0;
+static const float default_theta            = 0.5f;
+static const int   default_fmm_order        = 4;
+static const int   default_report_format    = NBODY_REPORT_NONE;
+static const int   default_distribution     = NBODY_DIST_CYCLIC;
+static const int   default_check_ulp        = -1;
+static const int   default_checkpoint       = 0;
+static const int   default_trajectory       = 0;
+static const int   default_trajectory_format = NBODY_TRAJECTORY_FULL;
+static const int   default_out_of_core      = 0;
+static const int   default_timestep_levels  = 1;
+static const float default_timestep_accuracy = 0.025f;
 
 typedef struct {
 	float domain_size_x;
@@ -51,13 +99,40 @@ typedef struct {
 	int timesteps;
 	int save_result;
 	int check_result;
+	int check_ulp;
 	int force_generation;
+	int solver;
+	int symmetric;
+	int fused;
+	int stationary;
+	int ring;
+	int compress;
+	float theta;
+	int fmm_order;
+	int report_format;
+	const char* report_file;
+	const char* report_tag;
+	int distribution;
+	int num_weights;
+	int weights[NBODY_MAX_RANKS];
+	int checkpoint_interval;
+	const char* restart_file;
+	int trajectory_interval;
+	int trajectory_format;
+	int out_of_core;      // MB of the chunks streamed from the .in file, 0 to load it whole
+	int timestep_levels;  // 1 advances every block with the time interval
+	float timestep_accuracy;
 	char parse;
 } nbody_conf_t;
 
 nbody_conf_t nbody_get_conf(int* ok, int argc, char **argv);
-double nbody_compute_throughput(int num_particles, int timesteps, double elapsed_time);
+// Weight of each device, 1 for the ones not given in --weights
+void nbody_device_weights(const nbody_conf_t *conf, int devices, int *weights);
+double nbody_compute_throughput(int solver, int num_particles, int timesteps, double elapsed_time);
 void * nbody_alloc(size_t size);
+void nbody_dealloc(void *addr, size_t size);
+// Address range that is only backed by the pages that get written
+void * nbody_reserve(size_t size);
 double get_time();
 
 #endif // COMMON_H
@@ -7,64 +7,219 @@
 
 #include "nbody.h"
 
+#include <assert.h>
+#include <errno.h>
 #include <ieee754.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 
-void nbody_particle_init(const nbody_conf_t *conf, particles_block_t *part)
+// Philox4x32-10 (Salmon et al., SC'11), a counter-based generator: the output
+// only depends on the counter and the key, so any block can be generated
+// alone, in any order and on any thread
+static void nbody_philox4x32(uint32_t ctr[4], uint32_t key0, uint32_t key1)
 {
-	for (int i = 0; i < BLOCK_SIZE; i++){
-		part->position_x[i] = conf->domain_size_x * ((float)random() / ((float)RAND_MAX + 1.0));
-		part->position_y[i] = conf->domain_size_y * ((float)random() / ((float)RAND_MAX + 1.0));
-		part->position_z[i] = conf->domain_size_z * ((float)random() / ((float)RAND_MAX + 1.0));
-		part->mass[i] = conf->mass_maximum * ((float)random() / ((float)RAND_MAX + 1.0));
+	for (int r = 0; r < 10; r++) {
+		const uint64_t p0 = (uint64_t)0xD2511F53 * ctr[0];
+		const uint64_t p1 = (uint64_t)0xCD9E8D57 * ctr[2];
+		const uint32_t c0 = (uint32_t)(p1 >> 32) ^ ctr[1] ^ key0;
+		const uint32_t c2 = (uint32_t)(p0 >> 32) ^ ctr[3] ^ key1;
+		ctr[1] = (uint32_t)p1;
+		ctr[3] = (uint32_t)p0;
+		ctr[0] = c0;
+		ctr[2] = c2;
+		key0 += 0x9E3779B9;
+		key1 += 0xBB67AE85;
+	}
+}
+
+// Uniform in [0,1) with the 24 bits of the mantissa
+static inline float nbody_uniform(uint32_t r)
+{
+	return (r >> 8) * (1.0f / 16777216.0f);
+}
+
+// One counter per particle, its lane and block, keyed by the seed
+void nbody_particle_init(const nbody_conf_t *conf, particles_block_t *part, const int block, const int count)
+{
+	for (int i = 0; i < count; i++){
+		uint32_t r[4] = {i, block, 0, 0};
+		nbody_philox4x32(r, conf->seed, 0);
+		part->position_x[i] = conf->domain_size_x * nbody_uniform(r[0]);
+		part->position_y[i] = conf->domain_size_y * nbody_uniform(r[1]);
+		part->position_z[i] = conf->domain_size_z * nbody_uniform(r[2]);
+		part->mass[i] = conf->mass_maximum * nbody_uniform(r[3]);
 		part->weight[i] = gravitational_constant * part->mass[i];
 	}
+	for (int i = count; i < BLOCK_SIZE; i++) {
+		part->position_x[i] = part->position_x[0];
+		part->position_y[i] = part->position_y[0];
+		part->position_z[i] = part->position_z[0];
+		part->mass[i] = 0.0f;
+		part->weight[i] = 0.0f;
+	}
 }
 
-int nbody_compare_particles(const particles_block_t *local, const particles_block_t *reference, int num_blocks)
+void nbody_generate_blocks(const nbody_conf_t *conf, particles_block_t *particles)
 {
-	double error = 0.0;
-	int count = 0;
-	for (int i = 0; i < num_blocks; i++) {
-		for (int e = 0; e < BLOCK_SIZE; e++) {
+	const int touch = TOUCH_BLOCKS(sizeof(particles_block_t));
+	for (int first = 0; first < conf->num_blocks; first += touch) {
+		const int last = MIN(first + touch, conf->num_blocks);
+		#pragma oss task label("particle_init") out(particles[first;last-first]) firstprivate(first, last)
+		for (int i = first; i < last; i++) {
+			nbody_particle_init(conf, particles+i, i, nbody_block_particles(conf->num_particles, i));
+		}
+	}
+	#pragma oss taskwait
+}
+
+// Bits of a float as an integer that grows with its value, so the distance in
+// units in the last place is the difference of two of them
+static inline int64_t nbody_ordered_bits(float value)
+{
+	int32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits < 0 ? (int64_t)INT32_MIN - bits : bits;
+}
+
+static inline float nbody_relative_error(float local, float reference)
+{
+	const float diff = local - reference;
+	return diff == 0.0f ? 0.0f : fabsf(diff * 100.0f / reference);
+}
+
+// Branch-free over the lanes of the block, so it vectorizes
+static void nbody_compare_block(const particles_block_t *local, const particles_block_t *reference, nbody_error_t *error)
+{
+	int mismatches = 0;
+	double relative_sum = 0.0, ulp_sum = 0.0;
+	float relative_min = INFINITY, relative_max = 0.0f;
+	long long ulp_max = 0;
+
+	for (int e = 0; e < BLOCK_SIZE; e++) {
+		const int differs = (local->position_x[e] != reference->position_x[e]) |
+		                    (local->position_y[e] != reference->position_y[e]) |
+		                    (local->position_z[e] != reference->position_z[e]);
+		const float relative = nbody_relative_error(local->position_x[e], reference->position_x[e]) +
+		                       nbody_relative_error(local->position_y[e], reference->position_y[e]) +
+		                       nbody_relative_error(local->position_z[e], reference->position_z[e]);
+		const int64_t ulp_x = llabs(nbody_ordered_bits(local->position_x[e]) - nbody_ordered_bits(reference->position_x[e]));
+		const int64_t ulp_y = llabs(nbody_ordered_bits(local->position_y[e]) - nbody_ordered_bits(reference->position_y[e]));
+		const int64_t ulp_z = llabs(nbody_ordered_bits(local->position_z[e]) - nbody_ordered_bits(reference->position_z[e]));
+		const long long ulp = MAX(ulp_x, MAX(ulp_y, ulp_z));
+
+		mismatches += differs;
+		relative_sum += relative;
+		relative_min = differs ? fminf(relative_min, relative) : relative_min;
+		relative_max = fmaxf(relative_max, relative);
+		ulp_sum += ulp;
+		ulp_max = MAX(ulp_max, ulp);
+	}
+
+	error->mismatches = mismatches;
+	error->relative_sum = relative_sum;
+	error->relative_min = relative_min;
+	error->relative_max = relative_max;
+	error->ulp_sum = ulp_sum;
+	error->ulp_max = ulp_max;
+}
+
+void nbody_compare_blocks(const particles_block_t *local, const particles_block_t *reference, int first, int last, nbody_error_t *errors)
+{
+	for (int b = first; b < last; b++) {
+		#pragma oss task label("compare_block") in(local[b], reference[b]) out(errors[b])
+		nbody_compare_block(local+b, reference+b, errors+b);
+	}
+}
+
+int nbody_compare_result(const particles_block_t *local, const particles_block_t *reference, const nbody_error_t *errors, int num_blocks, int max_ulp, int computed)
+{
+	nbody_error_t total = {0, 0.0, INFINITY, 0.0f, 0.0, 0};
+	for (int b = 0; b < num_blocks; b++) {
+		total.mismatches += errors[b].mismatches;
+		total.relative_sum += errors[b].relative_sum;
+		total.relative_min = fminf(total.relative_min, errors[b].relative_min);
+		total.relative_max = fmaxf(total.relative_max, errors[b].relative_max);
+		total.ulp_sum += errors[b].ulp_sum;
+		total.ulp_max = MAX(total.ulp_max, errors[b].ulp_max);
+	}
+
+	// Only the first mismatches are printed, from the blocks that have them,
+	// when the particles are still on the host
+	int printed = 0;
+	for (int i = 0; local && i < num_blocks && printed < 100; i++) {
+		if (!errors[i].mismatches) continue;
+		for (int e = 0; e < BLOCK_SIZE && printed < 100; e++) {
 			if ((local[i].position_x[e] != reference[i].position_x[e]) ||
 			    (local[i].position_y[e] != reference[i].position_y[e]) ||
 			    (local[i].position_z[e] != reference[i].position_z[e])) {
-				error += fabs(((local[i].position_x[e] - reference[i].position_x[e])*100.0) / reference[i].position_x[e]) +
-				         fabs(((local[i].position_y[e] - reference[i].position_y[e])*100.0) / reference[i].position_y[e]) +
-				         fabs(((local[i].position_z[e] - reference[i].position_z[e])*100.0) / reference[i].position_z[e]);
-				count++;
-				if (count <= 100) {
-					typedef union {
-						float t;
-						unsigned int r;
-					} cast_t;
-					cast_t xref, yref, zref, x, y, z;
-					xref.t = reference[i].position_x[e];
-					yref.t = reference[i].position_y[e];
-					zref.t = reference[i].position_z[e];
-					x.t = local[i].position_x[e];
-					y.t = local[i].position_y[e];
-					z.t = local[i].position_z[e];
-					printf("block %d pos %d: expected (%e %e %e) found (%e %e %e) %X %X %X   %X %X %X\n", i, e,
-						reference[i].position_x[e], reference[i].position_y[e], reference[i].position_z[e],
-						local[i].position_x[e], local[i].position_y[e], local[i].position_z[e], xref.r, yref.r, zref.r, x.r, y.r, z.r);
-				}
+				typedef union {
+					float t;
+					unsigned int r;
+				} cast_t;
+				cast_t xref, yref, zref, x, y, z;
+				xref.t = reference[i].position_x[e];
+				yref.t = reference[i].position_y[e];
+				zref.t = reference[i].position_z[e];
+				x.t = local[i].position_x[e];
+				y.t = local[i].position_y[e];
+				z.t = local[i].position_z[e];
+				printf("block %d pos %d: expected (%e %e %e) found (%e %e %e) %X %X %X   %X %X %X\n", i, e,
+					reference[i].position_x[e], reference[i].position_y[e], reference[i].position_z[e],
+					local[i].position_x[e], local[i].position_y[e], local[i].position_z[e], xref.r, yref.r, zref.r, x.r, y.r, z.r);
+				printed++;
 			}
 		}
 	}
-	
-	double relative_error = (count != 0) ? error / (3.0 * count) : 0.0;
+
+	const int count = total.mismatches;
+	const double particles = (double)num_blocks * BLOCK_SIZE;
+	const double relative_error = (count != 0) ? total.relative_sum / (3.0 * count) : 0.0;
 	printf("count %d relative error %g\n", count, relative_error);
-	if ((count * 100.0) / (num_blocks * BLOCK_SIZE) > 60 || relative_error > TOLERATED_ERROR) {
+	if (count != 0) {
+		printf("relative error min %g max %g, ulp error mean %g max %lld\n",
+				total.relative_min / 3.0, total.relative_max / 3.0, total.ulp_sum / particles, (long long)total.ulp_max);
+	}
+	if (max_ulp >= 0) {
+		return total.ulp_max <= max_ulp;
+	}
+	// Every particle differs from an fp64 reference, so only the error counts
+	if ((!computed && (count * 100.0) / particles > 60) || !(relative_error <= TOLERATED_ERROR)) {
 		return 0;
 	}
 	return 1;
 }
 
+int nbody_compare_particles(const particles_block_t *local, const particles_block_t *reference, int num_blocks, int max_ulp, int computed)
+{
+	nbody_error_t *errors = malloc(num_blocks * sizeof(nbody_error_t));
+	assert(errors != NULL);
+
+	nbody_compare_blocks(local, reference, 0, num_blocks, errors);
+	#pragma oss taskwait
+
+	const int ok = nbody_compare_result(local, reference, errors, num_blocks, max_ulp, computed);
+	free(errors);
+	return ok;
+}
+
+int nbody_write_all(int fd, const void *buffer, size_t size)
+{
+	const char *ptr = buffer;
+	while (size > 0) {
+		const ssize_t n = write(fd, ptr, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return 0;
+		ptr += n;
+		size -= n;
+	}
+	return 1;
+}
+
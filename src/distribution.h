@@ -0,0 +1,70 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+#ifndef DISTRIBUTION_H
+#define DISTRIBUTION_H
+
+// Ranks of a cluster, the OMPIF owners 254 and 255 are reserved
+#define NBODY_MAX_RANKS 254
+
+typedef enum {
+	NBODY_DIST_CYCLIC = 0,  // block i to the ranks in turn, in proportion to their weights
+	NBODY_DIST_CONTIGUOUS   // a range of consecutive blocks per rank
+} nbody_distribution_t;
+
+// Blocks of each rank, proportional to its weight. The blocks left by the
+// rounding go to the ranks with the largest remainders, first ranks first
+static inline void nbody_distribution_counts(int num_blocks, int ranks, const int *weights, int *counts)
+{
+	long long total = 0, remainder[NBODY_MAX_RANKS];
+	for (int r = 0; r < ranks; r++) total += weights[r];
+
+	int assigned = 0;
+	for (int r = 0; r < ranks; r++) {
+		counts[r] = (int)((long long)num_blocks*weights[r]/total);
+		remainder[r] = (long long)num_blocks*weights[r] - counts[r]*total;
+		assigned += counts[r];
+	}
+	for (; assigned < num_blocks; assigned++) {
+		int best = 0;
+		for (int r = 1; r < ranks; r++) {
+			if (remainder[r] > remainder[best]) best = r;
+		}
+		counts[best]++;
+		remainder[best] = -1;
+	}
+}
+
+// Owner rank of every block. The cyclic mapping gives each block to the rank
+// furthest behind its share, so equal weights give block i to rank i%ranks
+static inline void nbody_block_owners(int num_blocks, int ranks, const int *weights, int distribution, unsigned char *owners)
+{
+	int counts[NBODY_MAX_RANKS], assigned[NBODY_MAX_RANKS];
+	nbody_distribution_counts(num_blocks, ranks, weights, counts);
+	for (int r = 0; r < ranks; r++) assigned[r] = 0;
+
+	int rank = 0;
+	for (int b = 0; b < num_blocks; b++) {
+		if (distribution == NBODY_DIST_CONTIGUOUS) {
+			while (assigned[rank] == counts[rank]) rank++;
+		} else {
+			// Share of each rank after this block minus what it has, scaled by num_blocks
+			long long behind = -1;
+			for (int r = 0; r < ranks; r++) {
+				const long long deficit = (long long)(b + 1)*counts[r] - (long long)num_blocks*assigned[r];
+				if (assigned[r] < counts[r] && deficit > behind) {
+					behind = deficit;
+					rank = r;
+				}
+			}
+		}
+		owners[b] = (unsigned char)rank;
+		assigned[rank]++;
+	}
+}
+
+#endif // DISTRIBUTION_H
@@ -0,0 +1,601 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+#include "nbody.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Relative cost of one M2L term with respect to one direct interaction,
+// used to balance the near and the far field when choosing the depth
+#define FMM_M2L_COST 3.0
+// The interaction lists start at level 2
+#define FMM_MIN_LEVEL 2
+// 8^7 leaf cells, enough for the largest runs
+#define FMM_MAX_LEVEL 7
+// Cells computed by each task
+#define FMM_TASK_CELLS 64
+
+// Cartesian Taylor expansions of 1/r: the multipole of a cell is
+// M_k = sum w (c - r)^k and the potential of the far field around a cell
+// is sum_l L_l (x - c)^l, for all the multi-indices k = (kx, ky, kz) with
+// |k| = kx + ky + kz <= order.
+typedef struct {
+	int order;
+	int num_terms;
+	int (*k)[3];          // Multi-index of each term, sorted by |k|
+	int *index;           // Term of each (kx, ky, kz), (order+1)^3 entries
+	int (*recurrence)[6]; // Terms k - e_i and k - 2e_i for the derivatives, -1 if not valid
+	// M2L: L_l += binom(k + l, k) M_k a_{k+l}(R), for |k| + |l| <= order
+	int num_m2l;
+	int (*m2l)[3];        // l, k, k + l
+	double *m2l_coef;
+	// M2M and L2L: binom(k, j) d^{k-j}, for all j <= k
+	int num_shift;
+	int (*shift)[3];      // k, j, k - j
+	double *shift_coef;
+} fmm_terms_t;
+
+typedef struct {
+	fmm_terms_t terms;
+	int levels;           // Level of the leaf cells, the root is level 0
+	float lo[3];          // Corner of the root cell
+	float size;           // Side of the root cell
+	int num_particles;
+	int *key;             // Leaf cell of each particle
+	int *index;           // Tree order to particle index permutation
+	int *start;           // First particle of each leaf cell in tree order
+	// Particles and forces in tree order
+	float *x, *y, *z, *mass, *weight;
+	float *fx, *fy, *fz;
+	double *multipole[FMM_MAX_LEVEL + 1];
+	double *local[FMM_MAX_LEVEL + 1];
+} fmm_tree_t;
+
+static double fmm_binomial(int n, int k)
+{
+	double b = 1.0;
+	for (int i = 1; i <= k; i++) b = b*(n - k + i)/i;
+	return b;
+}
+
+static inline int fmm_term(const fmm_terms_t *terms, int kx, int ky, int kz)
+{
+	const int o = terms->order + 1;
+	return terms->index[(kx*o + ky)*o + kz];
+}
+
+static void fmm_terms_init(fmm_terms_t *terms, const int order)
+{
+	terms->order = order;
+	terms->num_terms = (order + 1)*(order + 2)*(order + 3)/6;
+	terms->k = malloc(terms->num_terms*sizeof(*terms->k));
+	terms->index = malloc((order + 1)*(order + 1)*(order + 1)*sizeof(int));
+	terms->recurrence = malloc(terms->num_terms*sizeof(*terms->recurrence));
+	assert(terms->k && terms->index && terms->recurrence);
+
+	int t = 0;
+	for (int deg = 0; deg <= order; deg++) {
+		for (int kx = deg; kx >= 0; kx--) {
+			for (int ky = deg - kx; ky >= 0; ky--) {
+				const int kz = deg - kx - ky;
+				terms->k[t][0] = kx;
+				terms->k[t][1] = ky;
+				terms->k[t][2] = kz;
+				terms->index[(kx*(order + 1) + ky)*(order + 1) + kz] = t;
+				t++;
+			}
+		}
+	}
+	assert(t == terms->num_terms);
+
+	for (t = 0; t < terms->num_terms; t++) {
+		for (int i = 0; i < 3; i++) {
+			int e[3] = {terms->k[t][0], terms->k[t][1], terms->k[t][2]};
+			e[i] -= 1;
+			terms->recurrence[t][i] = e[i] >= 0 ? fmm_term(terms, e[0], e[1], e[2]) : -1;
+			e[i] -= 1;
+			terms->recurrence[t][3 + i] = e[i] >= 0 ? fmm_term(terms, e[0], e[1], e[2]) : -1;
+		}
+	}
+
+	terms->num_m2l = 0;
+	terms->num_shift = 0;
+	for (int a = 0; a < terms->num_terms; a++) {
+		for (int b = 0; b < terms->num_terms; b++) {
+			const int *ka = terms->k[a], *kb = terms->k[b];
+			if (ka[0] + ka[1] + ka[2] + kb[0] + kb[1] + kb[2] <= order) terms->num_m2l++;
+			if (kb[0] <= ka[0] && kb[1] <= ka[1] && kb[2] <= ka[2]) terms->num_shift++;
+		}
+	}
+	terms->m2l = malloc(terms->num_m2l*sizeof(*terms->m2l));
+	terms->m2l_coef = malloc(terms->num_m2l*sizeof(double));
+	terms->shift = malloc(terms->num_shift*sizeof(*terms->shift));
+	terms->shift_coef = malloc(terms->num_shift*sizeof(double));
+	assert(terms->m2l && terms->m2l_coef && terms->shift && terms->shift_coef);
+
+	int m = 0, s = 0;
+	for (int a = 0; a < terms->num_terms; a++) {
+		for (int b = 0; b < terms->num_terms; b++) {
+			const int *ka = terms->k[a], *kb = terms->k[b];
+			if (ka[0] + ka[1] + ka[2] + kb[0] + kb[1] + kb[2] <= order) {
+				terms->m2l[m][0] = a;
+				terms->m2l[m][1] = b;
+				terms->m2l[m][2] = fmm_term(terms, ka[0] + kb[0], ka[1] + kb[1], ka[2] + kb[2]);
+				terms->m2l_coef[m] = fmm_binomial(ka[0] + kb[0], kb[0])*fmm_binomial(ka[1] + kb[1], kb[1])*fmm_binomial(ka[2] + kb[2], kb[2]);
+				m++;
+			}
+			if (kb[0] <= ka[0] && kb[1] <= ka[1] && kb[2] <= ka[2]) {
+				terms->shift[s][0] = a;
+				terms->shift[s][1] = b;
+				terms->shift[s][2] = fmm_term(terms, ka[0] - kb[0], ka[1] - kb[1], ka[2] - kb[2]);
+				terms->shift_coef[s] = fmm_binomial(ka[0], kb[0])*fmm_binomial(ka[1], kb[1])*fmm_binomial(ka[2], kb[2]);
+				s++;
+			}
+		}
+	}
+}
+
+static void fmm_terms_free(fmm_terms_t *terms)
+{
+	free(terms->k);
+	free(terms->index);
+	free(terms->recurrence);
+	free(terms->m2l);
+	free(terms->m2l_coef);
+	free(terms->shift);
+	free(terms->shift_coef);
+}
+
+// d^k for all the terms
+static void fmm_powers(const fmm_terms_t *terms, const double dx, const double dy, const double dz, double *pw)
+{
+	double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1], pz[FMM_MAX_ORDER + 1];
+	px[0] = py[0] = pz[0] = 1.0;
+	for (int i = 1; i <= terms->order; i++) {
+		px[i] = px[i-1]*dx;
+		py[i] = py[i-1]*dy;
+		pz[i] = pz[i-1]*dz;
+	}
+	for (int t = 0; t < terms->num_terms; t++) {
+		pw[t] = px[terms->k[t][0]]*py[terms->k[t][1]]*pz[terms->k[t][2]];
+	}
+}
+
+// Taylor coefficients a_n = d^n(1/r)/n! with the recurrence
+// |n| r^2 a_n = -(2|n| - 1) sum_i r_i a_{n-e_i} - (|n| - 1) sum_i a_{n-2e_i}
+static void fmm_derivatives(const fmm_terms_t *terms, const double rx, const double ry, const double rz, double *a)
+{
+	const double r[3] = {rx, ry, rz};
+	const double inv_r2 = 1.0/(rx*rx + ry*ry + rz*rz);
+	a[0] = sqrt(inv_r2);
+	for (int n = 1; n < terms->num_terms; n++) {
+		const int *k = terms->k[n];
+		const int *rec = terms->recurrence[n];
+		const int deg = k[0] + k[1] + k[2];
+		double s = 0.0;
+		for (int i = 0; i < 3; i++) {
+			if (rec[i] >= 0) s += (2*deg - 1)*r[i]*a[rec[i]];
+			if (rec[3 + i] >= 0) s += (deg - 1)*a[rec[3 + i]];
+		}
+		a[n] = -s*inv_r2/deg;
+	}
+}
+
+static inline int fmm_spread(int v)
+{
+	int r = 0;
+	for (int b = 0; b < FMM_MAX_LEVEL; b++) r |= ((v >> b) & 1) << (3*b);
+	return r;
+}
+
+static inline int fmm_compact(int v)
+{
+	int r = 0;
+	for (int b = 0; b < FMM_MAX_LEVEL; b++) r |= ((v >> (3*b)) & 1) << b;
+	return r;
+}
+
+// Cells are in Morton order, so the 8 children of cell c are 8c to 8c + 7
+static inline int fmm_cell(int ix, int iy, int iz)
+{
+	return fmm_spread(ix) | (fmm_spread(iy) << 1) | (fmm_spread(iz) << 2);
+}
+
+static inline void fmm_cell_coords(int c, int *i)
+{
+	i[0] = fmm_compact(c);
+	i[1] = fmm_compact(c >> 1);
+	i[2] = fmm_compact(c >> 2);
+}
+
+static inline void fmm_cell_center(const fmm_tree_t *tree, int level, int c, double *center)
+{
+	int i[3];
+	fmm_cell_coords(c, i);
+	const double side = (double)tree->size/(1 << level);
+	for (int d = 0; d < 3; d++) center[d] = tree->lo[d] + (i[d] + 0.5)*side;
+}
+
+static void fmm_sort(fmm_tree_t *tree, const particles_block_t *particles, const int num_blocks)
+{
+	// Only the particles before the padding of the last block are sorted
+	float bmin[num_blocks][3], bmax[num_blocks][3];
+	for (int b = 0; b < num_blocks; b++) {
+		const int count = nbody_block_particles(tree->num_particles, b);
+		#pragma oss task label("fmm_bounding_box") in(particles[b]) out(bmin[b], bmax[b])
+		{
+			float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+			for (int e = 0; e < count; e++) {
+				lo[0] = MIN(lo[0], particles[b].position_x[e]); hi[0] = MAX(hi[0], particles[b].position_x[e]);
+				lo[1] = MIN(lo[1], particles[b].position_y[e]); hi[1] = MAX(hi[1], particles[b].position_y[e]);
+				lo[2] = MIN(lo[2], particles[b].position_z[e]); hi[2] = MAX(hi[2], particles[b].position_z[e]);
+			}
+			memcpy(bmin[b], lo, sizeof(lo));
+			memcpy(bmax[b], hi, sizeof(hi));
+		}
+	}
+	#pragma oss taskwait
+
+	float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+	for (int b = 0; b < num_blocks; b++) {
+		for (int d = 0; d < 3; d++) {
+			lo[d] = MIN(lo[d], bmin[b][d]);
+			hi[d] = MAX(hi[d], bmax[b][d]);
+		}
+	}
+	tree->size = 0.0f;
+	for (int d = 0; d < 3; d++) {
+		tree->lo[d] = lo[d];
+		tree->size = MAX(tree->size, hi[d] - lo[d]);
+	}
+	// Slightly enlarged so that the particles on the upper faces are inside
+	tree->size *= 1.0001f;
+
+	const int side = 1 << tree->levels;
+	const float scale = side/tree->size;
+	for (int b = 0; b < num_blocks; b++) {
+		const int count = nbody_block_particles(tree->num_particles, b);
+		#pragma oss task label("fmm_keys") in(particles[b]) out(tree->key[b*BLOCK_SIZE;count])
+		for (int e = 0; e < count; e++) {
+			const int ix = MIN(side - 1, (int)((particles[b].position_x[e] - tree->lo[0])*scale));
+			const int iy = MIN(side - 1, (int)((particles[b].position_y[e] - tree->lo[1])*scale));
+			const int iz = MIN(side - 1, (int)((particles[b].position_z[e] - tree->lo[2])*scale));
+			tree->key[b*BLOCK_SIZE + e] = fmm_cell(ix, iy, iz);
+		}
+	}
+	#pragma oss taskwait
+
+	// Counting sort of the particles by leaf cell
+	const int num_leaves = 1 << (3*tree->levels);
+	memset(tree->start, 0, (num_leaves + 1)*sizeof(int));
+	for (int p = 0; p < tree->num_particles; p++) {
+		tree->start[tree->key[p] + 1]++;
+	}
+	for (int c = 0; c < num_leaves; c++) {
+		tree->start[c + 1] += tree->start[c];
+	}
+	for (int p = 0; p < tree->num_particles; p++) {
+		tree->index[tree->start[tree->key[p]]++] = p;
+	}
+	for (int c = num_leaves; c > 0; c--) {
+		tree->start[c] = tree->start[c - 1];
+	}
+	tree->start[0] = 0;
+
+	for (int b = 0; b < num_blocks; b++) {
+		const int count = nbody_block_particles(tree->num_particles, b);
+		#pragma oss task label("fmm_reorder") out(tree->x[b*BLOCK_SIZE;count])
+		for (int k = b*BLOCK_SIZE; k < b*BLOCK_SIZE + count; k++) {
+			const int p = tree->index[k];
+			const particles_block_t *block = particles + p/BLOCK_SIZE;
+			const int e = p%BLOCK_SIZE;
+			tree->x[k] = block->position_x[e];
+			tree->y[k] = block->position_y[e];
+			tree->z[k] = block->position_z[e];
+			tree->mass[k] = block->mass[e];
+			tree->weight[k] = block->weight[e];
+			tree->fx[k] = tree->fy[k] = tree->fz[k] = 0.0f;
+		}
+	}
+	#pragma oss taskwait
+}
+
+// Particle to multipole, for the leaf cells
+static void fmm_p2m(fmm_tree_t *tree)
+{
+	const fmm_terms_t *terms = &tree->terms;
+	const int num_terms = terms->num_terms;
+	const int num_cells = 1 << (3*tree->levels);
+	for (int first = 0; first < num_cells; first += FMM_TASK_CELLS) {
+		#pragma oss task label("fmm_p2m") firstprivate(first)
+		{
+			double pw[num_terms];
+			for (int c = first; c < MIN(first + FMM_TASK_CELLS, num_cells); c++) {
+				double center[3];
+				fmm_cell_center(tree, tree->levels, c, center);
+				double *M = tree->multipole[tree->levels] + c*num_terms;
+				memset(M, 0, num_terms*sizeof(double));
+				for (int k = tree->start[c]; k < tree->start[c + 1]; k++) {
+					fmm_powers(terms, center[0] - tree->x[k], center[1] - tree->y[k], center[2] - tree->z[k], pw);
+					for (int t = 0; t < num_terms; t++) M[t] += tree->weight[k]*pw[t];
+				}
+			}
+		}
+	}
+	#pragma oss taskwait
+}
+
+// Multipole to multipole, from the children at level + 1 to the cells at level
+static void fmm_m2m(fmm_tree_t *tree, const int level)
+{
+	const fmm_terms_t *terms = &tree->terms;
+	const int num_terms = terms->num_terms;
+	const int num_cells = 1 << (3*level);
+	for (int first = 0; first < num_cells; first += FMM_TASK_CELLS) {
+		#pragma oss task label("fmm_m2m") firstprivate(first)
+		{
+			double pw[num_terms];
+			for (int c = first; c < MIN(first + FMM_TASK_CELLS, num_cells); c++) {
+				double center[3], child_center[3];
+				fmm_cell_center(tree, level, c, center);
+				double *M = tree->multipole[level] + c*num_terms;
+				memset(M, 0, num_terms*sizeof(double));
+				for (int o = 0; o < 8; o++) {
+					const double *child = tree->multipole[level + 1] + (8*c + o)*num_terms;
+					if (child[0] == 0.0) continue;
+					fmm_cell_center(tree, level + 1, 8*c + o, child_center);
+					fmm_powers(terms, center[0] - child_center[0], center[1] - child_center[1], center[2] - child_center[2], pw);
+					for (int s = 0; s < terms->num_shift; s++) {
+						const int *sh = terms->shift[s];
+						M[sh[0]] += terms->shift_coef[s]*child[sh[1]]*pw[sh[2]];
+					}
+				}
+			}
+		}
+	}
+}
+
+// Multipole to local for the interaction list of the cells at level: the
+// children of the neighbours of the parent that are not neighbours
+static void fmm_m2l(fmm_tree_t *tree, const int level)
+{
+	const fmm_terms_t *terms = &tree->terms;
+	const int num_terms = terms->num_terms;
+	const int num_cells = 1 << (3*level);
+	const int side = 1 << level;
+	for (int first = 0; first < num_cells; first += FMM_TASK_CELLS) {
+		#pragma oss task label("fmm_m2l") firstprivate(first)
+		{
+			double a[num_terms];
+			for (int c = first; c < MIN(first + FMM_TASK_CELLS, num_cells); c++) {
+				int i[3];
+				double center[3], source_center[3];
+				fmm_cell_coords(c, i);
+				fmm_cell_center(tree, level, c, center);
+				double *L = tree->local[level] + c*num_terms;
+				memset(L, 0, num_terms*sizeof(double));
+
+				const int lo[3] = {MAX(0, (i[0] & ~1) - 2), MAX(0, (i[1] & ~1) - 2), MAX(0, (i[2] & ~1) - 2)};
+				const int hi[3] = {MIN(side - 1, (i[0] | 1) + 2), MIN(side - 1, (i[1] | 1) + 2), MIN(side - 1, (i[2] | 1) + 2)};
+				for (int jx = lo[0]; jx <= hi[0]; jx++) {
+					for (int jy = lo[1]; jy <= hi[1]; jy++) {
+						for (int jz = lo[2]; jz <= hi[2]; jz++) {
+							if (abs(jx - i[0]) <= 1 && abs(jy - i[1]) <= 1 && abs(jz - i[2]) <= 1) continue;
+							const int source = fmm_cell(jx, jy, jz);
+							const double *M = tree->multipole[level] + source*num_terms;
+							if (M[0] == 0.0) continue;
+							fmm_cell_center(tree, level, source, source_center);
+							fmm_derivatives(terms, center[0] - source_center[0], center[1] - source_center[1], center[2] - source_center[2], a);
+							for (int m = 0; m < terms->num_m2l; m++) {
+								const int *t = terms->m2l[m];
+								L[t[0]] += terms->m2l_coef[m]*M[t[1]]*a[t[2]];
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Local to local, from the cells at level to their children
+static void fmm_l2l(fmm_tree_t *tree, const int level)
+{
+	const fmm_terms_t *terms = &tree->terms;
+	const int num_terms = terms->num_terms;
+	const int num_cells = 1 << (3*level);
+	for (int first = 0; first < num_cells; first += FMM_TASK_CELLS) {
+		#pragma oss task label("fmm_l2l") firstprivate(first)
+		{
+			double pw[num_terms];
+			for (int c = first; c < MIN(first + FMM_TASK_CELLS, num_cells); c++) {
+				double center[3], child_center[3];
+				fmm_cell_center(tree, level, c, center);
+				const double *L = tree->local[level] + c*num_terms;
+				for (int o = 0; o < 8; o++) {
+					double *child = tree->local[level + 1] + (8*c + o)*num_terms;
+					fmm_cell_center(tree, level + 1, 8*c + o, child_center);
+					fmm_powers(terms, child_center[0] - center[0], child_center[1] - center[1], child_center[2] - center[2], pw);
+					for (int s = 0; s < terms->num_shift; s++) {
+						const int *sh = terms->shift[s];
+						child[sh[1]] += terms->shift_coef[s]*L[sh[0]]*pw[sh[2]];
+					}
+				}
+			}
+		}
+	}
+}
+
+// Direct interactions of the leaf cells with their neighbours, computed
+// with the SMP block kernel on the contiguous ranges of each cell
+static void fmm_p2p(fmm_tree_t *tree)
+{
+	const int num_cells = 1 << (3*tree->levels);
+	const int side = 1 << tree->levels;
+	for (int first = 0; first < num_cells; first += FMM_TASK_CELLS) {
+		#pragma oss task label("fmm_p2p") firstprivate(first)
+		for (int c = first; c < MIN(first + FMM_TASK_CELLS, num_cells); c++) {
+			const int b = tree->start[c];
+			const int n = tree->start[c + 1] - b;
+			if (n == 0) continue;
+			int i[3];
+			fmm_cell_coords(c, i);
+			for (int jx = MAX(0, i[0] - 1); jx <= MIN(side - 1, i[0] + 1); jx++) {
+				for (int jy = MAX(0, i[1] - 1); jy <= MIN(side - 1, i[1] + 1); jy++) {
+					for (int jz = MAX(0, i[2] - 1); jz <= MIN(side - 1, i[2] + 1); jz++) {
+						const int source = fmm_cell(jx, jy, jz);
+						const int sb = tree->start[source];
+						const int sn = tree->start[source + 1] - sb;
+						calculate_forces_kernel_smp(tree->fx + b, tree->fy + b, tree->fz + b,
+							tree->x + b, tree->y + b, tree->z + b, tree->mass + b, n,
+							tree->x + sb, tree->y + sb, tree->z + sb, tree->weight + sb, sn);
+					}
+				}
+			}
+		}
+	}
+}
+
+// Local to particle: the acceleration is the gradient of the local expansion
+static void fmm_l2p(fmm_tree_t *tree, forces_block_t *forces)
+{
+	const fmm_terms_t *terms = &tree->terms;
+	const int num_terms = terms->num_terms;
+	const int num_cells = 1 << (3*tree->levels);
+	for (int first = 0; first < num_cells; first += FMM_TASK_CELLS) {
+		#pragma oss task label("fmm_l2p") firstprivate(first)
+		{
+			double pw[num_terms];
+			for (int c = first; c < MIN(first + FMM_TASK_CELLS, num_cells); c++) {
+				double center[3];
+				fmm_cell_center(tree, tree->levels, c, center);
+				const double *L = tree->local[tree->levels] + c*num_terms;
+				for (int k = tree->start[c]; k < tree->start[c + 1]; k++) {
+					fmm_powers(terms, tree->x[k] - center[0], tree->y[k] - center[1], tree->z[k] - center[2], pw);
+					double ax = 0.0, ay = 0.0, az = 0.0;
+					for (int t = 1; t < num_terms; t++) {
+						const int *e = terms->k[t];
+						if (e[0] > 0) ax += e[0]*L[t]*pw[fmm_term(terms, e[0] - 1, e[1], e[2])];
+						if (e[1] > 0) ay += e[1]*L[t]*pw[fmm_term(terms, e[0], e[1] - 1, e[2])];
+						if (e[2] > 0) az += e[2]*L[t]*pw[fmm_term(terms, e[0], e[1], e[2] - 1)];
+					}
+
+					// Leaf cells are disjoint, so no other task writes these forces
+					const int p = tree->index[k];
+					forces_block_t *force = forces + p/BLOCK_SIZE;
+					force->x[p%BLOCK_SIZE] += tree->fx[k] + (float)(tree->mass[k]*ax);
+					force->y[p%BLOCK_SIZE] += tree->fy[k] + (float)(tree->mass[k]*ay);
+					force->z[p%BLOCK_SIZE] += tree->fz[k] + (float)(tree->mass[k]*az);
+				}
+			}
+		}
+	}
+	#pragma oss taskwait
+}
+
+// Depth with the lowest estimated cost for a uniform distribution: the near
+// field grows with the particles per leaf and the far field with the leaves
+static int fmm_levels(const fmm_terms_t *terms, const int num_particles)
+{
+	int levels = FMM_MIN_LEVEL;
+	double best = DBL_MAX;
+	for (int level = FMM_MIN_LEVEL; level <= FMM_MAX_LEVEL; level++) {
+		const double cells = (double)(1 << (3*level));
+		const double p2p = 27.0*(double)num_particles*num_particles/cells;
+		const double m2l = FMM_M2L_COST*189.0*cells*terms->num_m2l;
+		if (p2p + m2l < best) {
+			best = p2p + m2l;
+			levels = level;
+		}
+	}
+	return levels;
+}
+
+static void fmm_calculate_forces(fmm_tree_t *tree, forces_block_t *forces)
+{
+	fmm_p2m(tree);
+	for (int level = tree->levels - 1; level >= FMM_MIN_LEVEL; level--) {
+		fmm_m2m(tree, level);
+		#pragma oss taskwait
+	}
+
+	// The near field does not depend on the expansions
+	fmm_p2p(tree);
+	for (int level = FMM_MIN_LEVEL; level <= tree->levels; level++) {
+		fmm_m2l(tree, level);
+	}
+	#pragma oss taskwait
+
+	for (int level = FMM_MIN_LEVEL; level < tree->levels; level++) {
+		fmm_l2l(tree, level);
+		#pragma oss taskwait
+	}
+
+	fmm_l2p(tree, forces);
+}
+
+void nbody_solve_fmm(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles, const int timesteps, const float time_interval, const int order)
+{
+	assert(order >= 1 && order <= FMM_MAX_ORDER);
+	nbody_smp_init();
+
+	fmm_tree_t tree;
+	fmm_terms_init(&tree.terms, order);
+	tree.num_particles = num_particles;
+	tree.levels = fmm_levels(&tree.terms, tree.num_particles);
+
+	const int num_leaves = 1 << (3*tree.levels);
+	tree.key = malloc(tree.num_particles*sizeof(int));
+	tree.index = malloc(tree.num_particles*sizeof(int));
+	tree.start = malloc((num_leaves + 1)*sizeof(int));
+	tree.x = malloc(tree.num_particles*sizeof(float));
+	tree.y = malloc(tree.num_particles*sizeof(float));
+	tree.z = malloc(tree.num_particles*sizeof(float));
+	tree.mass = malloc(tree.num_particles*sizeof(float));
+	tree.weight = malloc(tree.num_particles*sizeof(float));
+	tree.fx = malloc(tree.num_particles*sizeof(float));
+	tree.fy = malloc(tree.num_particles*sizeof(float));
+	tree.fz = malloc(tree.num_particles*sizeof(float));
+	assert(tree.key && tree.index && tree.start);
+	assert(tree.x && tree.y && tree.z && tree.mass && tree.weight);
+	assert(tree.fx && tree.fy && tree.fz);
+	for (int level = FMM_MIN_LEVEL; level <= tree.levels; level++) {
+		const size_t size = ((size_t)1 << (3*level))*tree.terms.num_terms*sizeof(double);
+		tree.multipole[level] = malloc(size);
+		tree.local[level] = malloc(size);
+		assert(tree.multipole[level] && tree.local[level]);
+	}
+
+	for (int t = 0; t < timesteps; t++) {
+		fmm_sort(&tree, particles, num_blocks);
+		fmm_calculate_forces(&tree, forces);
+		update_particles_smp(particles, forces, num_blocks, num_particles, time_interval);
+		#pragma oss taskwait
+	}
+
+	for (int level = FMM_MIN_LEVEL; level <= tree.levels; level++) {
+		free(tree.multipole[level]);
+		free(tree.local[level]);
+	}
+	free(tree.key);
+	free(tree.index);
+	free(tree.start);
+	free(tree.x);
+	free(tree.y);
+	free(tree.z);
+	free(tree.mass);
+	free(tree.weight);
+	free(tree.fx);
+	free(tree.fy);
+	free(tree.fz);
+	fmm_terms_free(&tree.terms);
+}
@@ -8,13 +8,263 @@
 #include "nbody.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <nanos6/distributed.h>
 
+// A device updates its own blocks, so it gets them whole, and its force tasks
+// only read the positions and weights of the other blocks, which are
+// consecutive. The force blocks are not copied, nbody_solve clears the ones
+// of each device. Returns the bytes copied
+static size_t nbody_upload_particles(particles_block_t *particles, const unsigned char *owners, int first_block, int last_block, int devices)
+{
+	const size_t block_size = sizeof(particles_block_t);
+	const size_t source_offset = PARTICLES_FPGABLOCK_POS_X_OFFSET*sizeof(float);
+	const size_t source_size = 4*BLOCK_SIZE*sizeof(float);
+	size_t bytes = 0;
+
+	for (int d = 0; d < devices; d++) {
+		for (int first = first_block, last; first < last_block; first = last) {
+			const int own = owners[first] == d;
+			for (last = first + 1; last < last_block && (owners[last] == d) == own; ++last);
+			if (own) {
+				nanos6_dist_memcpy_to_device(d, particles, block_size*(last - first), block_size*first, block_size*first);
+				bytes += block_size*(last - first);
+				continue;
+			}
+			for (int b = first; b < last; b++) {
+				nanos6_dist_memcpy_to_device(d, particles, source_size, block_size*b + source_offset, block_size*b + source_offset);
+				bytes += source_size;
+			}
+		}
+	}
+	return bytes;
+}
+
+// Each run of consecutive blocks of a device in one copy. With a reference,
+// the tasks that validate a run overlap with the copy of the next ones
+static void nbody_download_particles(particles_block_t *particles, const unsigned char *owners, int first_block, int last_block, const particles_block_t *reference, nbody_error_t *errors)
+{
+	for (int first = first_block, last; first < last_block; first = last) {
+		for (last = first + 1; last < last_block && owners[last] == owners[first]; ++last);
+		nanos6_dist_memcpy_from_device(owners[first], particles, sizeof(particles_block_t)*(last - first), sizeof(particles_block_t)*first, sizeof(particles_block_t)*first);
+		if (reference) nbody_compare_blocks(particles, reference, first, last, errors);
+	}
+}
+
+// Blocks of the chunks of the out-of-core mode
+static int nbody_chunk_blocks(const nbody_conf_t *conf)
+{
+	return MAX(1, (int)(((size_t)conf->out_of_core << 20) / sizeof(particles_block_t)));
+}
+
+// Gives back the pages of a chunk once it is sent or saved. The range stays
+// mapped, and the pages shared with the next chunk are kept
+static void nbody_drop_blocks(particles_block_t *particles, int first, int last)
+{
+	const uintptr_t start = ROUNDUP((uintptr_t)(particles + first), (uintptr_t)PAGE_SIZE);
+	const uintptr_t end = (uintptr_t)(particles + last) / PAGE_SIZE * PAGE_SIZE;
+	if (end > start) madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+// Out-of-core upload: a task reads the next chunk of the .in file, a task per
+// block, while the current one is copied to the devices and dropped, so the
+// host holds two chunks at most. Returns the bytes copied
+static size_t nbody_stream_upload(const nbody_conf_t *conf, const nbody_t *nbody, const unsigned char *owners, int devices)
+{
+	char fname[1024];
+	sprintf(fname, "%s.in", nbody->file.name);
+	const int fd = open(fname, O_RDONLY, 0);
+	assert(fd >= 0);
+
+	particles_block_t *particles = nbody->particles;
+	const int num_blocks = conf->num_blocks;
+	const int chunk = nbody_chunk_blocks(conf);
+	size_t bytes = 0;
+
+	nbody_read_blocks(fd, 0, particles, MIN(chunk, num_blocks));
+	for (int first = 0; first < num_blocks; first += chunk) {
+		const int last = MIN(first + chunk, num_blocks);
+		const int count = MIN(chunk, num_blocks - last);
+		if (count > 0) {
+			#pragma oss task label("read_chunk") firstprivate(last, count)
+			nbody_read_blocks(fd, last*sizeof(particles_block_t), particles + last, count);
+		}
+		bytes += nbody_upload_particles(particles, owners, first, last, devices);
+		nbody_drop_blocks(particles, first, last);
+		#pragma oss taskwait
+	}
+
+	int err = close(fd);
+	assert(!err);
+	return bytes;
+}
+
+// Out-of-core download: each chunk is validated and appended to the .out file
+// by tasks while the next one is copied from the devices, and dropped after
+static void nbody_stream_download(const nbody_conf_t *conf, const nbody_t *nbody, const unsigned char *owners, const particles_block_t *reference, nbody_error_t *errors)
+{
+	int fd = -1;
+	char fname[1024];
+	if (conf->save_result) {
+		sprintf(fname, "%s.out", nbody->file.name);
+		fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		assert(fd >= 0);
+	}
+
+	particles_block_t *particles = nbody->particles;
+	const int num_blocks = conf->num_blocks;
+	const int chunk = nbody_chunk_blocks(conf);
+
+	for (int first = 0; first < num_blocks; first += chunk) {
+		const int last = MIN(first + chunk, num_blocks);
+		nbody_download_particles(particles, owners, first, last, NULL, NULL);
+		#pragma oss taskwait
+		if (first > 0) nbody_drop_blocks(particles, first - chunk, first);
+
+		if (reference) nbody_compare_blocks(particles, reference, first, last, errors);
+		if (fd >= 0) {
+			#pragma oss task label("write_chunk") in(particles[first;last-first]) firstprivate(first, last)
+			if (!nbody_write_all(fd, particles + first, (last - first)*sizeof(particles_block_t))) {
+				fprintf(stderr, "Cannot write %s\n", fname);
+				exit(1);
+			}
+		}
+	}
+	#pragma oss taskwait
+	nbody_drop_blocks(particles, (num_blocks - 1)/chunk*chunk, num_blocks);
+
+	if (fd >= 0) {
+		int err = close(fd);
+		assert(!err);
+	}
+}
+
+static void nbody_solve_steps(const nbody_conf_t *conf, nbody_t *nbody, int steps, nbody_block_steps_t *block_steps)
+{
+	switch (conf->solver) {
+		case NBODY_SOLVER_FPGA:
+			nbody_solve((float*)nbody->particles, (float*)nbody->forces, conf->num_blocks, steps, conf->time_interval, nbody_solve_flags(conf));
+			#pragma oss taskwait
+			break;
+		case NBODY_SOLVER_SMP:
+			if (conf->timestep_levels > 1) {
+				nbody_solve_block_steps(nbody->particles, nbody->forces, conf->num_blocks, conf->num_particles, steps, conf->time_interval,
+					conf->timestep_levels, nbody_timestep_length(conf), block_steps);
+				break;
+			}
+			nbody_solve_smp(nbody->particles, nbody->forces, conf->num_blocks, conf->num_particles, steps, conf->time_interval, nbody_solve_flags(conf));
+			break;
+		case NBODY_SOLVER_BARNES_HUT:
+			nbody_solve_bh(nbody->particles, nbody->forces, conf->num_blocks, conf->num_particles, steps, conf->time_interval, conf->theta);
+			break;
+		default:
+			nbody_solve_fmm(nbody->particles, nbody->forces, conf->num_blocks, conf->num_particles, steps, conf->time_interval, conf->fmm_order);
+			break;
+	}
+}
+
+// Next timestep with a checkpoint or a trajectory frame, or the last one
+static int nbody_next_stop(const nbody_conf_t *conf, int step)
+{
+	int next = conf->timesteps;
+	if (conf->checkpoint_interval > 0) {
+		next = MIN(next, (step/conf->checkpoint_interval + 1)*conf->checkpoint_interval);
+	}
+	if (conf->trajectory_interval > 0) {
+		next = MIN(next, (step/conf->trajectory_interval + 1)*conf->trajectory_interval);
+	}
+	return next;
+}
+
+// The simulation runs in chunks of timesteps between the checkpoints and the
+// trajectory frames. Their writer threads save each snapshot while the next
+// chunk runs. The owners are the ones of the devices, NULL on the host
+static void nbody_run(const nbody_conf_t *conf, nbody_t *nbody, const unsigned char *owners)
+{
+	nbody_checkpoint_t *ckpt = conf->checkpoint_interval > 0 ? nbody_checkpoint_create(nbody, conf) : NULL;
+	nbody_trajectory_t *traj = conf->trajectory_interval > 0 ? nbody_trajectory_create(nbody, conf) : NULL;
+	double snapshot_time = 0;
+	nbody_block_steps_t block_steps = {0};
+
+	// The initial frame of a simulation that does not restart
+	if (traj && nbody->start_step == 0) {
+		nbody_trajectory_save(traj, nbody->particles, 0);
+	}
+
+	for (int step = nbody->start_step; step < conf->timesteps; ) {
+		const int next = nbody_next_stop(conf, step);
+		nbody_solve_steps(conf, nbody, next - step, &block_steps);
+		step = next;
+
+		const int checkpoint = ckpt && step % conf->checkpoint_interval == 0 && step < conf->timesteps;
+		const int frame = traj && step % conf->trajectory_interval == 0;
+		if (!checkpoint && !frame) continue;
+
+		double snapshot_start = get_time();
+		// The snapshots need the blocks of every device on the host
+		if (owners) nbody_download_particles(nbody->particles, owners, 0, conf->num_blocks, NULL, NULL);
+		if (checkpoint) nbody_checkpoint_save(ckpt, nbody->particles, step);
+		if (frame) nbody_trajectory_save(traj, nbody->particles, step);
+		snapshot_time += get_time() - snapshot_start;
+	}
+
+	if (ckpt) nbody_checkpoint_finish(ckpt);
+	if (traj) nbody_trajectory_finish(traj);
+	if (ckpt || traj) fprintf(stderr, "Snapshots %fs\n", snapshot_time);
+
+	// Once per run, not per chunk
+	if (conf->timestep_levels > 1) {
+		fprintf(stderr, "Block timesteps: %.4g interactions, %.2f%% of the ones at the finest level, steps per level",
+			block_steps.interactions, 100.0 * block_steps.interactions / block_steps.uniform);
+		for (int l = 0; l < conf->timestep_levels; l++) {
+			fprintf(stderr, " %d", block_steps.steps[l]);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+// Every device runs an nbody_solve without timesteps, which writes the
+// configuration of its bitstream after the block owners. The host has to be
+// built with the same one, or the blocks would not match the accelerators
+static int nbody_check_bitstream(const nbody_conf_t *conf, nbody_t *nbody, int devices)
+{
+	static const char *fields[NBODY_CONFIG_FIELDS] = {
+		"tag", "block size", "NCALCFORCES", "memory port width", "maximum number of blocks", "number of force accelerators", "precision"
+	};
+	const unsigned int expected[NBODY_CONFIG_FIELDS] = {
+		NBODY_CONFIG_TAG, BLOCK_SIZE, NBODY_NCALCFORCES, FPGA_MEMORY_PORT_WIDTH, NBODY_MAX_BLOCKS, NBODY_NUM_FBLOCK_ACCS, NBODY_PRECISION
+	};
+	const size_t offset = BLOCK_CONFIG_OFFSET(conf->num_blocks);
+	const unsigned int *config = (const unsigned int *)((const char *)nbody->forces + offset);
+
+	nbody_solve((float*)nbody->particles, (float*)nbody->forces, conf->num_blocks, 0, conf->time_interval, 0);
+	#pragma oss taskwait
+
+	int ok = 1;
+	for (int d = 0; d < devices; d++) {
+		nanos6_dist_memcpy_from_device(d, nbody->forces, NBODY_CONFIG_RECORD_SIZE, offset, offset);
+		if (config[0] != NBODY_CONFIG_TAG) {
+			fprintf(stderr, "The bitstream of device %d does not report its configuration\n", d);
+			ok = 0;
+			continue;
+		}
+		for (int f = 1; f < NBODY_CONFIG_FIELDS; f++) {
+			if (config[f] != expected[f]) {
+				fprintf(stderr, "The %s of the bitstream of device %d is %u, and the host was built with %u\n", fields[f], d, config[f], expected[f]);
+				ok = 0;
+			}
+		}
+	}
+	return ok;
+}
+
 int main(int argc, char** argv)
 {
 	int ok;
@@ -23,57 +273,122 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	int devices = nanos6_dist_num_devices();
-	if (devices <= 0) {
-		fprintf(stderr, "Invalid number of devices %d\n", devices);
-		return 1;
+	int devices = 1;
+	if (conf.solver == NBODY_SOLVER_FPGA) {
+		devices = nanos6_dist_num_devices();
+		if (devices <= 0) {
+			fprintf(stderr, "Invalid number of devices %d\n", devices);
+			return 1;
+		}
 	}
-	if (conf.num_particles%(BLOCK_SIZE*devices) != 0) {
-		fprintf(stderr, "Number of particles not multiple of block size and number of devices\n");
-		return 1;
+	if (conf.solver == NBODY_SOLVER_FPGA) {
+		if (devices > NBODY_MAX_RANKS || conf.num_weights > devices) {
+			fprintf(stderr, "%d weights given for %d devices, at most %d\n", conf.num_weights, devices, NBODY_MAX_RANKS);
+			return 1;
+		}
+		if ((conf.num_particles + BLOCK_SIZE - 1)/BLOCK_SIZE > NBODY_MAX_BLOCKS) {
+			fprintf(stderr, "Number of blocks larger than the %d of the accelerators\n", NBODY_MAX_BLOCKS);
+			return 1;
+		}
 	}
 
-	assert(conf.num_particles >= BLOCK_SIZE);
+	assert(conf.num_particles > 0);
 	assert(conf.timesteps > 0);
 	
-	conf.num_blocks = conf.num_particles / BLOCK_SIZE;
+	// The last block is padded when the particles do not fill it
+	conf.num_blocks = (conf.num_particles + BLOCK_SIZE - 1) / BLOCK_SIZE;
 	assert(conf.num_blocks > 0);
 	
+	nbody_timing_t timing = {0};
+	double setup_start = get_time();
 	nbody_t nbody = nbody_setup(&conf);
+	timing.setup = get_time() - setup_start;
 	
 	particles_block_t *particles = nbody.particles;
 	forces_block_t *forces = nbody.forces;
 
+	if (conf.solver != NBODY_SOLVER_FPGA) {
+		double start = get_time();
+		nbody_run(&conf, &nbody, NULL);
+		double end = get_time();
+		timing.solve = end - start;
+
+		nbody_stats(&nbody, &conf, &timing);
+
+		if (conf.save_result && !conf.force_generation) nbody_save_particles(&nbody);
+		if (conf.check_result) nbody_check(&nbody, &conf);
+		nbody_free(&nbody);
+		return 0;
+	}
+
 	nanos6_dist_map_address(particles, sizeof(particles_block_t)*conf.num_blocks);
-	nanos6_dist_map_address(forces, sizeof(forces_block_t)*conf.num_blocks);
+	nanos6_dist_map_address(forces, FORCES_ALLOC_SIZE(conf.num_blocks));
+
+	// Every device reads the owner of each block from the end of the forces
+	int weights[NBODY_MAX_RANKS];
+	nbody_device_weights(&conf, devices, weights);
+	unsigned char *owners = (unsigned char *)forces + BLOCK_OWNERS_OFFSET(conf.num_blocks);
+	nbody_block_owners(conf.num_blocks, devices, weights, conf.distribution, owners);
 
 	double copy_start = get_time();
-	int blocks_per_dev = conf.num_blocks/devices;
-	nanos6_dist_memcpy_to_all(particles, sizeof(particles_block_t)*conf.num_blocks, 0, 0);
-	nanos6_dist_memcpy_to_all(forces, sizeof(forces_block_t)*conf.num_blocks, 0, 0);
+	if (conf.out_of_core) {
+		timing.upload_bytes = nbody_stream_upload(&conf, &nbody, owners, devices);
+	} else {
+		timing.upload_bytes = nbody_upload_particles(particles, owners, 0, conf.num_blocks, devices);
+	}
+	nanos6_dist_memcpy_to_all(forces, BLOCK_OWNERS_SIZE(conf.num_blocks), BLOCK_OWNERS_OFFSET(conf.num_blocks), BLOCK_OWNERS_OFFSET(conf.num_blocks));
 	double copy_end = get_time();
 	double copy_time = copy_end-copy_start;
-	double bandwidth = ((sizeof(particles_block_t)*conf.num_blocks+sizeof(forces_block_t)*conf.num_blocks)*devices)/copy_time;
+	timing.upload = copy_time;
+	timing.upload_bytes += BLOCK_OWNERS_SIZE(conf.num_blocks)*devices;
+	double bandwidth = timing.upload_bytes/copy_time;
 	fprintf(stderr, "Copy time %fs bandwidth %.2fMB/s\n", copy_time, bandwidth/1024/1024);
 
+	if (!nbody_check_bitstream(&conf, &nbody, devices)) {
+		return 1;
+	}
+
 	double start = get_time();
-	nbody_solve((float*)particles, (float*)forces, conf.num_blocks, conf.timesteps, conf.time_interval);
-	#pragma oss taskwait
+	nbody_run(&conf, &nbody, owners);
 	double end = get_time();
+	timing.solve = end - start;
 
+	const particles_block_t *reference = NULL;
+	nbody_error_t *errors = NULL;
+	int computed = 0;
 	if (conf.check_result) {
-		for (int i = 0; i < devices; ++i) {
-			nanos6_dist_memcpy_from_device(i, particles, sizeof(particles_block_t)*blocks_per_dev, sizeof(particles_block_t)*blocks_per_dev*i, sizeof(particles_block_t)*blocks_per_dev*i);
+		reference = nbody_open_reference(&nbody, &conf, &computed);
+		errors = malloc(conf.num_blocks * sizeof(nbody_error_t));
+		assert(errors != NULL);
+	}
+	if (conf.check_result || (conf.out_of_core && conf.save_result)) {
+		double download_start = get_time();
+		if (conf.out_of_core) {
+			nbody_stream_download(&conf, &nbody, owners, reference, errors);
+		} else {
+			nbody_download_particles(particles, owners, 0, conf.num_blocks, reference, errors);
 		}
+		timing.download = get_time() - download_start;
+		timing.download_bytes = sizeof(particles_block_t)*conf.num_blocks;
+		#pragma oss taskwait
 	}
 
 	nanos6_dist_unmap_address(particles);
 	nanos6_dist_unmap_address(forces);
 	
-	nbody_stats(&nbody, &conf, end - start);
+	nbody_stats(&nbody, &conf, &timing);
 	
-	if (conf.save_result && !conf.force_generation) nbody_save_particles(&nbody);
-	if (conf.check_result) nbody_check(&nbody);
+	// The out-of-core download already saved the chunks
+	if (conf.save_result && !conf.force_generation && !conf.out_of_core) nbody_save_particles(&nbody);
+	if (reference) {
+		if (nbody_compare_result(conf.out_of_core ? NULL : particles, reference, errors, conf.num_blocks, conf.check_ulp, computed)) {
+			printf("Result validation: OK\n");
+		} else {
+			printf("Result validation: ERROR\n");
+		}
+		free(errors);
+		nbody_close_reference(&nbody, reference);
+	}
 	nbody_free(&nbody);
 	return 0;
 }
@@ -9,14 +9,16 @@
 #define NBODY_H
 
 #include "common.h"
+#include "nbody_config.h"
 
 #include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-// Block size definition
+// Block size definition, the one of the accelerators unless the host is
+// built with another one for the SMP solvers
 #ifndef BLOCK_SIZE
-#define BLOCK_SIZE 2048
+#define BLOCK_SIZE NBODY_BLOCK_SIZE
 #endif
 
 #define MIN_PARTICLES (4096 * BLOCK_SIZE / sizeof(particles_block_t))
@@ -28,18 +30,24 @@ enum {
     BLOCK_SIZE_C = BLOCK_SIZE
 };
 
-static const unsigned int PARTICLES_FPGABLOCK_POS_X_OFFSET  = 0*BLOCK_SIZE;
-static const unsigned int PARTICLES_FPGABLOCK_POS_Y_OFFSET  = 1*BLOCK_SIZE;
-static const unsigned int PARTICLES_FPGABLOCK_POS_Z_OFFSET  = 2*BLOCK_SIZE;
-static const unsigned int PARTICLES_FPGABLOCK_VEL_X_OFFSET  = 3*BLOCK_SIZE;
-static const unsigned int PARTICLES_FPGABLOCK_VEL_Y_OFFSET  = 4*BLOCK_SIZE;
-static const unsigned int PARTICLES_FPGABLOCK_VEL_Z_OFFSET  = 5*BLOCK_SIZE;
-static const unsigned int PARTICLES_FPGABLOCK_MASS_OFFSET   = 6*BLOCK_SIZE;
-static const unsigned int PARTICLES_FPGABLOCK_WEIGHT_OFFSET = 7*BLOCK_SIZE;
+// Hot fields first: the force tasks read the target block from the mass to
+// the z positions and the source block from the x positions to the weights,
+// one burst each, and the velocities are only read by the updates
+static const unsigned int PARTICLES_FPGABLOCK_MASS_OFFSET   = 0*BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_X_OFFSET  = 1*BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_Y_OFFSET  = 2*BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_POS_Z_OFFSET  = 3*BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_WEIGHT_OFFSET = 4*BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_X_OFFSET  = 5*BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_Y_OFFSET  = 6*BLOCK_SIZE;
+static const unsigned int PARTICLES_FPGABLOCK_VEL_Z_OFFSET  = 7*BLOCK_SIZE;
 
 enum {
     PARTICLES_FPGABLOCK_SIZE = 8*BLOCK_SIZE,
-    FORCE_FPGABLOCK_SIZE     = 3*BLOCK_SIZE
+    PARTICLES_FPGABLOCK_HOT_SIZE = 4*BLOCK_SIZE,
+    FORCE_FPGABLOCK_SIZE     = 3*BLOCK_SIZE,
+    // Origin and scale of each axis, padded to 64 bytes, and two 16-bit positions per word
+    PACKED_FPGABLOCK_SIZE    = 16 + 3*BLOCK_SIZE/2
 };
 
 static const unsigned int FORCE_FPGABLOCK_X_OFFSET = 0*BLOCK_SIZE;
@@ -48,38 +56,145 @@ static const unsigned int FORCE_FPGABLOCK_Z_OFFSET = 2*BLOCK_SIZE;
 
 // Solver structures
 typedef struct {
+	float mass[BLOCK_SIZE];       /* kg  */
 	float position_x[BLOCK_SIZE]; /* m   */
 	float position_y[BLOCK_SIZE]; /* m   */
 	float position_z[BLOCK_SIZE]; /* m   */
+	float weight[BLOCK_SIZE];
 	float velocity_x[BLOCK_SIZE]; /* m/s */
 	float velocity_y[BLOCK_SIZE]; /* m/s */
 	float velocity_z[BLOCK_SIZE]; /* m/s */
-	float mass[BLOCK_SIZE];       /* kg  */
-	float weight[BLOCK_SIZE];
 } particles_block_t;
 
+// Tag of the field order in the names of the data files, since the files
+// are raw particle blocks
+#define PARTICLES_LAYOUT_NAME "hot"
+
 typedef struct {
 	float x[BLOCK_SIZE]; /* x   */
 	float y[BLOCK_SIZE]; /* y   */
 	float z[BLOCK_SIZE]; /* z   */
 } forces_block_t;
 
+// The packed positions of the compressed exchange follow the force blocks,
+// then the owner rank of each block, padded to 64 bytes, and the
+// configuration record of the bitstream
+#define BLOCK_OWNERS_OFFSET(num_blocks) ((num_blocks) * (sizeof(forces_block_t) + PACKED_FPGABLOCK_SIZE*sizeof(float)))
+#define BLOCK_OWNERS_SIZE(num_blocks) ((((num_blocks) + 63) / 64) * 64)
+#define BLOCK_CONFIG_OFFSET(num_blocks) (BLOCK_OWNERS_OFFSET(num_blocks) + BLOCK_OWNERS_SIZE(num_blocks))
+#define FORCES_ALLOC_SIZE(num_blocks) (BLOCK_CONFIG_OFFSET(num_blocks) + NBODY_CONFIG_RECORD_SIZE)
+
+// Particles of block b. Only the last block can be partial, and its tail is
+// padding with no mass or weight at the position of its first particle, so
+// the accelerators that process whole blocks get no force from it
+static inline int nbody_block_particles(const int num_particles, const int b)
+{
+	return MIN(BLOCK_SIZE, num_particles - b*BLOCK_SIZE);
+}
+
 // Forward declaration
 typedef struct nbody_file_t nbody_file_t;
 typedef struct nbody_t nbody_t;
+typedef struct nbody_checkpoint_t nbody_checkpoint_t;
+typedef struct nbody_trajectory_t nbody_trajectory_t;
+
+// Solver flags
+enum {
+	NBODY_SOLVE_SYMMETRIC = 0x1, // Visit each pair of blocks once (Newton's third law)
+	NBODY_SOLVE_FUSED     = 0x2, // Update the particles in the last force task of each block
+	NBODY_SOLVE_STATIONARY = 0x4, // One force task per block over all the source blocks
+	NBODY_SOLVE_RING      = 0x8, // Forward the updated positions along a ring of ranks
+	NBODY_SOLVE_COMPRESS  = 0x10 // Exchange the positions packed as 16-bit block offsets
+};
 
 // Solver function
 #pragma oss task device(smp) inout([PARTICLES_FPGABLOCK_SIZE*num_blocks]particles, [FORCE_FPGABLOCK_SIZE*num_blocks]forces)
-void nbody_solve(float *particles, float *forces, const int num_blocks, const int timesteps, const float time_interval);
+void nbody_solve(float *particles, float *forces, const int num_blocks, const int timesteps, const float time_interval, const int flags);
+
+// Multithreaded SIMD solver for the host CPUs
+void nbody_solve_smp(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles, const int timesteps, const float time_interval, const int flags);
+int nbody_solve_flags(const nbody_conf_t *conf);
+// Work of the block timesteps, accumulated over the calls of a run
+typedef struct {
+	double interactions;
+	double uniform;                          // interactions at the finest level
+	int steps[NBODY_MAX_TIMESTEP_LEVELS];    // block steps taken at each level
+} nbody_block_steps_t;
+
+// Power-of-two timesteps per block, up to 2^(levels-1) substeps per timestep,
+// from the acceleration of each block against the accuracy length
+void nbody_solve_block_steps(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles,
+	const int timesteps, const float time_interval, const int levels, const float length, nbody_block_steps_t *work);
+float nbody_timestep_length(const nbody_conf_t *conf);
+
+// Barnes-Hut tree code solver for the host CPUs
+void nbody_solve_bh(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles, const int timesteps, const float time_interval, const float theta);
+
+// Fast multipole method solver for the host CPUs
+void nbody_solve_fmm(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles, const int timesteps, const float time_interval, const int order);
+
+// SMP kernels shared by the host solvers
+void nbody_smp_init();
+void calculate_forces_kernel_smp(float *fx, float *fy, float *fz,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2);
+void update_particles_smp(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles, const float time_interval);
+
+// Wall clock time of each phase of a run, in seconds
+typedef struct {
+	double setup;          // generation or loading of the particles
+	double upload;         // copy of the blocks to the devices
+	double solve;          // simulation
+	double download;       // copy of the particles back from the devices
+	size_t upload_bytes;
+	size_t download_bytes;
+} nbody_timing_t;
+
+// Error of the positions of a block against the reference
+typedef struct {
+	int mismatches;        // particles with a different position
+	double relative_sum;   // relative error of the axes, in %
+	float relative_min;    // of the particles that differ
+	float relative_max;
+	double ulp_sum;        // largest distance of the axes, in units in the last place
+	long long ulp_max;
+} nbody_error_t;
 
 // Auxiliary functions
 nbody_t nbody_setup(const nbody_conf_t *conf);
-void nbody_particle_init(const nbody_conf_t *conf, particles_block_t *part);
-void nbody_stats(const nbody_t *nbody, const nbody_conf_t *conf, double time);
+void nbody_particle_init(const nbody_conf_t *conf, particles_block_t *part, const int block, const int count);
+// Every block in a task, the same particles with any number of threads
+void nbody_generate_blocks(const nbody_conf_t *conf, particles_block_t *particles);
+void nbody_stats(const nbody_t *nbody, const nbody_conf_t *conf, const nbody_timing_t *timing);
 void nbody_save_particles(const nbody_t *nbody);
+void nbody_read_blocks(int fd, off_t offset, particles_block_t *particles, int num_blocks);
 void nbody_free(nbody_t *nbody);
-void nbody_check(const nbody_t *nbody);
-int nbody_compare_particles(const particles_block_t *local, const particles_block_t *reference, int num_blocks);
+void nbody_check(const nbody_t *nbody, const nbody_conf_t *conf);
+// The .ref file of the run, or else the cached fp64 reference of the configuration
+const particles_block_t * nbody_open_reference(const nbody_t *nbody, const nbody_conf_t *conf, int *computed);
+void nbody_reference_solve(const nbody_conf_t *conf, particles_block_t *particles);
+void nbody_close_reference(const nbody_t *nbody, const particles_block_t *reference);
+// One task per block, the errors are ready after a taskwait
+void nbody_compare_blocks(const particles_block_t *local, const particles_block_t *reference, int first, int last, nbody_error_t *errors);
+// Passes with at most max_ulp, or with the relative error when it is negative.
+// A computed reference is fp64, so the number of particles that differ is not used.
+// The mismatches are not printed without the local particles
+int nbody_compare_result(const particles_block_t *local, const particles_block_t *reference, const nbody_error_t *errors, int num_blocks, int max_ulp, int computed);
+int nbody_compare_particles(const particles_block_t *local, const particles_block_t *reference, int num_blocks, int max_ulp, int computed);
+int nbody_write_all(int fd, const void *buffer, size_t size);
+
+// Periodic checkpoints, written by a background thread from a snapshot of
+// the particles, and the restart from one of them
+nbody_checkpoint_t * nbody_checkpoint_create(const nbody_t *nbody, const nbody_conf_t *conf);
+void nbody_checkpoint_save(nbody_checkpoint_t *ckpt, const particles_block_t *particles, int step);
+void nbody_checkpoint_finish(nbody_checkpoint_t *ckpt);
+int nbody_checkpoint_load(const nbody_conf_t *conf, particles_block_t *particles);
+
+// Trajectory file with a frame of the particles every few timesteps, packed
+// into two snapshots in turn and appended by a background thread
+nbody_trajectory_t * nbody_trajectory_create(const nbody_t *nbody, const nbody_conf_t *conf);
+void nbody_trajectory_save(nbody_trajectory_t *traj, const particles_block_t *particles, int step);
+void nbody_trajectory_finish(nbody_trajectory_t *traj);
 
 // Application structures
 struct nbody_file_t {
@@ -91,7 +206,9 @@ struct nbody_t {
         particles_block_t *particles;
         forces_block_t *forces;
         int num_blocks;
-        int timesteps;
+        int num_particles;
+        int timesteps;       // simulated by this run
+        int start_step;      // of the checkpoint of a restart
         nbody_file_t file;
 };
 
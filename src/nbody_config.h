@@ -0,0 +1,88 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+#ifndef NBODY_CONFIG_H
+#define NBODY_CONFIG_H
+
+// Block configuration shared by the host code and the accelerators in hls/.
+// The Makefile passes the variables of the same name, to the hls code through
+// the generated hls/nbody_build_config.h, and scripts/autotune.sh suggests
+// values for a given problem.
+
+// Particles of a block, also the size of the accelerator internal memories
+#ifndef NBODY_BLOCK_SIZE
+#define NBODY_BLOCK_SIZE 2048
+#endif
+
+// Forces computed per cycle by the force accelerators
+#ifndef NBODY_NCALCFORCES
+#define NBODY_NCALCFORCES 16
+#endif
+
+// Bit-width of the memory port of the accelerators
+#ifndef FPGA_MEMORY_PORT_WIDTH
+#define FPGA_MEMORY_PORT_WIDTH 128
+#endif
+
+// Blocks of a simulation, the size of the owner table of nbody_solve
+#ifndef NBODY_MAX_BLOCKS
+#define NBODY_MAX_BLOCKS 4096
+#endif
+
+// Instances of the force accelerator
+#ifndef NBODY_NUM_FBLOCK_ACCS
+#define NBODY_NUM_FBLOCK_ACCS 1
+#endif
+
+// Precision of the force kernel of calc_forces (hls/calc_forces_kernel.h).
+// The symmetric, fused and output stationary accelerators are fp32 only
+#define NBODY_PRECISION_FLOAT 0 // fp32 arithmetic and accumulation
+#define NBODY_PRECISION_MIXED 1 // fp32 arithmetic, fp64 accumulation
+#define NBODY_PRECISION_HALF  2 // fp16 differences of normalized positions
+#define NBODY_PRECISION_FIXED 3 // ap_fixed differences of normalized positions
+
+#ifndef NBODY_PRECISION
+#define NBODY_PRECISION NBODY_PRECISION_FLOAT
+#endif
+
+// Record of the configuration that nbody_solve writes to the memory of its
+// device after the block owners, so the host can check the bitstream. The
+// fields are 32-bit, in the order of NBODY_CONFIG_RECORD
+#define NBODY_CONFIG_TAG 0x4e424459 // "NBDY", so stale memory does not match
+#define NBODY_CONFIG_FIELDS 7
+#define NBODY_CONFIG_RECORD_SIZE 64
+#define NBODY_CONFIG_RECORD { NBODY_CONFIG_TAG, NBODY_BLOCK_SIZE, NBODY_NCALCFORCES, FPGA_MEMORY_PORT_WIDTH, \
+	NBODY_MAX_BLOCKS, NBODY_NUM_FBLOCK_ACCS, NBODY_PRECISION }
+
+#if NBODY_BLOCK_SIZE <= 0 || (NBODY_BLOCK_SIZE & (NBODY_BLOCK_SIZE - 1)) != 0
+#error "NBODY_BLOCK_SIZE must be a power of two"
+#endif
+
+// The target arrays are partitioned by NCALCFORCES/2
+#if NBODY_NCALCFORCES < 2 || (NBODY_NCALCFORCES & (NBODY_NCALCFORCES - 1)) != 0
+#error "NBODY_NCALCFORCES must be a power of two, at least 2"
+#endif
+
+#if NBODY_PRECISION < NBODY_PRECISION_FLOAT || NBODY_PRECISION > NBODY_PRECISION_FIXED
+#error "NBODY_PRECISION must be NBODY_PRECISION_FLOAT, _MIXED, _HALF or _FIXED"
+#endif
+
+#if NBODY_NCALCFORCES > NBODY_BLOCK_SIZE
+#error "NBODY_NCALCFORCES cannot be larger than NBODY_BLOCK_SIZE"
+#endif
+
+// Every array of a block starts at a memory word. The packed positions are
+// 16 words of header and half a block per axis
+#if FPGA_MEMORY_PORT_WIDTH < 64 || FPGA_MEMORY_PORT_WIDTH > 512 || (FPGA_MEMORY_PORT_WIDTH & (FPGA_MEMORY_PORT_WIDTH - 1)) != 0
+#error "FPGA_MEMORY_PORT_WIDTH must be a power of two between 64 and 512"
+#endif
+
+#if NBODY_BLOCK_SIZE * 16 % FPGA_MEMORY_PORT_WIDTH != 0
+#error "half a block of floats must be a whole number of memory words"
+#endif
+
+#endif // NBODY_CONFIG_H
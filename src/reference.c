@@ -0,0 +1,122 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+#include "nbody.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Targets of a force or update task of the reference
+#define REFERENCE_CHUNK 256
+
+typedef struct {
+	double *x, *y, *z;
+	double *vx, *vy, *vz;
+	double *mass, *weight;
+	double *fx, *fy, *fz;
+} nbody_reference_t;
+
+static void nbody_reference_forces(const nbody_reference_t *ref, const int first, const int last, const int num_particles)
+{
+	for (int j = first; j < last; j++) {
+		double ax = 0.0, ay = 0.0, az = 0.0;
+		for (int i = 0; i < num_particles; i++) {
+			const double diff_x = ref->x[i] - ref->x[j];
+			const double diff_y = ref->y[i] - ref->y[j];
+			const double diff_z = ref->z[i] - ref->z[j];
+			const double distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+			if (distance_squared == 0.0) continue;
+			const double inv_distance = 1.0 / sqrt(distance_squared);
+			const double s = ref->weight[i] * inv_distance * inv_distance * inv_distance;
+			ax += s * diff_x;
+			ay += s * diff_y;
+			az += s * diff_z;
+		}
+		ref->fx[j] = ref->mass[j] * ax;
+		ref->fy[j] = ref->mass[j] * ay;
+		ref->fz[j] = ref->mass[j] * az;
+	}
+}
+
+static void nbody_reference_update(const nbody_reference_t *ref, const int first, const int last, const double time_interval)
+{
+	const double half_time_interval = 0.5 * time_interval;
+	for (int e = first; e < last; e++) {
+		const double time_by_mass = ref->mass[e] == 0.0 ? 0.0 : time_interval / ref->mass[e];
+
+		const double velocity_change_x = ref->fx[e] * time_by_mass;
+		const double velocity_change_y = ref->fy[e] * time_by_mass;
+		const double velocity_change_z = ref->fz[e] * time_by_mass;
+
+		ref->x[e] += ref->vx[e] * time_interval + velocity_change_x * half_time_interval;
+		ref->y[e] += ref->vy[e] * time_interval + velocity_change_y * half_time_interval;
+		ref->z[e] += ref->vz[e] * time_interval + velocity_change_z * half_time_interval;
+
+		ref->vx[e] += velocity_change_x;
+		ref->vy[e] += velocity_change_y;
+		ref->vz[e] += velocity_change_z;
+	}
+}
+
+// Direct sum over all the pairs in fp64, with the same update as the solvers.
+// The forces of a step are computed in tasks of targets from the positions of
+// the previous step, and the padding of the last block is left as it is
+void nbody_reference_solve(const nbody_conf_t *conf, particles_block_t *particles)
+{
+	const int n = conf->num_particles;
+	double *arrays = malloc(11 * n * sizeof(double));
+	assert(arrays != NULL);
+
+	nbody_reference_t ref;
+	double **fields[] = {&ref.x, &ref.y, &ref.z, &ref.vx, &ref.vy, &ref.vz, &ref.mass, &ref.weight, &ref.fx, &ref.fy, &ref.fz};
+	for (int f = 0; f < 11; f++) {
+		*fields[f] = arrays + f * n;
+	}
+
+	for (int p = 0; p < n; p++) {
+		const particles_block_t *block = particles + p / BLOCK_SIZE;
+		const int e = p % BLOCK_SIZE;
+		ref.x[p] = block->position_x[e];
+		ref.y[p] = block->position_y[e];
+		ref.z[p] = block->position_z[e];
+		ref.vx[p] = block->velocity_x[e];
+		ref.vy[p] = block->velocity_y[e];
+		ref.vz[p] = block->velocity_z[e];
+		ref.mass[p] = block->mass[e];
+		ref.weight[p] = (double)gravitational_constant * block->mass[e];
+	}
+
+	for (int t = 0; t < conf->timesteps; t++) {
+		for (int first = 0; first < n; first += REFERENCE_CHUNK) {
+			const int last = MIN(first + REFERENCE_CHUNK, n);
+			#pragma oss task label("reference_forces") firstprivate(first, last)
+			nbody_reference_forces(&ref, first, last, n);
+		}
+		#pragma oss taskwait
+
+		for (int first = 0; first < n; first += REFERENCE_CHUNK) {
+			const int last = MIN(first + REFERENCE_CHUNK, n);
+			#pragma oss task label("reference_update") firstprivate(first, last)
+			nbody_reference_update(&ref, first, last, conf->time_interval);
+		}
+		#pragma oss taskwait
+	}
+
+	for (int p = 0; p < n; p++) {
+		particles_block_t *block = particles + p / BLOCK_SIZE;
+		const int e = p % BLOCK_SIZE;
+		block->position_x[e] = ref.x[p];
+		block->position_y[e] = ref.y[p];
+		block->position_z[e] = ref.z[p];
+		block->velocity_x[e] = ref.vx[p];
+		block->velocity_y[e] = ref.vy[p];
+		block->velocity_z[e] = ref.vz[p];
+	}
+
+	free(arrays);
+}
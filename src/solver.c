@@ -19,32 +19,57 @@
 
 #pragma oss task label("calculate_forces_block") \
 	device(fpga) num_instances(FBLOCK_NUM_ACCS) \
-	copy_inout([BLOCK_SIZE_C]x, [BLOCK_SIZE_C]y, [BLOCK_SIZE_C]z) \
-	copy_in([BLOCK_SIZE_C]pos_x1, [BLOCK_SIZE_C]pos_y1, [BLOCK_SIZE_C]pos_z1, [BLOCK_SIZE_C]mass1) \
-	copy_in([BLOCK_SIZE_C]pos_x2, [BLOCK_SIZE_C]pos_y2, [BLOCK_SIZE_C]pos_z2, [BLOCK_SIZE_C]weight2) \
-	inout(x[0]) in(pos_x1[0], pos_x2[0])
-void calculate_forces_block(float *x, float *y, float *z,
-	const float *pos_x1, const float *pos_y1, const float *pos_z1, const float *mass1,
-	const float *pos_x2, const float *pos_y2, const float *pos_z2, const float *weight2)
+	copy_inout([FORCE_FPGABLOCK_SIZE]forces) \
+	copy_in(block1[PARTICLES_FPGABLOCK_MASS_OFFSET;PARTICLES_FPGABLOCK_HOT_SIZE]) \
+	copy_in(block2[PARTICLES_FPGABLOCK_POS_X_OFFSET;PARTICLES_FPGABLOCK_HOT_SIZE]) \
+	inout(forces[0]) in(block1[0], block2[0])
+void calculate_forces_block(float *forces, const float *block1, const float *block2, const int step)
 {
 	#pragma HLS inline
+	//NOTE: The accelerator keeps the last particle blocks it read and only
+	//      copies them in again when the address or the step changes
+	//NOTE: Each copy is a single burst, the mass and positions of the target
+	//      block and the positions and weights of the source block
 	//NOTE: Partition in a way that we can read/write enough data each cycle
-	#pragma HLS array_partition variable=x cyclic factor=NCALCFORCES
-	#pragma HLS array_partition variable=y cyclic factor=NCALCFORCES
-	#pragma HLS array_partition variable=z cyclic factor=NCALCFORCES
-	#pragma HLS array_partition variable=pos_x1 cyclic factor=NCALCFORCES/2
-	#pragma HLS array_partition variable=pos_y1 cyclic factor=NCALCFORCES/2
-	#pragma HLS array_partition variable=pos_z1 cyclic factor=NCALCFORCES/2
-	#pragma HLS array_partition variable=mass1  cyclic factor=NCALCFORCES/2
-	#pragma HLS array_partition variable=pos_x2 cyclic factor=FPGA_PWIDTH/64
-	#pragma HLS array_partition variable=pos_y2 cyclic factor=FPGA_PWIDTH/64
-	#pragma HLS array_partition variable=pos_z2 cyclic factor=FPGA_PWIDTH/64
-	#pragma HLS array_partition variable=weight2  cyclic factor=FPGA_PWIDTH/64
+	#pragma HLS array_partition variable=forces cyclic factor=NCALCFORCES
+	#pragma HLS array_partition variable=block1 cyclic factor=NCALCFORCES/2
+	#pragma HLS array_partition variable=block2 cyclic factor=FPGA_PWIDTH/64
+	//NOTE: The step only tags the cached blocks in the wrapper, the
+	//      computation itself does not depend on it
+	(void)step;
 
 	for (int i = 0; i < BLOCK_SIZE; i++) {
 		for (int j = 0; j < BLOCK_SIZE; j++) {
 		#pragma HLS pipeline II=1
 		#pragma HLS unroll factor=NCALCFORCES
+			const float diff_x = block2[PARTICLES_FPGABLOCK_POS_X_OFFSET + i] - block1[PARTICLES_FPGABLOCK_POS_X_OFFSET + j];
+			const float diff_y = block2[PARTICLES_FPGABLOCK_POS_Y_OFFSET + i] - block1[PARTICLES_FPGABLOCK_POS_Y_OFFSET + j];
+			const float diff_z = block2[PARTICLES_FPGABLOCK_POS_Z_OFFSET + i] - block1[PARTICLES_FPGABLOCK_POS_Z_OFFSET + j];
+			const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+			const float distance = sqrtf(distance_squared);
+			const float force = block1[PARTICLES_FPGABLOCK_MASS_OFFSET + j] / (distance_squared * distance) * block2[PARTICLES_FPGABLOCK_WEIGHT_OFFSET + i];
+			const float force_corrected = distance_squared == 0 ? 0 : force;
+			forces[FORCE_FPGABLOCK_X_OFFSET + j] += force_corrected * diff_x;
+			forces[FORCE_FPGABLOCK_Y_OFFSET + j] += force_corrected * diff_y;
+			forces[FORCE_FPGABLOCK_Z_OFFSET + j] += force_corrected * diff_z;
+		}
+	}
+}
+
+#pragma oss task label("calculate_forces_block_sym") \
+	device(fpga) \
+	copy_inout([BLOCK_SIZE_C]x1, [BLOCK_SIZE_C]y1, [BLOCK_SIZE_C]z1) \
+	copy_inout([BLOCK_SIZE_C]x2, [BLOCK_SIZE_C]y2, [BLOCK_SIZE_C]z2) \
+	copy_in([BLOCK_SIZE_C]pos_x1, [BLOCK_SIZE_C]pos_y1, [BLOCK_SIZE_C]pos_z1, [BLOCK_SIZE_C]mass1) \
+	copy_in([BLOCK_SIZE_C]pos_x2, [BLOCK_SIZE_C]pos_y2, [BLOCK_SIZE_C]pos_z2, [BLOCK_SIZE_C]weight2) \
+	inout(x1[0], x2[0]) in(pos_x1[0], pos_x2[0])
+void calculate_forces_block_sym(float *x1, float *y1, float *z1, float *x2, float *y2, float *z2,
+	const float *pos_x1, const float *pos_y1, const float *pos_z1, const float *mass1,
+	const float *pos_x2, const float *pos_y2, const float *pos_z2, const float *weight2)
+{
+	#pragma HLS inline
+	for (int i = 0; i < BLOCK_SIZE; i++) {
+		for (int j = 0; j < BLOCK_SIZE; j++) {
 			const float diff_x = pos_x2[i] - pos_x1[j];
 			const float diff_y = pos_y2[i] - pos_y1[j];
 			const float diff_z = pos_z2[i] - pos_z1[j];
@@ -52,11 +77,103 @@ void calculate_forces_block(float *x, float *y, float *z,
 			const float distance = sqrtf(distance_squared);
 			const float force = mass1[j] / (distance_squared * distance) * weight2[i];
 			const float force_corrected = distance_squared == 0 ? 0 : force;
+			x1[j] += force_corrected * diff_x;
+			y1[j] += force_corrected * diff_y;
+			z1[j] += force_corrected * diff_z;
+			x2[i] -= force_corrected * diff_x;
+			y2[i] -= force_corrected * diff_y;
+			z2[i] -= force_corrected * diff_z;
+		}
+	}
+}
+
+// Forces of a block over all the source blocks. The force block stays in
+// the accelerator while the source blocks stream through, and it is written
+// back once, so it does not need to be cleared between steps.
+#pragma oss task label("calculate_forces_block_stationary") \
+	device(fpga) \
+	copy_out([BLOCK_SIZE_C]x, [BLOCK_SIZE_C]y, [BLOCK_SIZE_C]z) \
+	copy_in([BLOCK_SIZE_C]pos_x1, [BLOCK_SIZE_C]pos_y1, [BLOCK_SIZE_C]pos_z1, [BLOCK_SIZE_C]mass1) \
+	out(x[0]) in(pos_x1[0])
+void calculate_forces_block_stationary(float *x, float *y, float *z,
+	const float *pos_x1, const float *pos_y1, const float *pos_z1, const float *mass1,
+	const float *particles, const int num_blocks)
+{
+	#pragma HLS inline
+	for (int j = 0; j < BLOCK_SIZE; j++) {
+		x[j] = 0.0f;
+		y[j] = 0.0f;
+		z[j] = 0.0f;
+	}
+
+	for (int b = 0; b < num_blocks; b++) {
+		const float *block2 = particles + b*PARTICLES_FPGABLOCK_SIZE;
+		for (int i = 0; i < BLOCK_SIZE; i++) {
+			for (int j = 0; j < BLOCK_SIZE; j++) {
+				const float diff_x = block2[PARTICLES_FPGABLOCK_POS_X_OFFSET + i] - pos_x1[j];
+				const float diff_y = block2[PARTICLES_FPGABLOCK_POS_Y_OFFSET + i] - pos_y1[j];
+				const float diff_z = block2[PARTICLES_FPGABLOCK_POS_Z_OFFSET + i] - pos_z1[j];
+				const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+				const float distance = sqrtf(distance_squared);
+				const float force = mass1[j] / (distance_squared * distance) * block2[PARTICLES_FPGABLOCK_WEIGHT_OFFSET + i];
+				const float force_corrected = distance_squared == 0 ? 0 : force;
+				x[j] += force_corrected * diff_x;
+				y[j] += force_corrected * diff_y;
+				z[j] += force_corrected * diff_z;
+			}
+		}
+	}
+}
+
+// Last contribution to a force block followed by the update of its
+// particles. The accelerator does not write the forces back, since the
+// first contribution of the next step does not read them.
+#pragma oss task label("calculate_forces_update_block") \
+	device(fpga) \
+	copy_inout([PARTICLES_FPGABLOCK_SIZE]particles) \
+	copy_in([BLOCK_SIZE_C]x, [BLOCK_SIZE_C]y, [BLOCK_SIZE_C]z) \
+	copy_in([BLOCK_SIZE_C]pos_x2, [BLOCK_SIZE_C]pos_y2, [BLOCK_SIZE_C]pos_z2, [BLOCK_SIZE_C]weight2) \
+	inout(particles[0], x[0]) in(pos_x2[0])
+void calculate_forces_update_block(float *x, float *y, float *z, float *particles,
+	const float *pos_x2, const float *pos_y2, const float *pos_z2, const float *weight2, const float time_interval)
+{
+	#pragma HLS inline
+	for (int i = 0; i < BLOCK_SIZE; i++) {
+		for (int j = 0; j < BLOCK_SIZE; j++) {
+			const float diff_x = pos_x2[i] - particles[PARTICLES_FPGABLOCK_POS_X_OFFSET + j];
+			const float diff_y = pos_y2[i] - particles[PARTICLES_FPGABLOCK_POS_Y_OFFSET + j];
+			const float diff_z = pos_z2[i] - particles[PARTICLES_FPGABLOCK_POS_Z_OFFSET + j];
+			const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+			const float distance = sqrtf(distance_squared);
+			const float force = particles[PARTICLES_FPGABLOCK_MASS_OFFSET + j] / (distance_squared * distance) * weight2[i];
+			const float force_corrected = distance_squared == 0 ? 0 : force;
 			x[j] += force_corrected * diff_x;
 			y[j] += force_corrected * diff_y;
 			z[j] += force_corrected * diff_z;
 		}
 	}
+
+	for (int e = 0; e < BLOCK_SIZE; e++) {
+		const float mass               = particles[PARTICLES_FPGABLOCK_MASS_OFFSET + e];
+		const float time_by_mass       = mass == 0.0f ? 0.0f : time_interval / mass;
+		const float half_time_interval = 0.5f * time_interval;
+
+		const float velocity_change_x = x[e] * time_by_mass;
+		const float velocity_change_y = y[e] * time_by_mass;
+		const float velocity_change_z = z[e] * time_by_mass;
+
+		particles[PARTICLES_FPGABLOCK_POS_X_OFFSET + e] += particles[PARTICLES_FPGABLOCK_VEL_X_OFFSET + e] * time_interval + velocity_change_x * half_time_interval;
+		particles[PARTICLES_FPGABLOCK_POS_Y_OFFSET + e] += particles[PARTICLES_FPGABLOCK_VEL_Y_OFFSET + e] * time_interval + velocity_change_y * half_time_interval;
+		particles[PARTICLES_FPGABLOCK_POS_Z_OFFSET + e] += particles[PARTICLES_FPGABLOCK_VEL_Z_OFFSET + e] * time_interval + velocity_change_z * half_time_interval;
+
+		particles[PARTICLES_FPGABLOCK_VEL_X_OFFSET + e] += velocity_change_x;
+		particles[PARTICLES_FPGABLOCK_VEL_Y_OFFSET + e] += velocity_change_y;
+		particles[PARTICLES_FPGABLOCK_VEL_Z_OFFSET + e] += velocity_change_z;
+
+		x[e] = 0.0f;
+		y[e] = 0.0f;
+		z[e] = 0.0f;
+	}
 }
 
 #pragma oss task device(fpga) copy_deps inout([PARTICLES_FPGABLOCK_SIZE]particles, [FORCE_FPGABLOCK_SIZE]forces) label("update_particles_block")
@@ -80,16 +197,17 @@ void update_particles_block(float *particles, float *forces, const float time_in
 		const float position_y = particles[PARTICLES_FPGABLOCK_POS_Y_OFFSET + e];
 		const float position_z = particles[PARTICLES_FPGABLOCK_POS_Z_OFFSET + e];
 
-		const float time_by_mass       = time_interval / mass;
+		//The padding of a partial block has no mass and does not move
+		const float time_by_mass       = mass == 0.0f ? 0.0f : time_interval / mass;
 		const float half_time_interval = 0.5f * time_interval;
 
 		const float velocity_change_x = forces[FORCE_FPGABLOCK_X_OFFSET + e] * time_by_mass;
 		const float velocity_change_y = forces[FORCE_FPGABLOCK_Y_OFFSET + e] * time_by_mass;
 		const float velocity_change_z = forces[FORCE_FPGABLOCK_Z_OFFSET + e] * time_by_mass;
 
-		const float position_change_x = velocity_x + velocity_change_x * half_time_interval;
-		const float position_change_y = velocity_y + velocity_change_y * half_time_interval;
-		const float position_change_z = velocity_z + velocity_change_z * half_time_interval;
+		const float position_change_x = velocity_x * time_interval + velocity_change_x * half_time_interval;
+		const float position_change_y = velocity_y * time_interval + velocity_change_y * half_time_interval;
+		const float position_change_z = velocity_z * time_interval + velocity_change_z * half_time_interval;
 
 		particles[PARTICLES_FPGABLOCK_VEL_X_OFFSET + e] = velocity_x + velocity_change_x;
 		particles[PARTICLES_FPGABLOCK_VEL_Y_OFFSET + e] = velocity_y + velocity_change_y;
@@ -105,7 +223,48 @@ void update_particles_block(float *particles, float *forces, const float time_in
 	}
 }
 
-void calculate_forces(float *forces, const float *particles, const int num_blocks)
+// Packs the positions of a block as 16-bit offsets from the minimum of each
+// axis, or unpacks them. The nbody_solve accelerator creates these tasks
+// around the position exchange of the compressed mode, where the owner
+// packs and the other ranks unpack.
+#pragma oss task label("compress_positions") device(fpga) \
+	copy_inout([3*BLOCK_SIZE_C]positions, [PACKED_FPGABLOCK_SIZE]packed) \
+	inout(positions[0], packed[0])
+void compress_positions(float *positions, unsigned int *packed, const int decode)
+{
+	#pragma HLS inline
+	for (int c = 0; c < 3; c++) {
+		float *pos = positions + c*BLOCK_SIZE;
+		unsigned int *words = packed + 16 + c*BLOCK_SIZE/2;
+		if (decode) {
+			float origin, scale;
+			memcpy(&origin, packed + c, sizeof(float));
+			memcpy(&scale, packed + 4 + c, sizeof(float));
+			for (int e = 0; e < BLOCK_SIZE/2; e++) {
+				pos[2*e] = origin + (float)(words[e] & 0xFFFF) * scale;
+				pos[2*e + 1] = origin + (float)(words[e] >> 16) * scale;
+			}
+		} else {
+			float minimum = pos[0], maximum = pos[0];
+			for (int e = 1; e < BLOCK_SIZE; e++) {
+				minimum = pos[e] < minimum ? pos[e] : minimum;
+				maximum = pos[e] > maximum ? pos[e] : maximum;
+			}
+			const float range = maximum - minimum;
+			const float scale = range / 65535.0f;
+			const float inv_scale = range == 0 ? 0 : 65535.0f / range;
+			memcpy(packed + c, &minimum, sizeof(float));
+			memcpy(packed + 4 + c, &scale, sizeof(float));
+			for (int e = 0; e < BLOCK_SIZE/2; e++) {
+				const float low = (pos[2*e] - minimum) * inv_scale + 0.5f;
+				const float high = (pos[2*e + 1] - minimum) * inv_scale + 0.5f;
+				words[e] = (low >= 65535.0f ? 0xFFFF : (unsigned int)low) | (high >= 65535.0f ? 0xFFFF : (unsigned int)high) << 16;
+			}
+		}
+	}
+}
+
+void calculate_forces(float *forces, const float *particles, const int num_blocks, const int step)
 {
 	for (int i = 0; i < num_blocks; i++) {
 		for (int j = 0; j < num_blocks; j++) {
@@ -113,13 +272,70 @@ void calculate_forces(float *forces, const float *particles, const int num_block
 			const float * block1 = particles + j*PARTICLES_FPGABLOCK_SIZE;
 			const float * block2 = particles + i*PARTICLES_FPGABLOCK_SIZE;
 
-			calculate_forces_block(
-				forcesTarget + FORCE_FPGABLOCK_X_OFFSET, forcesTarget + FORCE_FPGABLOCK_Y_OFFSET,
-				forcesTarget + FORCE_FPGABLOCK_Z_OFFSET, block1 + PARTICLES_FPGABLOCK_POS_X_OFFSET,
-				block1 + PARTICLES_FPGABLOCK_POS_Y_OFFSET, block1 + PARTICLES_FPGABLOCK_POS_Z_OFFSET,
-				block1 + PARTICLES_FPGABLOCK_MASS_OFFSET, block2 + PARTICLES_FPGABLOCK_POS_X_OFFSET,
-				block2 + PARTICLES_FPGABLOCK_POS_Y_OFFSET, block2 + PARTICLES_FPGABLOCK_POS_Z_OFFSET,
-				block2 + PARTICLES_FPGABLOCK_WEIGHT_OFFSET);
+			calculate_forces_block(forcesTarget, block1, block2, step);
+		}
+	}
+}
+
+void calculate_forces_sym(float *forces, const float *particles, const int num_blocks, const int step)
+{
+	for (int i = 0; i < num_blocks; i++) {
+		for (int j = i; j < num_blocks; j++) {
+			float * forces1 = forces + j*FORCE_FPGABLOCK_SIZE;
+			float * forces2 = forces + i*FORCE_FPGABLOCK_SIZE;
+			const float * block1 = particles + j*PARTICLES_FPGABLOCK_SIZE;
+			const float * block2 = particles + i*PARTICLES_FPGABLOCK_SIZE;
+
+			if (i == j) {
+				calculate_forces_block(forces1, block1, block2, step);
+			} else {
+				calculate_forces_block_sym(
+					forces1 + FORCE_FPGABLOCK_X_OFFSET, forces1 + FORCE_FPGABLOCK_Y_OFFSET,
+					forces1 + FORCE_FPGABLOCK_Z_OFFSET, forces2 + FORCE_FPGABLOCK_X_OFFSET,
+					forces2 + FORCE_FPGABLOCK_Y_OFFSET, forces2 + FORCE_FPGABLOCK_Z_OFFSET,
+					block1 + PARTICLES_FPGABLOCK_POS_X_OFFSET, block1 + PARTICLES_FPGABLOCK_POS_Y_OFFSET,
+					block1 + PARTICLES_FPGABLOCK_POS_Z_OFFSET, block1 + PARTICLES_FPGABLOCK_MASS_OFFSET,
+					block2 + PARTICLES_FPGABLOCK_POS_X_OFFSET, block2 + PARTICLES_FPGABLOCK_POS_Y_OFFSET,
+					block2 + PARTICLES_FPGABLOCK_POS_Z_OFFSET, block2 + PARTICLES_FPGABLOCK_WEIGHT_OFFSET);
+			}
+		}
+	}
+}
+
+// The stationary tasks read every particle block without a dependence on
+// them, so the updates wait for all of them with a taskwait
+void calculate_forces_stationary(float *forces, const float *particles, const int num_blocks)
+{
+	for (int j = 0; j < num_blocks; j++) {
+		float * forcesTarget = forces + j*FORCE_FPGABLOCK_SIZE;
+		const float * block1 = particles + j*PARTICLES_FPGABLOCK_SIZE;
+
+		calculate_forces_block_stationary(
+			forcesTarget + FORCE_FPGABLOCK_X_OFFSET, forcesTarget + FORCE_FPGABLOCK_Y_OFFSET,
+			forcesTarget + FORCE_FPGABLOCK_Z_OFFSET, block1 + PARTICLES_FPGABLOCK_POS_X_OFFSET,
+			block1 + PARTICLES_FPGABLOCK_POS_Y_OFFSET, block1 + PARTICLES_FPGABLOCK_POS_Z_OFFSET,
+			block1 + PARTICLES_FPGABLOCK_MASS_OFFSET, particles, num_blocks);
+	}
+}
+
+void calculate_forces_fused(float *forces, float *particles, const int num_blocks, const float time_interval, const int step)
+{
+	for (int i = 0; i < num_blocks; i++) {
+		for (int j = 0; j < num_blocks; j++) {
+			float * forcesTarget = forces + j*FORCE_FPGABLOCK_SIZE;
+			float * block1 = particles + j*PARTICLES_FPGABLOCK_SIZE;
+			const float * block2 = particles + i*PARTICLES_FPGABLOCK_SIZE;
+
+			if (i == num_blocks-1) {
+				calculate_forces_update_block(
+					forcesTarget + FORCE_FPGABLOCK_X_OFFSET, forcesTarget + FORCE_FPGABLOCK_Y_OFFSET,
+					forcesTarget + FORCE_FPGABLOCK_Z_OFFSET, block1,
+					block2 + PARTICLES_FPGABLOCK_POS_X_OFFSET, block2 + PARTICLES_FPGABLOCK_POS_Y_OFFSET,
+					block2 + PARTICLES_FPGABLOCK_POS_Z_OFFSET, block2 + PARTICLES_FPGABLOCK_WEIGHT_OFFSET,
+					time_interval);
+			} else {
+				calculate_forces_block(forcesTarget, block1, block2, step);
+			}
 		}
 	}
 }
@@ -131,30 +347,144 @@ void update_particles(float *particles, float *forces, const int num_blocks, con
 	}
 }
 
-void nbody_solve(float *particles, float *forces, const int num_blocks, const int timesteps, const float time_interval)
+void nbody_solve(float *particles, float *forces, const int num_blocks, const int timesteps, const float time_interval, const int flags)
 {
 #pragma HLS inline
+	// The configuration the accelerators were built with, for the host check
+	const unsigned int config[NBODY_CONFIG_FIELDS] = NBODY_CONFIG_RECORD;
+	memcpy((char *)forces + BLOCK_CONFIG_OFFSET(num_blocks), config, sizeof(config));
+
 	for (int t = 0; t < timesteps; t++) {
-		calculate_forces(forces, particles, num_blocks);
-		update_particles(particles, forces, num_blocks, time_interval);
+		if (flags & NBODY_SOLVE_SYMMETRIC) {
+			calculate_forces_sym(forces, particles, num_blocks, t);
+			update_particles(particles, forces, num_blocks, time_interval);
+		} else if (flags & NBODY_SOLVE_STATIONARY) {
+			calculate_forces_stationary(forces, particles, num_blocks);
+			#pragma oss taskwait
+			update_particles(particles, forces, num_blocks, time_interval);
+			#pragma oss taskwait
+		} else if (flags & NBODY_SOLVE_FUSED) {
+			calculate_forces_fused(forces, particles, num_blocks, time_interval, t);
+		} else {
+			calculate_forces(forces, particles, num_blocks, t);
+			update_particles(particles, forces, num_blocks, time_interval);
+		}
 	}
 
 	#pragma oss taskwait
 }
 
-void nbody_stats(const nbody_t *nbody, const nbody_conf_t *conf, double time)
+int nbody_solve_flags(const nbody_conf_t *conf)
 {
-	int particles = nbody->num_blocks * BLOCK_SIZE;
+	int flags = 0;
+	if (conf->symmetric) flags |= NBODY_SOLVE_SYMMETRIC;
+	if (conf->fused) flags |= NBODY_SOLVE_FUSED;
+	if (conf->stationary) flags |= NBODY_SOLVE_STATIONARY;
+	if (conf->ring) flags |= NBODY_SOLVE_RING;
+	if (conf->compress) flags |= NBODY_SOLVE_COMPRESS;
+	return flags;
+}
+
+// The accuracy of the block timesteps is a fraction of the mean spacing of
+// the particles in the domain
+float nbody_timestep_length(const nbody_conf_t *conf)
+{
+	const float volume = conf->domain_size_x * conf->domain_size_y * conf->domain_size_z;
+	return conf->timestep_accuracy * cbrtf(volume / conf->num_particles);
+}
+
+static const char *nbody_solver_names[] = {
+	[NBODY_SOLVER_FPGA]       = "fpga",
+	[NBODY_SOLVER_SMP]        = "smp",
+	[NBODY_SOLVER_BARNES_HUT] = "bh",
+	[NBODY_SOLVER_FMM]        = "fmm"
+};
+
+static const char *nbody_distribution_names[] = {
+	[NBODY_DIST_CYCLIC]     = "cyclic",
+	[NBODY_DIST_CONTIGUOUS] = "contiguous"
+};
+
+// Appends one record per run, so a benchmark sweep can accumulate its
+// results in a single file. CSV files get the header when they are empty.
+static void nbody_report(const nbody_t *nbody, const nbody_conf_t *conf, const nbody_timing_t *timing, int threads, int devices, double performance)
+{
+	FILE *out = stdout;
+	if (conf->report_file) {
+		out = fopen(conf->report_file, "a");
+		if (!out) {
+			fprintf(stderr, "Cannot open report file %s\n", conf->report_file);
+			return;
+		}
+	}
+
+	const int particles = nbody->num_particles;
+	const char *solver = nbody_solver_names[conf->solver];
+	const char *distribution = nbody_distribution_names[conf->distribution];
+	const double time_per_timestep = timing->solve/nbody->timesteps;
+	const double upload_bandwidth = timing->upload > 0 ? timing->upload_bytes/timing->upload : 0;
+	const double download_bandwidth = timing->download > 0 ? timing->download_bytes/timing->download : 0;
+
+	if (conf->report_format == NBODY_REPORT_JSON) {
+		fprintf(out, "{\"tag\": \"%s\", \"solver\": \"%s\", \"symmetric\": %d, \"fused\": %d, \"stationary\": %d, "
+				"\"ring\": %d, \"compress\": %d, \"distribution\": \"%s\", \"threads\": %d, \"devices\": %d, "
+				"\"particles\": %d, \"block_size\": %d, \"blocks\": %d, \"ncalcforces\": %d, \"fblock_accs\": %d, \"timesteps\": %d, "
+				"\"setup_time\": %e, \"upload_time\": %e, \"solve_time\": %e, \"download_time\": %e, \"time_per_timestep\": %e, "
+				"\"upload_bytes\": %zu, \"download_bytes\": %zu, \"upload_bandwidth\": %e, \"download_bandwidth\": %e, "
+				"\"interactions_per_second\": %e}\n",
+				conf->report_tag, solver, conf->symmetric, conf->fused, conf->stationary,
+				conf->ring, conf->compress, distribution, threads, devices,
+				particles, BLOCK_SIZE, nbody->num_blocks, NBODY_NCALCFORCES, NBODY_NUM_FBLOCK_ACCS, nbody->timesteps,
+				timing->setup, timing->upload, timing->solve, timing->download, time_per_timestep,
+				timing->upload_bytes, timing->download_bytes, upload_bandwidth, download_bandwidth,
+				performance*1e9);
+	} else {
+		if (ftell(out) == 0 || out == stdout) {
+			fprintf(out, "tag,solver,symmetric,fused,stationary,ring,compress,distribution,threads,devices,particles,block_size,blocks,ncalcforces,fblock_accs,timesteps,"
+					"setup_time,upload_time,solve_time,download_time,time_per_timestep,"
+					"upload_bytes,download_bytes,upload_bandwidth,download_bandwidth,interactions_per_second\n");
+		}
+		fprintf(out, "%s,%s,%d,%d,%d,%d,%d,%s,%d,%d,%d,%d,%d,%d,%d,%d,%e,%e,%e,%e,%e,%zu,%zu,%e,%e,%e\n",
+				conf->report_tag, solver, conf->symmetric, conf->fused, conf->stationary,
+				conf->ring, conf->compress, distribution, threads, devices,
+				particles, BLOCK_SIZE, nbody->num_blocks, NBODY_NCALCFORCES, NBODY_NUM_FBLOCK_ACCS, nbody->timesteps,
+				timing->setup, timing->upload, timing->solve, timing->download, time_per_timestep,
+				timing->upload_bytes, timing->download_bytes, upload_bandwidth, download_bandwidth,
+				performance*1e9);
+	}
+
+	if (out != stdout) fclose(out);
+}
+
+void nbody_stats(const nbody_t *nbody, const nbody_conf_t *conf, const nbody_timing_t *timing)
+{
+	// Only the interactions of the real particles, not of the padding
+	int particles = nbody->num_particles;
 	int devices = nanos6_dist_num_devices();
+	int threads = nanos6_get_num_cpus();
+	double time = timing->solve;
+	double performance = nbody_compute_throughput(conf->solver, particles, nbody->timesteps, time);
+	// Blocks of the most loaded device, which sets the time of a timestep
+	int blocks_per_device = nbody->num_blocks;
+	if (devices > 1 && devices <= NBODY_MAX_RANKS) {
+		int weights[NBODY_MAX_RANKS], counts[NBODY_MAX_RANKS];
+		nbody_device_weights(conf, devices, weights);
+		nbody_distribution_counts(nbody->num_blocks, devices, weights, counts);
+		blocks_per_device = 0;
+		for (int i = 0; i < devices; ++i) blocks_per_device = MAX(blocks_per_device, counts[i]);
+	}
 	if (conf->parse) {
 		printf("%e\n", time); 
 	}
 	else {
 		printf("time %f\n", time);
 		printf("threads, %d, devices %d, timesteps, %d, total_particles, %d, block_size, %d, blocks, %d, blocks_per_device, %d, performance, %f\n",
-				nanos6_get_num_cpus(), devices, nbody->timesteps, particles, BLOCK_SIZE,
-				nbody->num_blocks, nbody->num_blocks/devices, nbody_compute_throughput(particles, nbody->timesteps, time)
+				threads, devices, nbody->timesteps, particles, BLOCK_SIZE,
+				nbody->num_blocks, blocks_per_device, performance
 		);
 	}
-}
 
+	if (conf->report_format != NBODY_REPORT_NONE) {
+		nbody_report(nbody, conf, timing, threads, devices, performance);
+	}
+}
@@ -0,0 +1,647 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+#include "nbody.h"
+
+#include <assert.h>
+#include <immintrin.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of targets of a force block computed by a single task
+#define SMP_CHUNK MIN(BLOCK_SIZE, 512)
+
+// Accumulates into fx/fy/fz the forces that the n2 source particles
+// exert over the n1 target particles. The kernels first add up
+// weight2*diff/distance^3 per target and multiply by the target mass at
+// the end, which gives the same force as the FPGA accelerator.
+typedef void (*smp_forces_kernel_t)(float *fx, float *fy, float *fz,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2);
+
+static void calculate_forces_scalar(float *fx, float *fy, float *fz,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2)
+{
+	for (int j = 0; j < n1; j++) {
+		float ax = 0.0f, ay = 0.0f, az = 0.0f;
+		for (int i = 0; i < n2; i++) {
+			const float diff_x = x2[i] - x1[j];
+			const float diff_y = y2[i] - y1[j];
+			const float diff_z = z2[i] - z1[j];
+			const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+			if (distance_squared == 0.0f) continue;
+			const float inv_distance = 1.0f / sqrtf(distance_squared);
+			const float s = w2[i] * inv_distance * inv_distance * inv_distance;
+			ax += s * diff_x;
+			ay += s * diff_y;
+			az += s * diff_z;
+		}
+		fx[j] += m1[j] * ax;
+		fy[j] += m1[j] * ay;
+		fz[j] += m1[j] * az;
+	}
+}
+
+// AVX2: 2 vectors of 8 targets stay in registers while the sources stream
+#define AVX2_TILE 2
+
+__attribute__((target("avx2,fma")))
+static inline __m256 rsqrt_nr_avx2(const __m256 d2)
+{
+	// ~12-bit estimate refined with one Newton-Raphson iteration
+	const __m256 y = _mm256_rsqrt_ps(d2);
+	const __m256 h = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), d2), _mm256_mul_ps(y, y));
+	const __m256 r = _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), h));
+	// Self interactions (distance 0) do not contribute
+	return _mm256_and_ps(r, _mm256_cmp_ps(d2, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+}
+
+__attribute__((target("avx2,fma")))
+static void calculate_forces_avx2(float *fx, float *fy, float *fz,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2)
+{
+	const int tile = 8*AVX2_TILE;
+	const int n1_tiled = n1 - n1%tile;
+	for (int j = 0; j < n1_tiled; j += tile) {
+		__m256 px[AVX2_TILE], py[AVX2_TILE], pz[AVX2_TILE];
+		__m256 ax[AVX2_TILE], ay[AVX2_TILE], az[AVX2_TILE];
+		for (int t = 0; t < AVX2_TILE; t++) {
+			px[t] = _mm256_loadu_ps(x1 + j + 8*t);
+			py[t] = _mm256_loadu_ps(y1 + j + 8*t);
+			pz[t] = _mm256_loadu_ps(z1 + j + 8*t);
+			ax[t] = ay[t] = az[t] = _mm256_setzero_ps();
+		}
+		for (int i = 0; i < n2; i++) {
+			const __m256 sx = _mm256_broadcast_ss(x2 + i);
+			const __m256 sy = _mm256_broadcast_ss(y2 + i);
+			const __m256 sz = _mm256_broadcast_ss(z2 + i);
+			const __m256 sw = _mm256_broadcast_ss(w2 + i);
+			for (int t = 0; t < AVX2_TILE; t++) {
+				const __m256 dx = _mm256_sub_ps(sx, px[t]);
+				const __m256 dy = _mm256_sub_ps(sy, py[t]);
+				const __m256 dz = _mm256_sub_ps(sz, pz[t]);
+				const __m256 d2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+				const __m256 inv = rsqrt_nr_avx2(d2);
+				const __m256 s = _mm256_mul_ps(sw, _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+				ax[t] = _mm256_fmadd_ps(s, dx, ax[t]);
+				ay[t] = _mm256_fmadd_ps(s, dy, ay[t]);
+				az[t] = _mm256_fmadd_ps(s, dz, az[t]);
+			}
+		}
+		for (int t = 0; t < AVX2_TILE; t++) {
+			const __m256 m = _mm256_loadu_ps(m1 + j + 8*t);
+			_mm256_storeu_ps(fx + j + 8*t, _mm256_fmadd_ps(m, ax[t], _mm256_loadu_ps(fx + j + 8*t)));
+			_mm256_storeu_ps(fy + j + 8*t, _mm256_fmadd_ps(m, ay[t], _mm256_loadu_ps(fy + j + 8*t)));
+			_mm256_storeu_ps(fz + j + 8*t, _mm256_fmadd_ps(m, az[t], _mm256_loadu_ps(fz + j + 8*t)));
+		}
+	}
+	calculate_forces_scalar(fx + n1_tiled, fy + n1_tiled, fz + n1_tiled,
+		x1 + n1_tiled, y1 + n1_tiled, z1 + n1_tiled, m1 + n1_tiled, n1 - n1_tiled,
+		x2, y2, z2, w2, n2);
+}
+
+// AVX-512: 4 vectors of 16 targets, 32 registers leave room for the tile
+#define AVX512_TILE 4
+
+__attribute__((target("avx512f")))
+static inline __m512 rsqrt_nr_avx512(const __m512 d2)
+{
+	// 14-bit estimate refined with one Newton-Raphson iteration
+	const __m512 y = _mm512_rsqrt14_ps(d2);
+	const __m512 h = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), d2), _mm512_mul_ps(y, y));
+	const __m512 r = _mm512_mul_ps(y, _mm512_sub_ps(_mm512_set1_ps(1.5f), h));
+	// Self interactions (distance 0) do not contribute
+	return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(d2, _mm512_setzero_ps(), _CMP_NEQ_OQ), r);
+}
+
+__attribute__((target("avx512f")))
+static void calculate_forces_avx512(float *fx, float *fy, float *fz,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2)
+{
+	const int tile = 16*AVX512_TILE;
+	const int n1_tiled = n1 - n1%tile;
+	for (int j = 0; j < n1_tiled; j += tile) {
+		__m512 px[AVX512_TILE], py[AVX512_TILE], pz[AVX512_TILE];
+		__m512 ax[AVX512_TILE], ay[AVX512_TILE], az[AVX512_TILE];
+		for (int t = 0; t < AVX512_TILE; t++) {
+			px[t] = _mm512_loadu_ps(x1 + j + 16*t);
+			py[t] = _mm512_loadu_ps(y1 + j + 16*t);
+			pz[t] = _mm512_loadu_ps(z1 + j + 16*t);
+			ax[t] = ay[t] = az[t] = _mm512_setzero_ps();
+		}
+		for (int i = 0; i < n2; i++) {
+			const __m512 sx = _mm512_set1_ps(x2[i]);
+			const __m512 sy = _mm512_set1_ps(y2[i]);
+			const __m512 sz = _mm512_set1_ps(z2[i]);
+			const __m512 sw = _mm512_set1_ps(w2[i]);
+			for (int t = 0; t < AVX512_TILE; t++) {
+				const __m512 dx = _mm512_sub_ps(sx, px[t]);
+				const __m512 dy = _mm512_sub_ps(sy, py[t]);
+				const __m512 dz = _mm512_sub_ps(sz, pz[t]);
+				const __m512 d2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+				const __m512 inv = rsqrt_nr_avx512(d2);
+				const __m512 s = _mm512_mul_ps(sw, _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv)));
+				ax[t] = _mm512_fmadd_ps(s, dx, ax[t]);
+				ay[t] = _mm512_fmadd_ps(s, dy, ay[t]);
+				az[t] = _mm512_fmadd_ps(s, dz, az[t]);
+			}
+		}
+		for (int t = 0; t < AVX512_TILE; t++) {
+			const __m512 m = _mm512_loadu_ps(m1 + j + 16*t);
+			_mm512_storeu_ps(fx + j + 16*t, _mm512_fmadd_ps(m, ax[t], _mm512_loadu_ps(fx + j + 16*t)));
+			_mm512_storeu_ps(fy + j + 16*t, _mm512_fmadd_ps(m, ay[t], _mm512_loadu_ps(fy + j + 16*t)));
+			_mm512_storeu_ps(fz + j + 16*t, _mm512_fmadd_ps(m, az[t], _mm512_loadu_ps(fz + j + 16*t)));
+		}
+	}
+	calculate_forces_scalar(fx + n1_tiled, fy + n1_tiled, fz + n1_tiled,
+		x1 + n1_tiled, y1 + n1_tiled, z1 + n1_tiled, m1 + n1_tiled, n1 - n1_tiled,
+		x2, y2, z2, w2, n2);
+}
+
+// Symmetric variants: every pair is computed once, the target particles
+// of block 1 get the force and the source particles of block 2 get the
+// opposite one. The source side is a horizontal sum over the target tile.
+typedef void (*smp_forces_pair_kernel_t)(float *fx1, float *fy1, float *fz1,
+	float *fx2, float *fy2, float *fz2,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2);
+
+static void calculate_forces_pair_scalar(float *fx1, float *fy1, float *fz1,
+	float *fx2, float *fy2, float *fz2,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2)
+{
+	for (int j = 0; j < n1; j++) {
+		float ax = 0.0f, ay = 0.0f, az = 0.0f;
+		for (int i = 0; i < n2; i++) {
+			const float diff_x = x2[i] - x1[j];
+			const float diff_y = y2[i] - y1[j];
+			const float diff_z = z2[i] - z1[j];
+			const float distance_squared = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+			if (distance_squared == 0.0f) continue;
+			const float inv_distance = 1.0f / sqrtf(distance_squared);
+			const float s = inv_distance * inv_distance * inv_distance;
+			const float sw = w2[i] * s;
+			const float sm = m1[j] * s;
+			ax += sw * diff_x;
+			ay += sw * diff_y;
+			az += sw * diff_z;
+			fx2[i] -= w2[i] * sm * diff_x;
+			fy2[i] -= w2[i] * sm * diff_y;
+			fz2[i] -= w2[i] * sm * diff_z;
+		}
+		fx1[j] += m1[j] * ax;
+		fy1[j] += m1[j] * ay;
+		fz1[j] += m1[j] * az;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx2(const __m256 v)
+{
+	const __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	const __m128 s2 = _mm_add_ps(s4, _mm_movehl_ps(s4, s4));
+	return _mm_cvtss_f32(_mm_add_ss(s2, _mm_movehdup_ps(s2)));
+}
+
+__attribute__((target("avx2,fma")))
+static void calculate_forces_pair_avx2(float *fx1, float *fy1, float *fz1,
+	float *fx2, float *fy2, float *fz2,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2)
+{
+	const int tile = 8*AVX2_TILE;
+	const int n1_tiled = n1 - n1%tile;
+	for (int j = 0; j < n1_tiled; j += tile) {
+		__m256 px[AVX2_TILE], py[AVX2_TILE], pz[AVX2_TILE], pm[AVX2_TILE];
+		__m256 ax[AVX2_TILE], ay[AVX2_TILE], az[AVX2_TILE];
+		for (int t = 0; t < AVX2_TILE; t++) {
+			px[t] = _mm256_loadu_ps(x1 + j + 8*t);
+			py[t] = _mm256_loadu_ps(y1 + j + 8*t);
+			pz[t] = _mm256_loadu_ps(z1 + j + 8*t);
+			pm[t] = _mm256_loadu_ps(m1 + j + 8*t);
+			ax[t] = ay[t] = az[t] = _mm256_setzero_ps();
+		}
+		for (int i = 0; i < n2; i++) {
+			const __m256 sx = _mm256_broadcast_ss(x2 + i);
+			const __m256 sy = _mm256_broadcast_ss(y2 + i);
+			const __m256 sz = _mm256_broadcast_ss(z2 + i);
+			const __m256 sw = _mm256_broadcast_ss(w2 + i);
+			__m256 rx = _mm256_setzero_ps(), ry = _mm256_setzero_ps(), rz = _mm256_setzero_ps();
+			for (int t = 0; t < AVX2_TILE; t++) {
+				const __m256 dx = _mm256_sub_ps(sx, px[t]);
+				const __m256 dy = _mm256_sub_ps(sy, py[t]);
+				const __m256 dz = _mm256_sub_ps(sz, pz[t]);
+				const __m256 d2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+				const __m256 inv = rsqrt_nr_avx2(d2);
+				const __m256 s = _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv));
+				const __m256 s_w = _mm256_mul_ps(sw, s);
+				const __m256 s_m = _mm256_mul_ps(pm[t], s);
+				ax[t] = _mm256_fmadd_ps(s_w, dx, ax[t]);
+				ay[t] = _mm256_fmadd_ps(s_w, dy, ay[t]);
+				az[t] = _mm256_fmadd_ps(s_w, dz, az[t]);
+				rx = _mm256_fmadd_ps(s_m, dx, rx);
+				ry = _mm256_fmadd_ps(s_m, dy, ry);
+				rz = _mm256_fmadd_ps(s_m, dz, rz);
+			}
+			fx2[i] -= w2[i] * hsum_avx2(rx);
+			fy2[i] -= w2[i] * hsum_avx2(ry);
+			fz2[i] -= w2[i] * hsum_avx2(rz);
+		}
+		for (int t = 0; t < AVX2_TILE; t++) {
+			_mm256_storeu_ps(fx1 + j + 8*t, _mm256_fmadd_ps(pm[t], ax[t], _mm256_loadu_ps(fx1 + j + 8*t)));
+			_mm256_storeu_ps(fy1 + j + 8*t, _mm256_fmadd_ps(pm[t], ay[t], _mm256_loadu_ps(fy1 + j + 8*t)));
+			_mm256_storeu_ps(fz1 + j + 8*t, _mm256_fmadd_ps(pm[t], az[t], _mm256_loadu_ps(fz1 + j + 8*t)));
+		}
+	}
+	calculate_forces_pair_scalar(fx1 + n1_tiled, fy1 + n1_tiled, fz1 + n1_tiled, fx2, fy2, fz2,
+		x1 + n1_tiled, y1 + n1_tiled, z1 + n1_tiled, m1 + n1_tiled, n1 - n1_tiled,
+		x2, y2, z2, w2, n2);
+}
+
+__attribute__((target("avx512f")))
+static void calculate_forces_pair_avx512(float *fx1, float *fy1, float *fz1,
+	float *fx2, float *fy2, float *fz2,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2)
+{
+	const int tile = 16*AVX512_TILE;
+	const int n1_tiled = n1 - n1%tile;
+	for (int j = 0; j < n1_tiled; j += tile) {
+		__m512 px[AVX512_TILE], py[AVX512_TILE], pz[AVX512_TILE], pm[AVX512_TILE];
+		__m512 ax[AVX512_TILE], ay[AVX512_TILE], az[AVX512_TILE];
+		for (int t = 0; t < AVX512_TILE; t++) {
+			px[t] = _mm512_loadu_ps(x1 + j + 16*t);
+			py[t] = _mm512_loadu_ps(y1 + j + 16*t);
+			pz[t] = _mm512_loadu_ps(z1 + j + 16*t);
+			pm[t] = _mm512_loadu_ps(m1 + j + 16*t);
+			ax[t] = ay[t] = az[t] = _mm512_setzero_ps();
+		}
+		for (int i = 0; i < n2; i++) {
+			const __m512 sx = _mm512_set1_ps(x2[i]);
+			const __m512 sy = _mm512_set1_ps(y2[i]);
+			const __m512 sz = _mm512_set1_ps(z2[i]);
+			const __m512 sw = _mm512_set1_ps(w2[i]);
+			__m512 rx = _mm512_setzero_ps(), ry = _mm512_setzero_ps(), rz = _mm512_setzero_ps();
+			for (int t = 0; t < AVX512_TILE; t++) {
+				const __m512 dx = _mm512_sub_ps(sx, px[t]);
+				const __m512 dy = _mm512_sub_ps(sy, py[t]);
+				const __m512 dz = _mm512_sub_ps(sz, pz[t]);
+				const __m512 d2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+				const __m512 inv = rsqrt_nr_avx512(d2);
+				const __m512 s = _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv));
+				const __m512 s_w = _mm512_mul_ps(sw, s);
+				const __m512 s_m = _mm512_mul_ps(pm[t], s);
+				ax[t] = _mm512_fmadd_ps(s_w, dx, ax[t]);
+				ay[t] = _mm512_fmadd_ps(s_w, dy, ay[t]);
+				az[t] = _mm512_fmadd_ps(s_w, dz, az[t]);
+				rx = _mm512_fmadd_ps(s_m, dx, rx);
+				ry = _mm512_fmadd_ps(s_m, dy, ry);
+				rz = _mm512_fmadd_ps(s_m, dz, rz);
+			}
+			fx2[i] -= w2[i] * _mm512_reduce_add_ps(rx);
+			fy2[i] -= w2[i] * _mm512_reduce_add_ps(ry);
+			fz2[i] -= w2[i] * _mm512_reduce_add_ps(rz);
+		}
+		for (int t = 0; t < AVX512_TILE; t++) {
+			_mm512_storeu_ps(fx1 + j + 16*t, _mm512_fmadd_ps(pm[t], ax[t], _mm512_loadu_ps(fx1 + j + 16*t)));
+			_mm512_storeu_ps(fy1 + j + 16*t, _mm512_fmadd_ps(pm[t], ay[t], _mm512_loadu_ps(fy1 + j + 16*t)));
+			_mm512_storeu_ps(fz1 + j + 16*t, _mm512_fmadd_ps(pm[t], az[t], _mm512_loadu_ps(fz1 + j + 16*t)));
+		}
+	}
+	calculate_forces_pair_scalar(fx1 + n1_tiled, fy1 + n1_tiled, fz1 + n1_tiled, fx2, fy2, fz2,
+		x1 + n1_tiled, y1 + n1_tiled, z1 + n1_tiled, m1 + n1_tiled, n1 - n1_tiled,
+		x2, y2, z2, w2, n2);
+}
+
+static smp_forces_kernel_t smp_forces_kernel = NULL;
+static smp_forces_pair_kernel_t smp_forces_pair_kernel = NULL;
+
+// The instruction set is detected at runtime. The NBODY_SMP_ISA
+// environment variable (scalar, avx2 or avx512) forces a given kernel.
+void nbody_smp_init()
+{
+	if (smp_forces_kernel != NULL) return;
+
+	const char *isa = getenv("NBODY_SMP_ISA");
+	__builtin_cpu_init();
+	const int has_avx512 = __builtin_cpu_supports("avx512f");
+	const int has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+	if (isa == NULL) {
+		isa = has_avx512 ? "avx512" : (has_avx2 ? "avx2" : "scalar");
+	}
+
+	if (!strcmp(isa, "avx512") && has_avx512) {
+		smp_forces_kernel = calculate_forces_avx512;
+		smp_forces_pair_kernel = calculate_forces_pair_avx512;
+	} else if (!strcmp(isa, "avx2") && has_avx2) {
+		smp_forces_kernel = calculate_forces_avx2;
+		smp_forces_pair_kernel = calculate_forces_pair_avx2;
+	} else {
+		if (strcmp(isa, "scalar")) {
+			fprintf(stderr, "Warning: %s kernel not supported by this CPU, using the scalar one\n", isa);
+		}
+		isa = "scalar";
+		smp_forces_kernel = calculate_forces_scalar;
+		smp_forces_pair_kernel = calculate_forces_pair_scalar;
+	}
+	fprintf(stderr, "SMP solver using the %s kernel\n", isa);
+}
+
+// The padding of the last block is neither a target nor a source. The
+// chunk tasks write all the components of their forces and read every
+// particle block, but their dependences only match the first x force of the
+// chunk and the first block, so the updates wait for them with a taskwait
+static void calculate_forces_smp(forces_block_t *forces, const particles_block_t *particles, const int num_blocks, const int num_particles)
+{
+	for (int j = 0; j < num_blocks; j++) {
+		const int n1 = nbody_block_particles(num_particles, j);
+		for (int c = 0; c < n1; c += SMP_CHUNK) {
+			#pragma oss task label("calculate_forces_smp") \
+				in(particles[0;num_blocks]) inout(forces[j].x[c;SMP_CHUNK])
+			{
+				forces_block_t *target_forces = forces + j;
+				const particles_block_t *target = particles + j;
+				for (int i = 0; i < num_blocks; i++) {
+					const particles_block_t *source = particles + i;
+					smp_forces_kernel(target_forces->x + c, target_forces->y + c, target_forces->z + c,
+						target->position_x + c, target->position_y + c, target->position_z + c,
+						target->mass + c, MIN(SMP_CHUNK, n1 - c),
+						source->position_x, source->position_y, source->position_z,
+						source->weight, nbody_block_particles(num_particles, i));
+				}
+			}
+		}
+	}
+}
+
+void calculate_forces_kernel_smp(float *fx, float *fy, float *fz,
+	const float *x1, const float *y1, const float *z1, const float *m1, const int n1,
+	const float *x2, const float *y2, const float *z2, const float *w2, const int n2)
+{
+	smp_forces_kernel(fx, fy, fz, x1, y1, z1, m1, n1, x2, y2, z2, w2, n2);
+}
+
+// Each unordered pair of blocks is a task. Tasks sharing a force block
+// run in any order but never at the same time.
+static void calculate_forces_sym_smp(forces_block_t *forces, const particles_block_t *particles, const int num_blocks, const int num_particles)
+{
+	for (int i = 0; i < num_blocks; i++) {
+		for (int j = i; j < num_blocks; j++) {
+			#pragma oss task label("calculate_forces_sym_smp") \
+				in(particles[i], particles[j]) commutative(forces[i], forces[j])
+			{
+				forces_block_t *forces1 = forces + j;
+				forces_block_t *forces2 = forces + i;
+				const particles_block_t *block1 = particles + j;
+				const particles_block_t *block2 = particles + i;
+				const int n1 = nbody_block_particles(num_particles, j);
+				const int n2 = nbody_block_particles(num_particles, i);
+				if (i == j) {
+					smp_forces_kernel(forces1->x, forces1->y, forces1->z,
+						block1->position_x, block1->position_y, block1->position_z, block1->mass, n1,
+						block2->position_x, block2->position_y, block2->position_z, block2->weight, n2);
+				} else {
+					smp_forces_pair_kernel(forces1->x, forces1->y, forces1->z,
+						forces2->x, forces2->y, forces2->z,
+						block1->position_x, block1->position_y, block1->position_z, block1->mass, n1,
+						block2->position_x, block2->position_y, block2->position_z, block2->weight, n2);
+				}
+			}
+		}
+	}
+}
+
+void update_particles_smp(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles, const float time_interval)
+{
+	for (int i = 0; i < num_blocks; i++) {
+		#pragma oss task label("update_particles_smp") inout(particles[i], forces[i])
+		{
+			particles_block_t *part = particles + i;
+			forces_block_t *force = forces + i;
+			const float half_time_interval = 0.5f * time_interval;
+			const int count = nbody_block_particles(num_particles, i);
+
+			for (int e = 0; e < count; e++) {
+				const float time_by_mass = time_interval / part->mass[e];
+
+				const float velocity_change_x = force->x[e] * time_by_mass;
+				const float velocity_change_y = force->y[e] * time_by_mass;
+				const float velocity_change_z = force->z[e] * time_by_mass;
+
+				part->position_x[e] += part->velocity_x[e] * time_interval + velocity_change_x * half_time_interval;
+				part->position_y[e] += part->velocity_y[e] * time_interval + velocity_change_y * half_time_interval;
+				part->position_z[e] += part->velocity_z[e] * time_interval + velocity_change_z * half_time_interval;
+
+				part->velocity_x[e] += velocity_change_x;
+				part->velocity_y[e] += velocity_change_y;
+				part->velocity_z[e] += velocity_change_z;
+
+				force->x[e] = 0.0f;
+				force->y[e] = 0.0f;
+				force->z[e] = 0.0f;
+			}
+		}
+	}
+}
+
+void nbody_solve_smp(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles, const int timesteps, const float time_interval, const int flags)
+{
+	nbody_smp_init();
+
+	for (int t = 0; t < timesteps; t++) {
+		if (flags & NBODY_SOLVE_SYMMETRIC) {
+			calculate_forces_sym_smp(forces, particles, num_blocks, num_particles);
+			update_particles_smp(particles, forces, num_blocks, num_particles, time_interval);
+		} else {
+			calculate_forces_smp(forces, particles, num_blocks, num_particles);
+			#pragma oss taskwait
+			update_particles_smp(particles, forces, num_blocks, num_particles, time_interval);
+			#pragma oss taskwait
+		}
+	}
+
+	#pragma oss taskwait
+}
+
+// Positions of the sources of the block timesteps, at the time of a substep
+typedef struct {
+	float x[BLOCK_SIZE];
+	float y[BLOCK_SIZE];
+	float z[BLOCK_SIZE];
+} positions_block_t;
+
+// A block that is not active was already moved to the end of its step, so
+// its positions at the substep are taken back along the same trajectory,
+// with the force of the start of its step: x(t) = x - v*tau + a*tau^2/2
+static void predict_positions_smp(positions_block_t *predicted, const particles_block_t *part, const forces_block_t *force, const int count, const float tau)
+{
+	for (int e = 0; e < count; e++) {
+		const float half_tau_by_mass = 0.5f * tau * tau / part->mass[e];
+		predicted->x[e] = part->position_x[e] - part->velocity_x[e] * tau + force->x[e] * half_tau_by_mass;
+		predicted->y[e] = part->position_y[e] - part->velocity_y[e] * tau + force->y[e] * half_tau_by_mass;
+		predicted->z[e] = part->position_z[e] - part->velocity_z[e] * tau + force->z[e] * half_tau_by_mass;
+	}
+}
+
+// Only the chunks of the active targets are tasks. Their forces are cleared
+// first, since the ones of the other blocks are still needed to predict them
+static void calculate_forces_active_smp(forces_block_t *forces, const particles_block_t *particles, const positions_block_t *predicted,
+	const unsigned char *active, const int num_blocks, const int num_particles)
+{
+	for (int j = 0; j < num_blocks; j++) {
+		if (!active[j]) continue;
+		const int n1 = nbody_block_particles(num_particles, j);
+		for (int c = 0; c < n1; c += SMP_CHUNK) {
+			#pragma oss task label("calculate_forces_active_smp") \
+				in(particles[0;num_blocks], predicted[0;num_blocks]) inout(forces[j].x[c;SMP_CHUNK])
+			{
+				forces_block_t *target_forces = forces + j;
+				const particles_block_t *target = particles + j;
+				const int n = MIN(SMP_CHUNK, n1 - c);
+				memset(target_forces->x + c, 0, n * sizeof(float));
+				memset(target_forces->y + c, 0, n * sizeof(float));
+				memset(target_forces->z + c, 0, n * sizeof(float));
+				for (int i = 0; i < num_blocks; i++) {
+					const particles_block_t *source = particles + i;
+					const float *x2 = active[i] ? source->position_x : predicted[i].x;
+					const float *y2 = active[i] ? source->position_y : predicted[i].y;
+					const float *z2 = active[i] ? source->position_z : predicted[i].z;
+					smp_forces_kernel(target_forces->x + c, target_forces->y + c, target_forces->z + c,
+						target->position_x + c, target->position_y + c, target->position_z + c,
+						target->mass + c, n, x2, y2, z2, source->weight, nbody_block_particles(num_particles, i));
+				}
+			}
+		}
+	}
+}
+
+// Level of the next step of a block from its largest acceleration, so that
+// a*dt^2/2 stays within the accuracy length. A step starts at a substep that
+// is a multiple of its length, so a block only moves to a coarser level
+// when the substep is aligned with it
+static int block_timestep_level(const particles_block_t *part, const forces_block_t *force, const int count,
+	const float time_interval, const int levels, const float length, const int substep, const int substeps)
+{
+	float acceleration = 0.0f;
+	for (int e = 0; e < count; e++) {
+		// The forces and masses squared overflow, the accelerations do not
+		const float ax = force->x[e] / part->mass[e];
+		const float ay = force->y[e] / part->mass[e];
+		const float az = force->z[e] / part->mass[e];
+		acceleration = fmaxf(acceleration, ax * ax + ay * ay + az * az);
+	}
+	acceleration = sqrtf(acceleration);
+
+	int level = 0;
+	const float ratio = acceleration * time_interval * time_interval / (2.0f * length);
+	if (ratio > 1.0f) {
+		level = MIN((int)ceilf(0.5f * log2f(ratio)), levels - 1);
+	}
+	while (substep % (substeps >> level) != 0) level++;
+	return level;
+}
+
+// Power-of-two block timesteps. A timestep of time_interval is split in
+// 2^(levels-1) substeps, and each block advances with the step of its
+// level: at a substep, only the blocks whose step starts there get forces,
+// from the other blocks at their predicted positions, and are updated. The
+// update is the one of update_particles_smp, but the forces are kept for the
+// predictions. Every block is active at the first substep of a timestep, so
+// the particles are in sync between timesteps
+void nbody_solve_block_steps(particles_block_t *particles, forces_block_t *forces, const int num_blocks, const int num_particles,
+	const int timesteps, const float time_interval, const int levels, const float length, nbody_block_steps_t *work)
+{
+	nbody_smp_init();
+
+	const int substeps = 1 << (levels - 1);
+	const float substep_interval = time_interval / substeps;
+
+	unsigned char *level = malloc(num_blocks);
+	unsigned char *active = malloc(num_blocks);
+	int *end = malloc(num_blocks * sizeof(int));
+	positions_block_t *predicted = nbody_alloc(num_blocks * sizeof(positions_block_t));
+	assert(level != NULL && active != NULL && end != NULL);
+
+	for (int t = 0; t < timesteps; t++) {
+		for (int s = 0; s < substeps; s++) {
+			int inactive = 0;
+			for (int b = 0; b < num_blocks; b++) {
+				active[b] = s == 0 || end[b] == s;
+				inactive += !active[b];
+				if (active[b]) work->interactions += (double)nbody_block_particles(num_particles, b) * num_particles;
+			}
+
+			for (int b = 0; inactive && b < num_blocks; b++) {
+				if (active[b]) continue;
+				#pragma oss task label("predict_positions_smp") in(particles[b], forces[b]) out(predicted[b])
+				predict_positions_smp(predicted + b, particles + b, forces + b, nbody_block_particles(num_particles, b), (end[b] - s) * substep_interval);
+			}
+			// The force tasks read every predicted block, which their
+			// dependences do not match
+			if (inactive) {
+				#pragma oss taskwait
+			}
+
+			calculate_forces_active_smp(forces, particles, predicted, active, num_blocks, num_particles);
+			// And the updates need all the chunks of their forces
+			#pragma oss taskwait
+
+			for (int b = 0; b < num_blocks; b++) {
+				if (!active[b]) continue;
+				#pragma oss task label("update_particles_block_steps_smp") inout(particles[b]) in(forces[b])
+				{
+					particles_block_t *part = particles + b;
+					const forces_block_t *force = forces + b;
+					const int count = nbody_block_particles(num_particles, b);
+					level[b] = block_timestep_level(part, force, count, time_interval, levels, length, s, substeps);
+					end[b] = s + (substeps >> level[b]);
+
+					const float dt = substep_interval * (substeps >> level[b]);
+					const float half_dt = 0.5f * dt;
+					for (int e = 0; e < count; e++) {
+						const float time_by_mass = dt / part->mass[e];
+
+						const float velocity_change_x = force->x[e] * time_by_mass;
+						const float velocity_change_y = force->y[e] * time_by_mass;
+						const float velocity_change_z = force->z[e] * time_by_mass;
+
+						part->position_x[e] += part->velocity_x[e] * dt + velocity_change_x * half_dt;
+						part->position_y[e] += part->velocity_y[e] * dt + velocity_change_y * half_dt;
+						part->position_z[e] += part->velocity_z[e] * dt + velocity_change_z * half_dt;
+
+						part->velocity_x[e] += velocity_change_x;
+						part->velocity_y[e] += velocity_change_y;
+						part->velocity_z[e] += velocity_change_z;
+					}
+				}
+			}
+			// The next active blocks depend on the levels
+			#pragma oss taskwait
+
+			for (int b = 0; b < num_blocks; b++) {
+				if (active[b]) work->steps[level[b]]++;
+			}
+		}
+	}
+
+	// The forces are left cleared, like the other solvers do
+	memset(forces, 0, num_blocks * sizeof(forces_block_t));
+
+	work->uniform += (double)num_particles * num_particles * substeps * timesteps;
+
+	nbody_dealloc(predicted, num_blocks * sizeof(positions_block_t));
+	free(end);
+	free(active);
+	free(level);
+}
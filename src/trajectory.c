@@ -0,0 +1,302 @@
+//
+// This file is part of NBody and is licensed under the terms contained
+// in the LICENSE file.
+//
+// Copyright (C) 2021 Barcelona Supercomputing Center (BSC)
+//
+
+#include "nbody.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRAJECTORY_MAGIC "NBODYTR1"
+
+static const float TRAJECTORY_PACKED_MAX = 65535.0f;
+
+// First page of a trajectory file, followed by the frames
+typedef struct {
+	char magic[8];
+	char layout[8];
+	int block_size;
+	int num_particles;
+	int num_blocks;
+	int format;
+	int interval;         // timesteps between frames
+	float time_interval;
+	uint64_t frame_size;  // bytes after each frame header
+} nbody_trajectory_header_t;
+
+typedef struct {
+	int step;
+	int format;
+	uint64_t size;
+} nbody_trajectory_frame_t;
+
+// Packed block: the origin and scale of each axis, then the offsets
+typedef struct {
+	float origin[3];
+	float scale[3];
+	uint16_t offset[3][BLOCK_SIZE];
+} nbody_trajectory_packed_t;
+
+// The solver packs each frame into one of the two snapshots while the writer
+// thread appends the other, so the solver only waits when both are pending
+struct nbody_trajectory_t {
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	void *snapshot[2];
+	int step[2];
+	int pending[2];
+	int next;
+	int format;
+	int num_blocks;
+	size_t frame_size;
+	int fd;
+	int finish;
+	int frames;
+	double write_time;
+	char name[1024];
+};
+
+static size_t nbody_trajectory_frame_size(int format, int num_blocks)
+{
+	switch (format) {
+		case NBODY_TRAJECTORY_POSITIONS:
+			return num_blocks * 3*BLOCK_SIZE*sizeof(float);
+		case NBODY_TRAJECTORY_PACKED:
+			return num_blocks * sizeof(nbody_trajectory_packed_t);
+		default:
+			return num_blocks * sizeof(particles_block_t);
+	}
+}
+
+// Offsets from the minimum of each block and axis, like the compressed
+// exchange of the positions between devices
+static void nbody_trajectory_pack(nbody_trajectory_packed_t *packed, const particles_block_t *block)
+{
+	const float *positions[3] = {block->position_x, block->position_y, block->position_z};
+	for (int c = 0; c < 3; c++) {
+		float minimum = positions[c][0], maximum = positions[c][0];
+		for (int e = 1; e < BLOCK_SIZE; e++) {
+			minimum = fminf(minimum, positions[c][e]);
+			maximum = fmaxf(maximum, positions[c][e]);
+		}
+		const float range = maximum - minimum;
+		const float inv_scale = range == 0 ? 0 : TRAJECTORY_PACKED_MAX / range;
+		packed->origin[c] = minimum;
+		packed->scale[c] = range / TRAJECTORY_PACKED_MAX;
+		for (int e = 0; e < BLOCK_SIZE; e++) {
+			packed->offset[c][e] = (uint16_t)MIN((positions[c][e] - minimum) * inv_scale + 0.5f, TRAJECTORY_PACKED_MAX);
+		}
+	}
+}
+
+static void nbody_trajectory_fill(const nbody_trajectory_t *traj, void *snapshot, const particles_block_t *particles)
+{
+	if (traj->format == NBODY_TRAJECTORY_POSITIONS) {
+		// The x, y and z positions are consecutive in a block
+		float *positions = snapshot;
+		for (int b = 0; b < traj->num_blocks; b++) {
+			memcpy(positions + b*3*BLOCK_SIZE, particles[b].position_x, 3*BLOCK_SIZE*sizeof(float));
+		}
+	} else if (traj->format == NBODY_TRAJECTORY_PACKED) {
+		nbody_trajectory_packed_t *packed = snapshot;
+		for (int b = 0; b < traj->num_blocks; b++) {
+			nbody_trajectory_pack(packed + b, particles + b);
+		}
+	} else {
+		memcpy(snapshot, particles, traj->frame_size);
+	}
+}
+
+static void * nbody_trajectory_writer(void *arg)
+{
+	nbody_trajectory_t *traj = arg;
+	int current = 0;
+
+	pthread_mutex_lock(&traj->lock);
+	while (1) {
+		while (!traj->pending[current] && !traj->finish) {
+			pthread_cond_wait(&traj->cond, &traj->lock);
+		}
+		if (!traj->pending[current]) break;
+
+		const nbody_trajectory_frame_t frame = {traj->step[current], traj->format, traj->frame_size};
+		pthread_mutex_unlock(&traj->lock);
+
+		const double start = get_time();
+		int ok = traj->fd >= 0;
+		ok = ok && nbody_write_all(traj->fd, &frame, sizeof(frame));
+		ok = ok && nbody_write_all(traj->fd, traj->snapshot[current], traj->frame_size);
+		const double end = get_time();
+
+		pthread_mutex_lock(&traj->lock);
+		if (ok) {
+			traj->frames++;
+		} else {
+			fprintf(stderr, "Warning: cannot write the frame of step %d to %s\n", frame.step, traj->name);
+		}
+		traj->write_time += end - start;
+		traj->pending[current] = 0;
+		pthread_cond_broadcast(&traj->cond);
+		current ^= 1;
+	}
+	pthread_mutex_unlock(&traj->lock);
+	return NULL;
+}
+
+static void nbody_trajectory_fill_header(nbody_trajectory_header_t *header, const nbody_trajectory_t *traj, const nbody_t *nbody, const nbody_conf_t *conf)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, TRAJECTORY_MAGIC, sizeof(header->magic));
+	strncpy(header->layout, PARTICLES_LAYOUT_NAME, sizeof(header->layout));
+	header->block_size = BLOCK_SIZE;
+	header->num_particles = nbody->num_particles;
+	header->num_blocks = nbody->num_blocks;
+	header->format = traj->format;
+	header->interval = conf->trajectory_interval;
+	header->time_interval = conf->time_interval;
+	header->frame_size = traj->frame_size;
+}
+
+// The trajectory of a restart must have the frames of this run. The frames
+// after the step of the checkpoint, written by the run that stopped, are
+// cut off with any partial frame, so the restart writes them again in order
+static void nbody_trajectory_resume(nbody_trajectory_t *traj, const nbody_t *nbody, const nbody_conf_t *conf)
+{
+	nbody_trajectory_header_t expected, header;
+	nbody_trajectory_fill_header(&expected, traj, nbody, conf);
+
+	struct stat st;
+	int err = fstat(traj->fd, &st);
+	assert(!err);
+
+	if (pread(traj->fd, &header, sizeof(header), 0) != sizeof(header)
+			|| memcmp(header.magic, expected.magic, sizeof(header.magic))
+			|| strncmp(header.layout, expected.layout, sizeof(header.layout))
+			|| header.block_size != expected.block_size || header.num_particles != expected.num_particles
+			|| header.num_blocks != expected.num_blocks || header.format != expected.format
+			|| header.frame_size != expected.frame_size) {
+		fprintf(stderr, "Trajectory %s has another layout, block size, number of particles or frame format than the restart\n", traj->name);
+		exit(1);
+	}
+	if (header.interval != expected.interval || header.time_interval != expected.time_interval) {
+		fprintf(stderr, "Warning: trajectory %s was written every %d timesteps of %e s\n", traj->name, header.interval, header.time_interval);
+	}
+
+	off_t end = PAGE_SIZE;
+	nbody_trajectory_frame_t frame;
+	while (end + (off_t)(sizeof(frame) + traj->frame_size) <= st.st_size
+			&& pread(traj->fd, &frame, sizeof(frame), end) == sizeof(frame)
+			&& frame.size == traj->frame_size && frame.step <= nbody->start_step) {
+		end += sizeof(frame) + traj->frame_size;
+	}
+	if (end < st.st_size) {
+		fprintf(stderr, "Dropping the trajectory frames after step %d of %s\n", nbody->start_step, traj->name);
+		err = ftruncate(traj->fd, end);
+		assert(!err);
+	}
+	if (lseek(traj->fd, end, SEEK_SET) != end) {
+		fprintf(stderr, "Warning: cannot append to the trajectory %s\n", traj->name);
+	}
+}
+
+nbody_trajectory_t * nbody_trajectory_create(const nbody_t *nbody, const nbody_conf_t *conf)
+{
+	nbody_trajectory_t *traj = malloc(sizeof(nbody_trajectory_t));
+	assert(traj != NULL);
+
+	memset(traj, 0, sizeof(nbody_trajectory_t));
+	traj->format = conf->trajectory_format;
+	traj->num_blocks = nbody->num_blocks;
+	traj->frame_size = nbody_trajectory_frame_size(traj->format, nbody->num_blocks);
+	traj->snapshot[0] = nbody_alloc(traj->frame_size);
+	traj->snapshot[1] = nbody_alloc(traj->frame_size);
+
+	struct stat st = {0};
+	if (stat("data", &st) == -1) {
+		mkdir("data", 0755);
+	}
+
+	// A restart appends to the frames of the previous run
+	sprintf(traj->name, "%s.traj", nbody->file.name);
+	const int append = nbody->start_step > 0 && !access(traj->name, F_OK);
+	traj->fd = open(traj->name, append ? O_RDWR : O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (traj->fd < 0) {
+		fprintf(stderr, "Warning: cannot open the trajectory %s\n", traj->name);
+	} else if (append) {
+		nbody_trajectory_resume(traj, nbody, conf);
+	} else {
+		nbody_trajectory_header_t header;
+		nbody_trajectory_fill_header(&header, traj, nbody, conf);
+
+		char page[PAGE_SIZE] = {0};
+		memcpy(page, &header, sizeof(header));
+		if (!nbody_write_all(traj->fd, page, PAGE_SIZE)) {
+			fprintf(stderr, "Warning: cannot write the trajectory %s\n", traj->name);
+		}
+	}
+
+	int err = pthread_mutex_init(&traj->lock, NULL);
+	err |= pthread_cond_init(&traj->cond, NULL);
+	err |= pthread_create(&traj->writer, NULL, nbody_trajectory_writer, traj);
+	assert(!err);
+
+	return traj;
+}
+
+void nbody_trajectory_save(nbody_trajectory_t *traj, const particles_block_t *particles, int step)
+{
+	const int b = traj->next;
+
+	pthread_mutex_lock(&traj->lock);
+	while (traj->pending[b]) {
+		pthread_cond_wait(&traj->cond, &traj->lock);
+	}
+	pthread_mutex_unlock(&traj->lock);
+
+	// The writer does not touch a snapshot until it is pending
+	nbody_trajectory_fill(traj, traj->snapshot[b], particles);
+
+	pthread_mutex_lock(&traj->lock);
+	traj->step[b] = step;
+	traj->pending[b] = 1;
+	traj->next = b ^ 1;
+	pthread_cond_signal(&traj->cond);
+	pthread_mutex_unlock(&traj->lock);
+}
+
+void nbody_trajectory_finish(nbody_trajectory_t *traj)
+{
+	pthread_mutex_lock(&traj->lock);
+	traj->finish = 1;
+	pthread_cond_signal(&traj->cond);
+	pthread_mutex_unlock(&traj->lock);
+
+	int err = pthread_join(traj->writer, NULL);
+	assert(!err);
+
+	fprintf(stderr, "Trajectory frames %d written to %s in %fs\n", traj->frames, traj->name, traj->write_time);
+
+	if (traj->fd >= 0) {
+		err = close(traj->fd);
+		assert(!err);
+	}
+	nbody_dealloc(traj->snapshot[0], traj->frame_size);
+	nbody_dealloc(traj->snapshot[1], traj->frame_size);
+	err = pthread_cond_destroy(&traj->cond);
+	err |= pthread_mutex_destroy(&traj->lock);
+	assert(!err);
+	free(traj);
+}
@@ -9,6 +9,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <ieee754.h>
@@ -40,17 +41,16 @@ void nbody_generate_particles(const nbody_conf_t *conf, const nbody_file_t *file
 	const int fd = open(fname, O_RDWR|O_CREAT|O_TRUNC, 0644);
 	assert(fd >= 0);
 	
-	const int size = file->size;
+	const size_t size = file->size;
 	assert(size % PAGE_SIZE == 0);
 	
 	int err = ftruncate(fd, size);
 	assert(!err);
 	
 	particles_block_t * const particles = mmap(NULL, size, PROT_WRITE|PROT_READ, MAP_SHARED, fd, 0);
+	assert(particles != MAP_FAILED);
 	
-	for(int i = 0; i < conf->num_blocks; i++) {
-		nbody_particle_init(conf, particles+i);
-	}
+	nbody_generate_blocks(conf, particles);
 	
 	err = munmap(particles, size);
 	assert(!err);
@@ -59,13 +59,71 @@ void nbody_generate_particles(const nbody_conf_t *conf, const nbody_file_t *file
 	assert(!err);
 }
 
-void nbody_check(const nbody_t *nbody)
+// FNV-1a of every parameter that changes the reference
+static unsigned long long nbody_reference_hash(const nbody_conf_t *conf)
+{
+	const struct {
+		int version;
+		int num_particles;
+		int block_size;
+		int timesteps;
+		int seed;
+		float time_interval;
+		float domain_size_x;
+		float domain_size_y;
+		float domain_size_z;
+		float mass_maximum;
+		char layout[8];
+	} key = {1, conf->num_particles, BLOCK_SIZE, conf->timesteps, conf->seed, conf->time_interval,
+		conf->domain_size_x, conf->domain_size_y, conf->domain_size_z, conf->mass_maximum, PARTICLES_LAYOUT_NAME};
+	
+	const unsigned char *bytes = (const unsigned char *)&key;
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < sizeof(key); i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// Integrates the initial particles in fp64 into the cache file of the
+// configuration, which the next runs reuse
+static void nbody_compute_reference(const nbody_conf_t *conf, const nbody_file_t *file, const char *fname)
+{
+	fprintf(stderr, "Computing the fp64 reference of %d particles and %d timesteps into %s\n", conf->num_particles, conf->timesteps, fname);
+	
+	particles_block_t *particles = nbody_alloc(file->size);
+	nbody_generate_blocks(conf, particles);
+	nbody_reference_solve(conf, particles);
+	
+	char tmp[1100];
+	sprintf(tmp, "%s.tmp", fname);
+	const int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	assert(fd >= 0);
+	
+	int ok = nbody_write_all(fd, particles, file->size);
+	ok = !close(fd) && ok;
+	ok = ok && !rename(tmp, fname);
+	assert(ok);
+	
+	nbody_dealloc(particles, file->size);
+}
+
+// The .ref file of the run when there is one, and otherwise the cached fp64
+// reference of the configuration, computed by the first run that needs it
+const particles_block_t * nbody_open_reference(const nbody_t *nbody, const nbody_conf_t *conf, int *computed)
 {
 	char fname[1024];
 	sprintf(fname, "%s.ref", nbody->file.name);
-	if (access(fname, F_OK) != 0) {
-		fprintf(stderr, "Warning: %s file does not exist. Skipping the check...\n", fname);
-		return;
+	*computed = access(fname, F_OK) != 0;
+	if (*computed) {
+		sprintf(fname, "%s-ref-%016llx.ref", conf->name, nbody_reference_hash(conf));
+		if (access(fname, F_OK) != 0) {
+			struct stat st = {0};
+			if (stat("data", &st) == -1) {
+				mkdir("data", 0755);
+			}
+			nbody_compute_reference(conf, &nbody->file, fname);
+		}
 	}
 	
 	const int fd = open(fname, O_RDONLY, 0);
@@ -74,17 +132,30 @@ void nbody_check(const nbody_t *nbody)
 	particles_block_t *reference = mmap(NULL, nbody->file.size, PROT_READ, MAP_SHARED, fd, 0);
 	assert(reference != MAP_FAILED);
 	
-	if (nbody_compare_particles(nbody->particles, reference, nbody->num_blocks)) {
+	int err = close(fd);
+	assert(!err);
+	
+	return reference;
+}
+
+void nbody_close_reference(const nbody_t *nbody, const particles_block_t *reference)
+{
+	int err = munmap((void *)reference, nbody->file.size);
+	assert(!err);
+}
+
+void nbody_check(const nbody_t *nbody, const nbody_conf_t *conf)
+{
+	int computed;
+	const particles_block_t *reference = nbody_open_reference(nbody, conf, &computed);
+	
+	if (nbody_compare_particles(nbody->particles, reference, nbody->num_blocks, conf->check_ulp, computed)) {
 		printf("Result validation: OK\n");
 	} else {
 		printf("Result validation: ERROR\n");
 	}
 	
-	int err = munmap(reference, nbody->file.size);
-	assert(!err);
-	
-	err = close(fd);
-	assert(!err);
+	nbody_close_reference(nbody, reference);
 }
 
 nbody_file_t nbody_setup_file(const nbody_conf_t *conf)
@@ -92,10 +163,33 @@ nbody_file_t nbody_setup_file(const nbody_conf_t *conf)
 	nbody_file_t file;
 	file.size = conf->num_blocks * sizeof(particles_block_t);
 	
-	sprintf(file.name, "%s-%d-%d-%d", conf->name, conf->num_blocks * BLOCK_SIZE, BLOCK_SIZE, conf->timesteps);
+	sprintf(file.name, "%s-%d-%d-%d-%s-%d", conf->name, conf->num_particles, BLOCK_SIZE, conf->timesteps, PARTICLES_LAYOUT_NAME, conf->seed);
 	return file;
 }
 
+// One task per huge page of blocks, so each page is first touched by a
+// single worker and placed on the NUMA node of that worker
+void nbody_read_blocks(int fd, off_t offset, particles_block_t *particles, int num_blocks)
+{
+	const int touch = TOUCH_BLOCKS(sizeof(particles_block_t));
+	for (int first = 0; first < num_blocks; first += touch) {
+		const int last = MIN(first + touch, num_blocks);
+		#pragma oss task label("read_block") out(particles[first;last-first]) firstprivate(first, last)
+		{
+			char *ptr = (char *)(particles + first);
+			const size_t size = (last - first) * sizeof(particles_block_t);
+			const off_t start = offset + first * sizeof(particles_block_t);
+			for (size_t done = 0; done < size; ) {
+				const ssize_t n = pread(fd, ptr + done, size - done, start + done);
+				if (n < 0 && errno == EINTR) continue;
+				assert(n > 0);
+				done += n;
+			}
+		}
+	}
+	#pragma oss taskwait
+}
+
 particles_block_t * nbody_load_particles(const nbody_conf_t *conf, const nbody_file_t *file)
 {
 	char fname[1024];
@@ -104,13 +198,27 @@ particles_block_t * nbody_load_particles(const nbody_conf_t *conf, const nbody_f
 	const int fd = open(fname, O_RDONLY, 0);
 	assert(fd >= 0);
 	
-	void * const ptr = mmap(NULL, file->size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
-	assert(ptr != MAP_FAILED);
+	particles_block_t * const particles = nbody_alloc(file->size);
+	nbody_read_blocks(fd, 0, particles, conf->num_blocks);
 	
 	int err = close(fd);
 	assert(!err);
 	
-	return ptr;
+	return particles;
+}
+
+// The force blocks are zeroed by a task per huge page, like the particles.
+// A block does not divide a huge page, so the tasks split the bytes instead
+static forces_block_t * nbody_alloc_forces(int num_blocks)
+{
+	forces_block_t * const forces = nbody_alloc(FORCES_ALLOC_SIZE(num_blocks));
+	const size_t size = num_blocks * sizeof(forces_block_t);
+	for (size_t first = 0; first < size; first += HUGE_PAGE_SIZE) {
+		#pragma oss task label("zero_forces") firstprivate(first)
+		memset((char *)forces + first, 0, MIN((size_t)HUGE_PAGE_SIZE, size - first));
+	}
+	#pragma oss taskwait
+	return forces;
 }
 
 nbody_t nbody_setup(const nbody_conf_t *conf)
@@ -118,28 +226,46 @@ nbody_t nbody_setup(const nbody_conf_t *conf)
 	nbody_t nbody;
 	nbody.timesteps = conf->timesteps;
 	nbody.num_blocks = conf->num_blocks;
+	nbody.num_particles = conf->num_particles;
+	nbody.start_step = 0;
 	
 	nbody_file_t file = nbody_setup_file(conf);
 	nbody.file = file;
 	
-	if (conf->force_generation) {
+	if (conf->restart_file) {
 		nbody.particles = nbody_alloc(conf->num_blocks * sizeof(particles_block_t));
 		assert(nbody.particles != NULL);
 		
-		for (int i = 0; i < conf->num_blocks; i++) {
-			nbody_particle_init(conf, nbody.particles+i);
-		}
+		nbody.start_step = nbody_checkpoint_load(conf, nbody.particles);
+		nbody.timesteps = conf->timesteps - nbody.start_step;
 		
-		nbody.forces = nbody_alloc(conf->num_blocks * sizeof(forces_block_t));
+		nbody.forces = nbody_alloc_forces(conf->num_blocks);
 		assert(nbody.forces != NULL);
 	}
+	else if (conf->force_generation) {
+		nbody.particles = nbody_alloc(conf->num_blocks * sizeof(particles_block_t));
+		assert(nbody.particles != NULL);
+		
+		nbody_generate_blocks(conf, nbody.particles);
+		
+		nbody.forces = nbody_alloc_forces(conf->num_blocks);
+		assert(nbody.forces != NULL);
+	}
+	else if (conf->out_of_core) {
+		// Only the chunks in flight are ever backed, main streams the .in
+		// file through them to the devices
+		nbody_generate_particles(conf, &file);
+		
+		nbody.particles = nbody_reserve(file.size);
+		nbody.forces = nbody_reserve(FORCES_ALLOC_SIZE(conf->num_blocks));
+	}
 	else {
 		nbody_generate_particles(conf, &file);
 		
 		nbody.particles = nbody_load_particles(conf, &file);
 		assert(nbody.particles != NULL);
 		
-		nbody.forces = nbody_alloc(conf->num_blocks * sizeof(forces_block_t));
+		nbody.forces = nbody_alloc_forces(conf->num_blocks);
 		assert(nbody.forces != NULL);
 	}
 	
@@ -154,7 +280,7 @@ void nbody_save_particles(const nbody_t *nbody)
 	const int fd = open(fname, O_RDWR|O_CREAT|O_TRUNC, 0644);
 	assert(fd >= 0);
 	
-	const int size = nbody->file.size;
+	const size_t size = nbody->file.size;
 	assert(size % PAGE_SIZE == 0);
 	
 	int err = ftruncate(fd, size);
@@ -174,8 +300,7 @@ void nbody_save_particles(const nbody_t *nbody)
 
 void nbody_free(nbody_t *nbody)
 {
-	int err = munmap(nbody->particles, nbody->num_blocks * sizeof(particles_block_t));
-	err |= munmap(nbody->forces, nbody->num_blocks * sizeof(forces_block_t));
-	assert(!err);
+	nbody_dealloc(nbody->particles, nbody->num_blocks * sizeof(particles_block_t));
+	nbody_dealloc(nbody->forces, FORCES_ALLOC_SIZE(nbody->num_blocks));
 }
 